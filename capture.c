@@ -0,0 +1,102 @@
+/**
+ * @file capture.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "print.h"
+
+struct capture {
+	struct capture_header *hdr;
+	struct capture_record *ring;
+	uint64_t head;
+	unsigned int mask;
+	size_t size;
+};
+
+struct capture *capture_create(const char *path, unsigned int length)
+{
+	struct capture *cap;
+	unsigned int n = 1;
+	void *map;
+	int fd;
+
+	while (n < length && n < (1U << 28))
+		n <<= 1;
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+	cap->size = CAPTURE_HEADER_SIZE + (size_t) n * sizeof(*cap->ring);
+	cap->mask = n - 1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		pr_err("failed to open capture file %s: %m", path);
+		goto no_file;
+	}
+	if (ftruncate(fd, cap->size)) {
+		pr_err("failed to resize capture file %s: %m", path);
+		goto no_map;
+	}
+	map = mmap(NULL, cap->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		pr_err("failed to map capture file %s: %m", path);
+		goto no_map;
+	}
+	close(fd);
+
+	cap->hdr = map;
+	cap->ring = (struct capture_record *)
+		((char *) map + CAPTURE_HEADER_SIZE);
+	cap->hdr->magic = CAPTURE_MAGIC;
+	cap->hdr->version = CAPTURE_VERSION;
+	cap->hdr->record_size = sizeof(*cap->ring);
+	cap->hdr->length = n;
+	return cap;
+
+no_map:
+	close(fd);
+no_file:
+	free(cap);
+	return NULL;
+}
+
+void capture_destroy(struct capture *cap)
+{
+	munmap(cap->hdr, cap->size);
+	free(cap);
+}
+
+void capture_add(struct capture *cap, const struct capture_record *r)
+{
+	struct capture_record *dst = &cap->ring[cap->head & cap->mask];
+
+	/* Invalidate the slot while it is rewritten. */
+	__atomic_store_n(&dst->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((char *) dst + sizeof(dst->seq), (const char *) r + sizeof(r->seq),
+	       sizeof(*r) - sizeof(r->seq));
+	cap->head++;
+	__atomic_store_n(&dst->seq, (uint32_t) cap->head, __ATOMIC_RELEASE);
+	__atomic_store_n(&cap->hdr->head, cap->head, __ATOMIC_RELEASE);
+}
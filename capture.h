@@ -0,0 +1,95 @@
+/**
+ * @file capture.h
+ * @brief Binary capture of the time stamps and servo samples to a file.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_CAPTURE_H
+#define HAVE_CAPTURE_H
+
+#include <stdint.h>
+
+/*
+ * The capture file is a header followed by a ring of fixed size records,
+ * in host byte order. The header is padded to CAPTURE_HEADER_SIZE bytes.
+ */
+#define CAPTURE_MAGIC		0x50504350 /* "PCPP" */
+#define CAPTURE_VERSION		1
+#define CAPTURE_HEADER_SIZE	64
+
+struct capture_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t length;	/* number of records in the ring, a power of two */
+	uint32_t reserved;
+	uint64_t head;		/* number of records ever written */
+};
+
+enum capture_type {
+	CAPTURE_SYNC = 1,	/* t1, t2 of a (follow up) sync */
+	CAPTURE_DELAY,		/* t3, t4 of a delay request and response */
+	CAPTURE_PDELAY,		/* t1 .. t4 of a peer delay exchange */
+	CAPTURE_SERVO,		/* corrected t1, t2 and the servo output */
+};
+
+/*
+ * Time stamps are in nanoseconds, the correction and asymmetry are in
+ * the 2^-16 nanosecond units of the correctionField. The record written
+ * as the n-th record since the start has seq set to n + 1, so readers can
+ * tell stale and partially written records.
+ */
+struct capture_record {
+	uint32_t seq;
+	uint8_t type;		/* enum capture_type */
+	uint8_t state;		/* enum servo_state, CAPTURE_SERVO only */
+	uint16_t port;		/* port number, 0 for CAPTURE_SERVO */
+	int64_t t1;
+	int64_t t2;
+	int64_t t3;
+	int64_t t4;
+	int64_t correction;
+	int64_t asymmetry;
+	int64_t offset;		/* master offset, path delay or peer delay */
+	double adj;		/* frequency adjustment in ppb */
+};
+
+/** Opaque type */
+struct capture;
+
+/**
+ * Create a capture file, replacing an existing one, and map it into memory.
+ * @param path    The name of the file.
+ * @param length  Number of records, rounded up to a power of two. Once the
+ *                ring is full, the oldest records are overwritten.
+ * @return        A pointer to a new capture on success, NULL otherwise.
+ */
+struct capture *capture_create(const char *path, unsigned int length);
+
+/**
+ * Unmap and close a capture file. The file itself is kept.
+ * @param cap  Pointer obtained via @ref capture_create().
+ */
+void capture_destroy(struct capture *cap);
+
+/**
+ * Append a record to the capture file. There must be only one writer.
+ * @param cap  Pointer obtained via @ref capture_create().
+ * @param r    The record to copy, its seq field is ignored.
+ */
+void capture_add(struct capture *cap, const struct capture_record *r);
+
+#endif
@@ -18,21 +18,23 @@
  */
 #include <errno.h>
 #include <linux/net_tstamp.h>
-#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
 
 #include "rv_ptp_ifc.h"
 
 #include "address.h"
 #include "bmc.h"
+#include "capture.h"
 #include "clock.h"
 #include "clockadj.h"
 #include "clockcheck.h"
 #include "foreign.h"
 #include "filter.h"
+#include "freqstate.h"
 #include "hash.h"
 #include "missing.h"
 #include "msg.h"
@@ -40,8 +42,11 @@
 #include "port.h"
 #include "servo.h"
 #include "stats.h"
+#include "telemetry.h"
+#include "timerq.h"
 #include "print.h"
 #include "rtnl.h"
+#include "rxthread.h"
 #include "sk.h"
 #include "tlv.h"
 #include "tsproc.h"
@@ -49,6 +54,20 @@
 #include "util.h"
 
 #define N_CLOCK_PFD (N_POLLFD + 1) /* one extra per port, for the fault timer */
+#define N_CLOCK_EVENTS 64
+/*
+ * The epoll data of each descriptor, RT netlink and the timer queue
+ * first, then CLOCK_EV_PORT + slot * N_CLOCK_PFD + index for the ports,
+ * 'slot' being the port's position in the slot table and 'index' its
+ * fd index. The expired port timers are turned into events with their
+ * FD_*_TIMER index, N_POLLFD for the fault timer.
+ */
+#define CLOCK_EV_RTNL 0
+#define CLOCK_EV_TIMER 1
+#define CLOCK_EV_PORT 2
+#define CLOCK_EV_DATA(slot, index) (CLOCK_EV_PORT + (slot) * N_CLOCK_PFD + (index))
+#define CLOCK_EV_SLOT(data) (((data) - CLOCK_EV_PORT) / N_CLOCK_PFD)
+#define CLOCK_EV_INDEX(data) (((data) - CLOCK_EV_PORT) % N_CLOCK_PFD)
 #define POW2_41 ((double)(1ULL << 41))
 
 extern void port_log_path_delay(struct port *p);
@@ -94,10 +113,20 @@ struct clock {
 	struct ClockIdentity ptl[PATH_TRACE_MAX];
 	struct foreign_clock *best;
 	struct ClockIdentity best_id;
+	/* Port identity of the master the clock synchronizes to. */
+	struct PortIdentity best_source;
+	/* Ebest and the default data set as of the last state decision. */
+	struct dataset ebest;
+	struct dataset ebest_dds;
 	LIST_HEAD(ports_head, port) ports;
 	struct port *uds_port;
-	struct pollfd *pollfd;
-	int pollfd_valid;
+	int epoll_fd;
+	int rtnl_fd;
+	struct timerq *timerq;
+	struct rxthread **rx_threads;
+	int n_rx_threads;
+	struct port **slots; /* indexed by the slot in the epoll data */
+	int nslots;
 	int nports; /* does not include the UDS port */
 	int last_port_number;
 	int sde;
@@ -114,6 +143,13 @@ struct clock {
 	int time_source; /* grand master role */
 	enum servo_state servo_state;
 	tmv_t master_offset;
+	tmv_t source_offset; /* master_offset before the UTC correction */
+	/* Part of the handover phase step not yet passed to the servo. */
+	tmv_t handover;
+	tmv_t handover_ts;
+	int handover_max_offset;
+	double handover_slew_rate;
+	unsigned int rv_dirty; /* RV_PTP_DIRTY_* bits not yet exported */
 	tmv_t path_delay;
 	tmv_t ingress_ts;
 	struct tsproc *tsproc;
@@ -124,6 +160,9 @@ struct clock {
 	struct clock_stats stats;
 	int stats_interval;
 	struct clockcheck *sanity_check;
+	struct telemetry *telemetry;
+	struct capture *capture;
+	struct freqstate *freqstate;
 	struct interface uds_interface;
 	LIST_HEAD(clock_subscribers_head, clock_subscriber) subscribers;
 };
@@ -131,7 +170,11 @@ struct clock {
 struct clock the_clock;
 
 static void handle_state_decision_event(struct clock *c);
-static int clock_resize_pollfd(struct clock *c, int new_nports);
+static int clock_add_slot(struct clock *c, struct port *p);
+static int clock_create_rx_threads(struct clock *c, struct config *config);
+static int clock_port_slot(struct clock *c, struct port *p);
+static int clock_watch(struct clock *c, int fd, uint32_t events,
+		       uint64_t data);
 static void clock_remove_port(struct clock *c, struct port *p);
 
 static int cid_eq(struct ClockIdentity *a, struct ClockIdentity *b)
@@ -274,16 +317,27 @@ void clock_send_notification(struct clock *c, struct ptp_message *msg,
 void clock_destroy(struct clock *c)
 {
 	struct port *p, *tmp;
+	int i;
 
 	clock_flush_subscriptions(c);
 	LIST_FOREACH_SAFE(p, &c->ports, list, tmp) {
 		clock_remove_port(c, p);
 	}
-	if (c->pollfd[0].fd >= 0) {
-		rtnl_close(c->pollfd[0].fd);
+	if (c->rtnl_fd >= 0) {
+		rtnl_close(c->rtnl_fd);
 	}
 	port_close(c->uds_port);
-	free(c->pollfd);
+	for (i = 0; i < c->n_rx_threads; i++) {
+		rxthread_destroy(c->rx_threads[i]);
+	}
+	free(c->rx_threads);
+	if (c->timerq) {
+		timerq_destroy(c->timerq);
+	}
+	if (c->epoll_fd >= 0) {
+		close(c->epoll_fd);
+	}
+	free(c->slots);
 	hash_destroy(c->index2port, NULL);
 	if (c->clkid != CLOCK_REALTIME) {
 		phc_close(c->clkid);
@@ -295,6 +349,12 @@ void clock_destroy(struct clock *c)
 	stats_destroy(c->stats.delay);
 	if (c->sanity_check)
 		clockcheck_destroy(c->sanity_check);
+	if (c->telemetry)
+		telemetry_destroy(c->telemetry);
+	if (c->capture)
+		capture_destroy(c->capture);
+	if (c->freqstate)
+		freqstate_destroy(c->freqstate);
 	memset(c, 0, sizeof(*c));
 	msg_cleanup();
 }
@@ -372,6 +432,8 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 	struct time_status_np *tsn;
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
+	struct msg_pool_stats_np *mps;
+	struct msg_pool_stats stats;
 	struct PTPText *text;
 
 	tlv = (struct management_tlv *) rsp->management.suffix;
@@ -484,6 +546,16 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		clock_get_subscription(c, req, sen->bitmask, &sen->duration);
 		respond = 1;
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		msg_pool_get_stats(&stats);
+		mps = (struct msg_pool_stats_np *) tlv->data;
+		mps->size = stats.size;
+		mps->in_use = stats.in_use;
+		mps->high_water = stats.high_water;
+		mps->exhausted = stats.exhausted;
+		datalen = sizeof(*mps);
+		respond = 1;
+		break;
 	}
 	if (respond) {
 		if (datalen % 2) {
@@ -796,6 +868,16 @@ UInteger8 clock_class(struct clock *c)
 	return c->dds.clockQuality.clockClass;
 }
 
+struct telemetry *clock_telemetry(struct clock *c)
+{
+	return c->telemetry;
+}
+
+struct capture *clock_capture(struct clock *c)
+{
+	return c->capture;
+}
+
 struct config *clock_config(struct clock *c)
 {
 	return c->config;
@@ -809,12 +891,12 @@ static int clock_add_port(struct clock *c, int phc_index,
 	int fd, index;
 	char key[16];
 
-	if (clock_resize_pollfd(c, c->nports + 1)) {
-		return -1;
-	}
 	p = port_open(phc_index, timestamping, ++c->last_port_number, iface, c);
 	if (!p) {
-		/* No need to shrink pollfd */
+		return -1;
+	}
+	if (clock_add_slot(c, p)) {
+		port_close(p);
 		return -1;
 	}
 	LIST_FOREACH(piter, &c->ports, list) {
@@ -826,7 +908,6 @@ static int clock_add_port(struct clock *c, int phc_index,
 		LIST_INSERT_HEAD(&c->ports, p, list);
 	}
 	c->nports++;
-	clock_fda_changed(c);
 
 	/* Remember the index to port mapping, for link status tracking. */
 	fd = sk_interface_fd();
@@ -849,14 +930,14 @@ static int clock_add_port(struct clock *c, int phc_index,
 
 static void clock_remove_port(struct clock *c, struct port *p)
 {
-	/* Do not call clock_resize_pollfd, it's pointless to shrink
-	 * the allocated memory at this point, clock_destroy will free
-	 * it all anyway. This function is usable from other parts of
-	 * the code, but even then we don't mind if pollfd is larger
-	 * than necessary. */
+	int slot = clock_port_slot(c, p);
+
+	/* The slot is reused by the next port. Closing the descriptors
+	 * removes them from the epoll set. */
+	if (slot >= 0)
+		c->slots[slot] = NULL;
 	LIST_REMOVE(p, list);
 	c->nports--;
-	clock_fda_changed(c);
 	port_close(p);
 }
 
@@ -866,6 +947,8 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	enum timestamp_type timestamping =
 		config_get_int(config, NULL, "time_stamping");
 	int fadj = 0, max_adj = 0, sw_ts = timestamping == TS_SOFTWARE ? 1 : 0;
+	char state_id[64];
+	struct freqstate_saved saved;
 	enum servo_type servo = config_get_int(config, NULL, "clock_servo");
 	int phc_index;
         unsigned required_modes = 0;
@@ -875,7 +958,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	char phc[32], *tmp;
 	struct interface *iface, *udsif = &c->uds_interface;
 	struct timespec ts;
-	int sfl;
+	int sfl, tl;
 
 	clock_gettime(CLOCK_REALTIME, &ts);
 	srandom(ts.tv_sec ^ ts.tv_nsec);
@@ -1046,6 +1129,11 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	c->config = config;
 	c->free_running = config_get_int(config, NULL, "free_running");
 	c->freq_est_interval = config_get_int(config, NULL, "freq_est_interval");
+	c->handover_max_offset = config_get_int(config, NULL, "handover_max_offset");
+	c->handover_slew_rate = config_get_double(config, NULL, "handover_slew_rate");
+	/* Offsets measured with different PHCs can not be compared. */
+	if (config_get_int(config, NULL, "boundary_clock_jbod"))
+		c->handover_max_offset = 0;
 	c->grand_master_capable = config_get_int(config, NULL, "gmCapable");
 	c->kernel_leap = config_get_int(config, NULL, "kernel_leap");
 	c->utc_offset = CURRENT_UTC_OFFSET;
@@ -1086,6 +1174,24 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		   and return 0. Set the frequency back to make sure fadj is
 		   the actual frequency of the clock. */
 		clockadj_set_freq(c->clkid, fadj);
+
+		/* Start from the frequency of the last run, if any. */
+		snprintf(state_id, sizeof(state_id), "%s@%s",
+			 cid2str(&c->dds.clockIdentity),
+			 phc_index >= 0 ? phc : "CLOCK_REALTIME");
+		c->freqstate = freqstate_create(
+			config_get_string(config, NULL, "servo_state_file"),
+			state_id, c->clkid,
+			config_get_int(config, NULL, "servo_state_interval"),
+			config_get_int(config, NULL, "servo_state_max_age"));
+		if (!c->freqstate) {
+			pr_err("Failed to create servo state");
+			return NULL;
+		}
+		if (!freqstate_restore(c->freqstate, &saved)) {
+			fadj = (int) -saved.freq;
+			clockadj_set_freq(c->clkid, fadj);
+		}
 	}
 	c->servo = servo_create(c->config, servo, -fadj, max_adj, sw_ts);
 	if (!c->servo) {
@@ -1110,6 +1216,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	c->stats.offset = stats_create();
 	c->stats.freq = stats_create();
 	c->stats.delay = stats_create();
+	c->rv_dirty = RV_PTP_DIRTY_ALL;
 	if (!c->stats.offset || !c->stats.freq || !c->stats.delay) {
 		pr_err("failed to create stats");
 		return NULL;
@@ -1122,6 +1229,23 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 			return NULL;
 		}
 	}
+	tl = config_get_int(config, NULL, "telemetry_length");
+	if (tl) {
+		c->telemetry = telemetry_create(tl);
+		if (!c->telemetry) {
+			pr_err("Failed to create telemetry ring");
+			return NULL;
+		}
+	}
+	tmp = config_get_string(config, NULL, "capture_file");
+	if (tmp[0]) {
+		c->capture = capture_create(tmp, config_get_int(config, NULL,
+							"capture_length"));
+		if (!c->capture) {
+			pr_err("Failed to create capture file");
+			return NULL;
+		}
+	}
 
 	/* Initialize the parentDS. */
 	clock_update_grandmaster(c);
@@ -1136,14 +1260,34 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	LIST_INIT(&c->ports);
 	c->last_port_number = 0;
 
-	if (clock_resize_pollfd(c, 0)) {
-		pr_err("failed to allocate pollfd");
+	c->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (c->epoll_fd < 0) {
+		pr_err("failed to create epoll instance: %m");
+		return NULL;
+	}
+
+	/* All of the port timers share one timerfd. */
+	c->timerq = timerq_create();
+	if (!c->timerq) {
+		return NULL;
+	}
+	if (clock_watch(c, timerq_fd(c->timerq), EPOLLIN, CLOCK_EV_TIMER)) {
+		pr_err("failed to watch the timer queue: %m");
+		return NULL;
+	}
+
+	if (clock_create_rx_threads(c, config)) {
+		pr_err("failed to start the receive threads");
 		return NULL;
 	}
 
 	/* Open a RT netlink socket. */
-	c->pollfd[0].fd = rtnl_open();
-	c->pollfd[0].events = POLLIN|POLLPRI;
+	c->rtnl_fd = rtnl_open();
+	if (c->rtnl_fd >= 0 &&
+	    clock_watch(c, c->rtnl_fd, EPOLLIN|EPOLLPRI, CLOCK_EV_RTNL)) {
+		pr_err("failed to watch RT netlink: %m");
+		return NULL;
+	}
 
 	/* Create the UDS interface. */
 	c->uds_port = port_open(phc_index, timestamping, 0, udsif, c);
@@ -1151,7 +1295,10 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		pr_err("failed to open the UDS port");
 		return NULL;
 	}
-	clock_fda_changed(c);
+	if (clock_add_slot(c, c->uds_port)) {
+		pr_err("failed to allocate the UDS port slot");
+		return NULL;
+	}
 
 	c->index2port = hash_create();
 	if (!c->index2port) {
@@ -1172,8 +1319,8 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		port_dispatch(p, EV_INITIALIZE, 0);
 	}
 	port_dispatch(c->uds_port, EV_INITIALIZE, 0);
-	if (c->pollfd[0].fd >= 0) {
-		rtnl_link_query(c->pollfd[0].fd);
+	if (c->rtnl_fd >= 0) {
+		rtnl_link_query(c->rtnl_fd);
 	}
 	return c;
 }
@@ -1235,55 +1382,128 @@ struct ClockIdentity clock_identity(struct clock *c)
 	return c->dds.clockIdentity;
 }
 
-static int clock_resize_pollfd(struct clock *c, int new_nports)
+static int clock_watch(struct clock *c, int fd, uint32_t events,
+		       uint64_t data)
 {
-	struct pollfd *new_pollfd;
+	struct epoll_event ev = {
+		.events = events,
+		.data.u64 = data,
+	};
 
-	/*
-	 * Need to allocate one descriptor for RT netlink and one
-	 * whole extra block of fds for UDS.
-	 */
-	new_pollfd = realloc(c->pollfd,
-			     (1 + (new_nports + 1) * N_CLOCK_PFD) *
-			     sizeof(struct pollfd));
-	if (!new_pollfd)
+	/* Closed descriptors have already left the epoll set. */
+	if (!epoll_ctl(c->epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+		return 0;
+	if (errno != ENOENT)
 		return -1;
-	c->pollfd = new_pollfd;
+	return epoll_ctl(c->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int clock_port_slot(struct clock *c, struct port *p)
+{
+	int slot;
+
+	for (slot = 0; slot < c->nslots; slot++) {
+		if (c->slots[slot] == p)
+			return slot;
+	}
+	return -1;
+}
+
+static int clock_add_slot(struct clock *c, struct port *p)
+{
+	struct port **slots;
+	int i;
+
+	i = clock_port_slot(c, NULL);
+	if (i < 0) {
+		i = c->nslots;
+		slots = realloc(c->slots, (c->nslots + 1) * sizeof(*slots));
+		if (!slots)
+			return -1;
+		c->slots = slots;
+		c->nslots++;
+	}
+	c->slots[i] = p;
+	/* Expired timers then map to their event without a lookup. */
+	port_tag_timers(p, CLOCK_EV_DATA(i, 0));
 	return 0;
 }
 
-static void clock_fill_pollfd(struct pollfd *dest, struct port *p)
+void clock_fda_changed(struct clock *c, struct port *p)
 {
+	int fd, i, rxq_fd, slot;
 	struct fdarray *fda;
-	int i;
+	uint32_t events;
+
+	slot = clock_port_slot(c, p);
+	if (slot < 0)
+		return;
 
 	fda = port_fda(p);
+	rxq_fd = port_rxq_fd(p);
 	for (i = 0; i < N_POLLFD; i++) {
-		dest[i].fd = fda->fd[i];
-		dest[i].events = POLLIN|POLLPRI;
+		fd = fda->fd[i];
+		events = EPOLLIN|EPOLLPRI;
+		/*
+		 * A receive thread reads the sockets, leaving only the
+		 * transmit time stamps for the clock, which show up as
+		 * EPOLLERR whatever the mask. The thread's queue takes the
+		 * place of the general socket.
+		 */
+		if (rxq_fd >= 0 && i == FD_EVENT)
+			events = 0;
+		if (rxq_fd >= 0 && i == FD_GENERAL)
+			fd = rxq_fd;
+		if (fd < 0)
+			continue;
+		if (clock_watch(c, fd, events, CLOCK_EV_DATA(slot, i)))
+			pr_err("port %d: failed to watch descriptor %d: %m",
+			       port_number(p), i);
 	}
-	dest[i].fd = port_fault_fd(p);
-	dest[i].events = POLLIN|POLLPRI;
 }
 
-static void clock_check_pollfd(struct clock *c)
+struct timerq *clock_timerq(struct clock *c)
 {
-	struct port *p;
-	struct pollfd *dest = c->pollfd + 1;
+	return c->timerq;
+}
 
-	if (c->pollfd_valid)
-		return;
-	LIST_FOREACH(p, &c->ports, list) {
-		clock_fill_pollfd(dest, p);
-		dest += N_CLOCK_PFD;
-	}
-	clock_fill_pollfd(dest, c->uds_port);
-	c->pollfd_valid = 1;
+struct rxthread *clock_rx_thread(struct clock *c, int port_number)
+{
+	if (!c->n_rx_threads)
+		return NULL;
+	return c->rx_threads[(port_number - 1) % c->n_rx_threads];
 }
 
-void clock_fda_changed(struct clock *c)
+static int clock_create_rx_threads(struct clock *c, struct config *config)
 {
-	c->pollfd_valid = 0;
+	char *cpus = config_get_string(config, NULL, "rx_thread_cpus");
+	int cpu, i, n = config_get_int(config, NULL, "rx_threads");
+	char *end;
+
+	if (!n)
+		return 0;
+	c->rx_threads = calloc(n, sizeof(*c->rx_threads));
+	if (!c->rx_threads)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		/* The list of CPUs is used up one entry per thread. */
+		cpu = -1;
+		if (cpus && *cpus) {
+			cpu = strtol(cpus, &end, 0);
+			if (end == cpus || (*end && *end != ',') || cpu < 0) {
+				pr_err("bad rx_thread_cpus list");
+				return -1;
+			}
+			cpus = *end ? end + 1 : end;
+		}
+		c->rx_threads[i] = rxthread_create(cpu);
+		if (!c->rx_threads[i])
+			return -1;
+		c->n_rx_threads++;
+	}
+	pr_info("receiving on %d threads", n);
+	return 0;
 }
 
 static int clock_do_forward_mgmt(struct clock *c,
@@ -1418,6 +1638,7 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 	case TLV_TIME_STATUS_NP:
 	case TLV_GRANDMASTER_SETTINGS_NP:
 	case TLV_SUBSCRIBE_EVENTS_NP:
+	case TLV_MSG_POOL_STATS_NP:
 		clock_management_send_error(p, msg, TLV_NOT_SUPPORTED);
 		break;
 	default:
@@ -1477,71 +1698,137 @@ struct PortIdentity clock_parent_identity(struct clock *c)
 	return c->dad.pds.parentPortIdentity;
 }
 
+static int clock_event_cmp(const void *a, const void *b)
+{
+	const struct epoll_event *x = a, *y = b;
+
+	return x->data.u64 < y->data.u64 ? -1 : x->data.u64 > y->data.u64;
+}
+
+static void clock_port_events(struct clock *c, struct port *p,
+			      uint32_t *revents)
+{
+	enum fsm_event event;
+	int err, i;
+
+	/* Collect the pending tx time stamps first. */
+	if (revents[FD_EVENT] & EPOLLERR) {
+		event = port_tx_event(p);
+		port_dispatch(p, event, 0);
+		if (PS_FAULTY == port_state(p)) {
+			clock_fault_timeout(p, 1);
+			return;
+		}
+		revents[FD_EVENT] &= ~(EPOLLERR|EPOLLPRI);
+	}
+	/* Let the ports handle their events. */
+	for (i = err = 0; i < N_POLLFD && !err; i++) {
+		if (revents[i] & (EPOLLIN|EPOLLPRI)) {
+			event = port_event(p, i);
+			if (EV_STATE_DECISION_EVENT == event)
+				c->sde = 1;
+			if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event)
+				c->sde = 1;
+			err = port_dispatch(p, event, 0);
+			/* Clear any fault after a little while. */
+			if (PS_FAULTY == port_state(p)) {
+				clock_fault_timeout(p, 1);
+				break;
+			}
+		}
+	}
+
+	/* Send the delay responses queued above. */
+	if (!err && PS_FAULTY != port_state(p)) {
+		event = port_tx_flush(p);
+		port_dispatch(p, event, 0);
+		if (PS_FAULTY == port_state(p))
+			clock_fault_timeout(p, 1);
+	}
+
+	/*
+	 * When the fault timer expires we clear the fault,
+	 * but only if the link is up.
+	 */
+	if (revents[N_POLLFD] & (EPOLLIN|EPOLLPRI)) {
+		clock_fault_timeout(p, 0);
+		if (port_link_status_get(p)) {
+			port_dispatch(p, EV_FAULT_CLEARED, 0);
+		}
+	}
+}
+
+/*
+ * Turns the expired port timers into events, as though each of them
+ * had its own descriptor. Returns the number of events added.
+ */
+static int clock_timer_events(struct clock *c, struct epoll_event *ev, int n)
+{
+	struct tmr *expired[N_CLOCK_EVENTS];
+	int cnt, i;
+
+	cnt = timerq_expire(c->timerq, expired, n);
+	for (i = 0; i < cnt; i++) {
+		ev[i].events = EPOLLIN;
+		ev[i].data.u64 = expired[i]->data;
+	}
+	return cnt;
+}
+
 int clock_poll(struct clock *c)
 {
-	int cnt, err, i;
+	struct epoll_event ev[2 * N_CLOCK_EVENTS];
+	uint32_t revents[N_CLOCK_PFD];
 	enum fsm_event event;
-	struct pollfd *cur;
+	int cnt, i, j, k, slot;
 	struct port *p;
 
-	clock_check_pollfd(c);
-	cnt = poll(c->pollfd, 1 + (c->nports + 1) * N_CLOCK_PFD, -1);
+	cnt = epoll_wait(c->epoll_fd, ev, N_CLOCK_EVENTS, -1);
 	if (cnt < 0) {
 		if (EINTR == errno) {
 			return 0;
 		} else {
-			pr_emerg("poll failed");
+			pr_emerg("epoll_wait failed");
 			return -1;
 		}
 	} else if (!cnt) {
 		return 0;
 	}
 
-	/* Check the RT netlink. */
-	cur = c->pollfd;
-	if (cur->revents & (POLLIN|POLLPRI)) {
-		rtnl_link_status(cur->fd, clock_link_status, c);
+	for (i = 0, j = cnt; i < j; i++) {
+		if (ev[i].data.u64 == CLOCK_EV_TIMER)
+			cnt += clock_timer_events(c, ev + cnt, N_CLOCK_EVENTS);
 	}
 
-	cur++;
-	LIST_FOREACH(p, &c->ports, list) {
-		/* Let the ports handle their events. */
-		for (i = err = 0; i < N_POLLFD && !err; i++) {
-			if (cur[i].revents & (POLLIN|POLLPRI)) {
-				event = port_event(p, i);
-				if (EV_STATE_DECISION_EVENT == event)
-					c->sde = 1;
-				if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event)
-					c->sde = 1;
-				err = port_dispatch(p, event, 0);
-				/* Clear any fault after a little while. */
-				if (PS_FAULTY == port_state(p)) {
-					clock_fault_timeout(p, 1);
-					break;
-				}
-			}
-		}
+	/* Group the ready descriptors by port, RT netlink first. */
+	qsort(ev, cnt, sizeof(ev[0]), clock_event_cmp);
 
-		/*
-		 * When the fault timer expires we clear the fault,
-		 * but only if the link is up.
-		 */
-		if (cur[N_POLLFD].revents & (POLLIN|POLLPRI)) {
-			clock_fault_timeout(p, 0);
-			if (port_link_status_get(p)) {
-				port_dispatch(p, EV_FAULT_CLEARED, 0);
-			}
+	for (i = 0; i < cnt; i = j) {
+		if (ev[i].data.u64 < CLOCK_EV_PORT) {
+			if (ev[i].data.u64 == CLOCK_EV_RTNL)
+				rtnl_link_status(c->rtnl_fd, clock_link_status, c);
+			j = i + 1;
+			continue;
 		}
+		slot = CLOCK_EV_SLOT(ev[i].data.u64);
+		memset(revents, 0, sizeof(revents));
+		for (j = i; j < cnt && CLOCK_EV_SLOT(ev[j].data.u64) == slot; j++)
+			revents[CLOCK_EV_INDEX(ev[j].data.u64)] = ev[j].events;
 
-		cur += N_CLOCK_PFD;
-	}
-
-	/* Check the UDS port. */
-	for (i = 0; i < N_POLLFD; i++) {
-		if (cur[i].revents & (POLLIN|POLLPRI)) {
-			event = port_event(c->uds_port, i);
-			if (EV_STATE_DECISION_EVENT == event)
-				c->sde = 1;
+		p = c->slots[slot];
+		if (!p)
+			continue;
+		if (p != c->uds_port) {
+			clock_port_events(c, p, revents);
+			continue;
+		}
+		/* Check the UDS port. */
+		for (k = 0; k < N_POLLFD; k++) {
+			if (revents[k] & (EPOLLIN|EPOLLPRI)) {
+				event = port_event(p, k);
+				if (EV_STATE_DECISION_EVENT == event)
+					c->sde = 1;
+			}
 		}
 	}
 
@@ -1640,9 +1927,33 @@ int clock_switch_phc(struct clock *c, int phc_index)
 	return 0;
 }
 
+/* Pass a part of the handover phase step to the servo. */
+static void clock_handover_slew(struct clock *c, tmv_t ingress)
+{
+	int64_t step;
+
+	if (!tmv_is_zero(c->handover_ts)) {
+		step = c->handover_slew_rate * 1e-9 *
+			tmv_dbl(tmv_sub(ingress, c->handover_ts));
+		if (step < 0)
+			step = 0;
+		if (llabs(tmv_to_nanoseconds(c->handover)) <= step) {
+			c->handover = tmv_zero();
+			pr_info("handover completed");
+		} else if (tmv_to_nanoseconds(c->handover) > 0) {
+			c->handover = tmv_sub(c->handover, dbl_tmv(step));
+		} else {
+			c->handover = tmv_add(c->handover, dbl_tmv(step));
+		}
+	}
+	c->handover_ts = ingress;
+}
+
 enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 {
+	struct port *piter;
 	double adj, weight;
+	tmv_t offset;
 
 	enum servo_state state = SERVO_UNLOCKED;
 
@@ -1656,19 +1967,56 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 
 	if (tsproc_update_offset(c->tsproc, &c->master_offset, &weight))
 		return state;
+	c->source_offset = c->master_offset;
 
 	if (clock_utc_correct(c, ingress))
 		return c->servo_state;
 
 	c->cur.offsetFromMaster = tmv_to_TimeInterval(c->master_offset);
+	c->rv_dirty |= RV_PTP_DIRTY_OFFSET;
 
 	if (c->free_running)
 		return clock_no_adjust(c, ingress, origin);
 
-	adj = servo_sample(c->servo, tmv_to_nanoseconds(c->master_offset),
+	/* During a handover the servo still sees the old master's phase. */
+	offset = c->master_offset;
+	if (!tmv_is_zero(c->handover)) {
+		clock_handover_slew(c, ingress);
+		offset = tmv_sub(offset, c->handover);
+	}
+
+	servo_offset_variance(c->servo, tsproc_offset_variance(c->tsproc));
+	adj = servo_sample(c->servo, tmv_to_nanoseconds(offset),
 			   tmv_to_nanoseconds(ingress), weight, &state);
 	c->servo_state = state;
 
+	if (c->telemetry) {
+		struct telemetry_sample ts = {
+			.ingress = tmv_to_nanoseconds(ingress),
+			.offset = tmv_to_nanoseconds(c->master_offset),
+			.path_delay = tmv_to_nanoseconds(c->path_delay),
+			.freq = adj,
+			.state = state,
+		};
+		telemetry_push(c->telemetry, &ts);
+	}
+
+	if (c->capture) {
+		struct capture_record r = {
+			.type = CAPTURE_SERVO,
+			.state = state,
+			.t1 = origin,
+			.t2 = ingress,
+			.offset = tmv_to_nanoseconds(c->master_offset),
+			.adj = adj,
+		};
+		capture_add(c->capture, &r);
+	}
+
+	if (c->freqstate)
+		freqstate_update(c->freqstate, tmv_to_nanoseconds(c->master_offset),
+				 adj, servo_rate_ratio(c->servo), state);
+
 	if (c->stats.max_count > 1) {
 		clock_stats_update(c, &c->stats, tmv_to_nanoseconds(c->master_offset), adj);    
 	} else {
@@ -1688,12 +2036,15 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 		clockadj_set_freq(c->clkid, -adj);
 		clockadj_step(c->clkid, -tmv_to_nanoseconds(c->master_offset));
 		c->ingress_ts = tmv_zero();
+		c->handover = tmv_zero();
 		if (c->sanity_check) {
 			clockcheck_set_freq(c->sanity_check, -adj);
 			clockcheck_step(c->sanity_check,
 					-tmv_to_nanoseconds(c->master_offset));
 		}
 		tsproc_reset(c->tsproc, 0);
+		LIST_FOREACH(piter, &c->ports, list)
+			port_clock_stepped(piter);
 		break;
 	case SERVO_LOCKED:
 		clockadj_set_freq(c->clkid, -adj);
@@ -1746,12 +2097,43 @@ void clock_update_best_identity(struct clock *c, struct ClockIdentity *id)
     memcpy(&c->best_id, id, sizeof(struct ClockIdentity));
 }
 
+/*
+ * Switch to a new master without restarting the measurement, if its port
+ * kept an estimate of the offset from it. The servo keeps seeing the
+ * phase of the old master, which moves to the new one at a bounded rate.
+ */
+static int clock_handover(struct clock *c, struct foreign_clock *best)
+{
+	char source[64];
+	tmv_t offset, step;
+
+	if (!c->handover_max_offset || c->servo_state != SERVO_LOCKED)
+		return -1;
+	if (port_standby_offset(best->port, &offset))
+		return -1;
+
+	step = tmv_sub(offset, tmv_sub(c->source_offset, c->handover));
+	if (llabs(tmv_to_nanoseconds(step)) > c->handover_max_offset) {
+		pr_info("phase step of %" PRId64 " ns too large for a handover",
+			tmv_to_nanoseconds(step));
+		return -1;
+	}
+	c->handover = step;
+	c->handover_ts = tmv_zero();
+
+	pid2str(source, sizeof(source), &best->dataset.sender);
+	pr_notice("handover to %s, slewing a phase step of %" PRId64 " ns",
+		  source, tmv_to_nanoseconds(step));
+	return 0;
+}
+
 static void handle_state_decision_event(struct clock *c)
 {
 	struct foreign_clock *best = NULL, *fc;
 	struct ClockIdentity best_id;
+	struct dataset *dds;
 	struct port *piter;
-	int fresh_best = 0;
+	int all, fresh_best = 0;
 
 	LIST_FOREACH(piter, &c->ports, list) {
 		fc = port_compute_best(piter);
@@ -1767,7 +2149,29 @@ static void handle_state_decision_event(struct clock *c)
 		best_id = c->dds.clockIdentity;
 	}
 
-	if (!cid_eq(&best_id, &c->best_id)) {
+	/*
+	 * The decision for a port depends on the default data set, Ebest
+	 * and the port's own Erbest. Unless one of the first two changed,
+	 * only the ports whose Erbest or state changed need a new one.
+	 * Both data sets are zeroed before use, so memcmp() is fine.
+	 */
+	dds = clock_default_ds(c);
+	all = best != c->best ||
+		(best && memcmp(&best->dataset, &c->ebest, sizeof(c->ebest))) ||
+		memcmp(dds, &c->ebest_dds, sizeof(c->ebest_dds));
+	if (best)
+		memcpy(&c->ebest, &best->dataset, sizeof(c->ebest));
+	memcpy(&c->ebest_dds, dds, sizeof(c->ebest_dds));
+
+	if (best && memcmp(&best->dataset.sender, &c->best_source,
+			   sizeof(c->best_source)) && !clock_handover(c, best)) {
+		/* The new master's estimators are converged, keep them. */
+		if (!cid_eq(&best_id, &c->best_id))
+			pr_notice("selected best master clock %s",
+				  cid2str(&best_id));
+		fresh_best = 1;
+		all = 1;
+	} else if (!cid_eq(&best_id, &c->best_id)) {
         pr_notice("selected best master clock %s", cid2str(&best_id));
 
 		clock_freq_est_reset(c);
@@ -1775,15 +2179,23 @@ static void handle_state_decision_event(struct clock *c)
         c->ingress_ts = tmv_zero();
 		c->path_delay = 0;
 		c->nrr = 1.0;
+		c->handover = tmv_zero();
 		fresh_best = 1;
+		all = 1;
 	}
 
 	c->best = best;
 	c->best_id = best_id;
+	if (best)
+		c->best_source = best->dataset.sender;
+	if (all)
+		c->rv_dirty |= RV_PTP_DIRTY_CLOCK;
 
 	LIST_FOREACH(piter, &c->ports, list) {
 		enum port_state ps;
 		enum fsm_event event;
+		if (!all && !port_decision_due(piter))
+			continue;
 		ps = bmc_state_decision(c, piter);
 		switch (ps) {
 		case PS_LISTENING:
@@ -1810,7 +2222,7 @@ static void handle_state_decision_event(struct clock *c)
 			event = EV_FAULT_DETECTED;
 			break;
 		}
-		port_dispatch(piter, event, fresh_best);
+		port_dispatch_decision(piter, event, fresh_best);
 	}
 }
 
@@ -1841,37 +2253,60 @@ double clock_rate_ratio(struct clock *c)
 //////////////////////////////////////////
 // start RAVENNA IPC implementation here
 //////////////////////////////////////////
-extern int rv_get_port_status(struct rv_ptpport_t *rv_ptpport, struct port *p);
+extern int rv_get_port_status(struct rv_ptpport_t *rv_ptpport, struct port *p, unsigned int dirty);
+
+void rv_set_clock_dirty(struct clock *c, unsigned int dirty) {
+    c->rv_dirty |= dirty;
+}
 
+int rv_get_clock_dirty(struct clock *c) {
+    return c ? c->rv_dirty : 0;
+}
+
+// Only the parts flagged dirty since the last call are rebuilt. Returns
+// the RV_PTP_DIRTY_* bits which were refreshed.
 int rv_get_clock_status(struct rv_ptpclock_t *rv_clock, struct clock *c) {
     struct port *piter = NULL;
+    unsigned int dirty;
 
     if (!c) {
         return -1;
     }
-    strncpy(rv_clock->clk_id, cid2str(&c->dds.clockIdentity), RV_PTP_CLOCK_ID_STRING_SIZE - 1);
-    
-    rv_clock->offset = tmv_to_nanoseconds(c->master_offset);
-    rv_clock->offset_sign = 0;
-    if(rv_clock->offset < 0) {
-        rv_clock->offset_sign = 1;
+
+    dirty = c->rv_dirty;
+    c->rv_dirty = 0;
+
+    if(dirty & RV_PTP_DIRTY_CLOCK) {
+        strncpy(rv_clock->clk_id, cid2str(&c->dds.clockIdentity), RV_PTP_CLOCK_ID_STRING_SIZE - 1);
+
+        rv_clock->clk_accuracy = c->dds.clockQuality.clockAccuracy;
+        rv_clock->clk_class    = c->dds.clockQuality.clockClass;
+
+        rv_clock->traceable = c->tds.flags & TIME_TRACEABLE ? true : false;
     }
-    
-    rv_clock->clk_accuracy = c->dds.clockQuality.clockAccuracy;
-    rv_clock->clk_class    = c->dds.clockQuality.clockClass;
 
-    rv_clock->traceable = c->tds.flags & TIME_TRACEABLE ? true : false;
-    
-    rv_clock->port_count = 0;
-    LIST_FOREACH(piter, &c->ports, list) {
-        if(rv_clock->port_count >= RV_PTP_MAX_PORTS) {
-            break;
+    if(dirty & RV_PTP_DIRTY_OFFSET) {
+        rv_clock->offset = tmv_to_nanoseconds(c->master_offset);
+        rv_clock->offset_sign = 0;
+        if(rv_clock->offset < 0) {
+            rv_clock->offset_sign = 1;
         }
-        
-        rv_get_port_status(&rv_clock->port[rv_clock->port_count], piter);
+    }
+    
+    if(dirty & (RV_PTP_DIRTY_CLOCK | RV_PTP_DIRTY_PORT_STATE | RV_PTP_DIRTY_PATH_DELAY)) {
+        rv_clock->port_count = 0;
+        LIST_FOREACH(piter, &c->ports, list) {
+            if(rv_clock->port_count >= RV_PTP_MAX_PORTS) {
+                break;
+            }
 
-        ++rv_clock->port_count;
+            // a clock change may alter the master information of every port
+            rv_get_port_status(&rv_clock->port[rv_clock->port_count], piter,
+                               dirty & RV_PTP_DIRTY_CLOCK ? RV_PTP_DIRTY_ALL : 0);
+
+            ++rv_clock->port_count;
+        }
     }
 
-    return 0;
+    return dirty;
 }
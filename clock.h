@@ -29,6 +29,9 @@
 #include "tmv.h"
 #include "transport.h"
 
+struct capture; /*forward declaration*/
+struct rxthread; /*forward declaration*/
+struct timerq; /*forward declaration*/
 struct tsproc; /*forward declaration*/
 struct ptp_message; /*forward declaration*/
 
@@ -73,6 +76,20 @@ UInteger8 clock_class(struct clock *c);
  */
 struct config *clock_config(struct clock *c);
 
+/**
+ * Obtains the ring buffer which records every servo sample.
+ * @param c  The clock instance.
+ * @return   A pointer to the ring, or NULL if telemetry is disabled.
+ */
+struct telemetry *clock_telemetry(struct clock *c);
+
+/**
+ * Obtains the binary capture of the time stamps and servo samples.
+ * @param c  The clock instance.
+ * @return   A pointer to the capture, or NULL if capturing is disabled.
+ */
+struct capture *clock_capture(struct clock *c);
+
 /**
  * Create a clock instance. There can only be one clock in any system,
  * so subsequent calls will destroy the previous clock instance.
@@ -137,10 +154,28 @@ struct ClockIdentity clock_identity(struct clock *c);
 
 /**
  * Informs clock that a file descriptor of one of its ports changed. The
- * clock will rebuild its array of file descriptors to poll.
+ * clock updates the registration of that port's descriptors in its
+ * epoll set, without touching the other ports.
  * @param c    The clock instance.
+ * @param p    The port whose descriptors changed.
+ */
+void clock_fda_changed(struct clock *c, struct port *p);
+
+/**
+ * Obtain the queue which holds the timers of the clock's ports.
+ * @param c    The clock instance.
+ * @return     The timer queue of the clock.
+ */
+struct timerq *clock_timerq(struct clock *c);
+
+/**
+ * Obtain the receive thread which serves a port.
+ * @param c            The clock instance.
+ * @param port_number  The number of the port.
+ * @return             The thread, or NULL if the ports receive on the
+ *                     clock's own thread.
  */
-void clock_fda_changed(struct clock *c);
+struct rxthread *clock_rx_thread(struct clock *c, int port_number);
 
 /**
  * Manage the clock according to a given message.
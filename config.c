@@ -26,6 +26,7 @@
 #include "ether.h"
 #include "hash.h"
 #include "print.h"
+#include "rv_ptp_ifc.h"
 #include "util.h"
 
 enum config_section {
@@ -130,6 +131,8 @@ static struct config_enum clock_servo_enu[] = {
 	{ "linreg", CLOCK_SERVO_LINREG },
 	{ "ntpshm", CLOCK_SERVO_NTPSHM },
 	{ "nullf",  CLOCK_SERVO_NULLF  },
+	{ "kalman", CLOCK_SERVO_KALMAN },
+	{ "ntpsock", CLOCK_SERVO_NTPSOCK },
 	{ NULL, 0 },
 };
 
@@ -146,6 +149,14 @@ static struct config_enum delay_mech_enu[] = {
 	{ NULL, 0 },
 };
 
+static struct config_enum mqtt_aggregate_enu[] = {
+	{ "last", eRvPtpAggregateLast },
+	{ "mean", eRvPtpAggregateMean },
+	{ "min",  eRvPtpAggregateMin  },
+	{ "max",  eRvPtpAggregateMax  },
+	{ NULL, 0 },
+};
+
 static struct config_enum nw_trans_enu[] = {
 	{ "L2",    TRANS_IEEE_802_3 },
 	{ "UDPv4", TRANS_UDP_IPV4   },
@@ -172,6 +183,8 @@ struct config_item config_tab[] = {
 	PORT_ITEM_INT("announceReceiptTimeout", 3, 2, UINT8_MAX),
 	GLOB_ITEM_INT("assume_two_step", 0, 0, 1),
 	PORT_ITEM_INT("boundary_clock_jbod", 0, 0, 1),
+	GLOB_ITEM_STR("capture_file", ""),
+	GLOB_ITEM_INT("capture_length", 65536, 1, 1 << 28),
 	GLOB_ITEM_INT("check_fup_sync", 0, 0, 1),
 	GLOB_ITEM_INT("clockAccuracy", 0xfe, 0, UINT8_MAX),
 	GLOB_ITEM_INT("clockClass", 248, 0, UINT8_MAX),
@@ -194,21 +207,44 @@ struct config_item config_tab[] = {
 	GLOB_ITEM_INT("free_running", 0, 0, 1),
 	PORT_ITEM_INT("freq_est_interval", 1, 0, INT_MAX),
 	GLOB_ITEM_INT("gmCapable", 1, 0, 1),
+	GLOB_ITEM_INT("handover_max_offset", 100000, 0, INT_MAX),
+	GLOB_ITEM_DBL("handover_slew_rate", 300.0, 1.0, DBL_MAX),
 	PORT_ITEM_INT("hybrid_e2e", 0, 0, 1),
 	PORT_ITEM_INT("ingressLatency", 0, INT_MIN, INT_MAX),
+	GLOB_ITEM_DBL("kalman_freq_noise", 1.0, 0.0, DBL_MAX),
+	GLOB_ITEM_DBL("kalman_phase_noise", 1.0, 0.0, DBL_MAX),
+	GLOB_ITEM_DBL("kalman_time_constant", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_INT("kernel_leap", 1, 0, 1),
 	PORT_ITEM_INT("logAnnounceInterval", 1, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logMinDelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logMinPdelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logSyncInterval", 0, INT8_MIN, INT8_MAX),
 	GLOB_ITEM_INT("logging_level", LOG_INFO, PRINT_LEVEL_MIN, PRINT_LEVEL_MAX),
+	GLOB_ITEM_INT("logging_queue_length", 0, 0, 65536),
 	GLOB_ITEM_STR("manufacturerIdentity", "00:00:00"),
 	GLOB_ITEM_INT("max_frequency", 900000000, 0, INT_MAX),
 	PORT_ITEM_INT("min_neighbor_prop_delay", -20000000, INT_MIN, -1),
+	GLOB_ITEM_ENU("mqtt_offset_aggregate", eRvPtpAggregateLast, mqtt_aggregate_enu),
+	GLOB_ITEM_INT("mqtt_offset_deadband", 10000, 0, INT_MAX),
+	GLOB_ITEM_INT("mqtt_offset_max_interval", 1000, 0, INT_MAX),
+	GLOB_ITEM_INT("mqtt_offset_min_interval", 0, 0, INT_MAX),
+	GLOB_ITEM_ENU("mqtt_path_delay_aggregate", eRvPtpAggregateLast, mqtt_aggregate_enu),
+	GLOB_ITEM_INT("mqtt_path_delay_deadband", 1000, 0, INT_MAX),
+	GLOB_ITEM_INT("mqtt_path_delay_max_interval", 1000, 0, INT_MAX),
+	GLOB_ITEM_INT("mqtt_path_delay_min_interval", 0, 0, INT_MAX),
+	GLOB_ITEM_INT("mqtt_telemetry_window", 1024, 0, 1048576),
+	GLOB_ITEM_INT("msg_pool_hugepages", 0, 0, 1),
+	GLOB_ITEM_INT("msg_pool_lock", 0, 0, 1),
+	GLOB_ITEM_INT("msg_pool_size", 128, 0, 65536),
 	PORT_ITEM_INT("neighborPropDelayThresh", 20000000, 0, INT_MAX),
 	PORT_ITEM_ENU("network_transport", TRANS_UDP_IPV4, nw_trans_enu),
+	PORT_ITEM_INT("nrate_window", 16, 0, 256),
 	GLOB_ITEM_INT("ntpshm_segment", 0, INT_MIN, INT_MAX),
+	GLOB_ITEM_STR("ntpsock_path", "/var/run/chrony.ptp.sock"),
 	GLOB_ITEM_INT("offsetScaledLogVariance", 0xffff, 0, UINT16_MAX),
+	PORT_ITEM_INT("outlier_filter_hysteresis", 0, 0, INT_MAX),
+	PORT_ITEM_INT("outlier_filter_length", 10, 1, INT_MAX),
+	PORT_ITEM_DBL("outlier_filter_percentile", 0.5, DBL_MIN, 1.0),
 	PORT_ITEM_INT("path_trace_enabled", 0, 0, 1),
 	GLOB_ITEM_DBL("pi_integral_const", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_DBL("pi_integral_exponent", 0.4, -DBL_MAX, DBL_MAX),
@@ -224,16 +260,24 @@ struct config_item config_tab[] = {
 	PORT_ITEM_STR("ptp_dst_mac", "01:1B:19:00:00:00"),
 	PORT_ITEM_STR("p2p_dst_mac", "01:80:C2:00:00:0E"),
 	GLOB_ITEM_STR("revisionData", ";;"),
+	GLOB_ITEM_STR("rx_thread_cpus", ""),
+	GLOB_ITEM_INT("rx_threads", 0, 0, 64),
 	GLOB_ITEM_INT("sanity_freq_limit", 500000000, 0, INT_MAX),
+	GLOB_ITEM_STR("servo_state_file", ""),
+	GLOB_ITEM_INT("servo_state_interval", 60, 1, INT_MAX),
+	GLOB_ITEM_INT("servo_state_max_age", 86400, 0, INT_MAX),
 	GLOB_ITEM_INT("slaveOnly", 0, 0, 1),
+	PORT_ITEM_INT("standby_masters", 0, 0, 64),
 	GLOB_ITEM_DBL("step_threshold", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_INT("summary_interval", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_INT("syncReceiptTimeout", 0, 0, UINT8_MAX),
+	GLOB_ITEM_INT("telemetry_length", 0, 0, 1048576),
 	GLOB_ITEM_INT("timeSource", INTERNAL_OSCILLATOR, 0x10, 0xfe),
 	GLOB_ITEM_ENU("time_stamping", TS_HARDWARE, timestamping_enu),
 	PORT_ITEM_INT("transportSpecific", 0, 0, 0x0F),
 	PORT_ITEM_ENU("tsproc_mode", TSPROC_FILTER, tsproc_enu),
 	GLOB_ITEM_INT("twoStepFlag", 1, 0, 1),
+	GLOB_ITEM_INT("tx_timestamp_async", 1, 0, 1),
 	GLOB_ITEM_INT("tx_timestamp_timeout", 1, 1, INT_MAX),
 	PORT_ITEM_INT("udp_ttl", 1, 1, 255),
 	PORT_ITEM_INT("udp6_scope", 0x0E, 0x00, 0x0F),
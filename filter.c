@@ -30,7 +30,7 @@ struct filter *filter_create(enum filter_type type, int length, double step_thre
 	case FILTER_MOVING_MEDIAN:
 		return mmedian_create(length);
     case FILTER_OUTLIER_DETECT:
-        return outlier_detect_create(length, step_threshold);
+        return outlier_detect_create(length, step_threshold, 0.5, 0);
 	default:
 		return NULL;
 	}
@@ -0,0 +1,140 @@
+/**
+ * @file foreign.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmc.h"
+#include "foreign.h"
+
+unsigned int foreign_index_bucket(struct PortIdentity *pid)
+{
+	unsigned char *b = (unsigned char *) pid;
+	unsigned int i, h = 2166136261U;
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(*pid); i++)
+		h = (h ^ b[i]) * 16777619U;
+
+	return h & (FOREIGN_MASTER_BUCKETS - 1);
+}
+
+static void heap_set(struct foreign_index *fi, int i, struct foreign_clock *fc)
+{
+	fi->heap[i] = fc;
+	fc->index = i;
+}
+
+static void heap_sift_up(struct foreign_index *fi, int i)
+{
+	struct foreign_clock *fc = fi->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (dscmp(&fc->dataset, &fi->heap[parent]->dataset) <= 0)
+			break;
+		heap_set(fi, i, fi->heap[parent]);
+		i = parent;
+	}
+	heap_set(fi, i, fc);
+}
+
+static void heap_sift_down(struct foreign_index *fi, int i)
+{
+	struct foreign_clock *fc = fi->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < fi->count) {
+		if (child + 1 < fi->count &&
+		    dscmp(&fi->heap[child + 1]->dataset,
+			  &fi->heap[child]->dataset) > 0)
+			child++;
+		if (dscmp(&fi->heap[child]->dataset, &fc->dataset) <= 0)
+			break;
+		heap_set(fi, i, fi->heap[child]);
+		i = child;
+	}
+	heap_set(fi, i, fc);
+}
+
+void foreign_index_add(struct foreign_index *fi, struct foreign_clock *fc)
+{
+	unsigned int h = foreign_index_bucket(&fc->dataset.sender);
+
+	LIST_INSERT_HEAD(&fi->buckets[h], fc, list);
+	fc->index = -1;
+}
+
+struct foreign_clock *foreign_index_find(struct foreign_index *fi,
+					 struct PortIdentity *pid)
+{
+	struct foreign_clock *fc;
+
+	LIST_FOREACH(fc, &fi->buckets[foreign_index_bucket(pid)], list) {
+		if (!memcmp(&fc->dataset.sender, pid, sizeof(*pid)))
+			return fc;
+	}
+	return NULL;
+}
+
+int foreign_index_qualify(struct foreign_index *fi, struct foreign_clock *fc)
+{
+	struct foreign_clock **heap;
+	int size;
+
+	if (fc->index < 0) {
+		if (fi->count == fi->size) {
+			size = fi->size ? 2 * fi->size : 16;
+			heap = realloc(fi->heap, size * sizeof(*heap));
+			if (!heap)
+				return -1;
+			fi->heap = heap;
+			fi->size = size;
+		}
+		heap_set(fi, fi->count++, fc);
+	}
+	heap_sift_up(fi, fc->index);
+	heap_sift_down(fi, fc->index);
+	return 0;
+}
+
+void foreign_index_disqualify(struct foreign_index *fi,
+			      struct foreign_clock *fc)
+{
+	struct foreign_clock *last;
+	int i = fc->index;
+
+	if (i < 0)
+		return;
+	fc->index = -1;
+	last = fi->heap[--fi->count];
+	if (last == fc)
+		return;
+	heap_set(fi, i, last);
+	heap_sift_up(fi, i);
+	heap_sift_down(fi, last->index);
+}
+
+void foreign_index_destroy(struct foreign_index *fi)
+{
+	free(fi->heap);
+	fi->heap = NULL;
+	fi->count = 0;
+	fi->size = 0;
+}
@@ -26,13 +26,20 @@
 #include "port.h"
 
 #define FOREIGN_MASTER_THRESHOLD 2
+#define FOREIGN_MASTER_BUCKETS 256 /* power of two */
 
 struct foreign_clock {
 	/**
-	 * Pointer to next foreign_clock in list.
+	 * Pointer to next foreign_clock in the same hash bucket.
 	 */
 	LIST_ENTRY(foreign_clock) list;
 
+	/**
+	 * Position in the port's ordered index of qualified foreign
+	 * masters, or -1 if not qualified.
+	 */
+	int index;
+
 	/**
 	 * A list of received announce messages.
 	 *
@@ -59,4 +66,73 @@ struct foreign_clock {
 	struct dataset dataset;
 };
 
+/**
+ * The foreign masters of a port, hashed by sourcePortIdentity. The
+ * qualified ones also sit in a binary heap ordered by dscmp().
+ */
+struct foreign_index {
+	LIST_HEAD(fm, foreign_clock) buckets[FOREIGN_MASTER_BUCKETS];
+	/* Qualified foreign masters, best on top. */
+	struct foreign_clock **heap;
+	int count;
+	int size;
+};
+
+/**
+ * Add a new foreign master, which is not qualified yet.
+ * @param fi  The index of the port.
+ * @param fc  The record, with dataset.sender set.
+ */
+void foreign_index_add(struct foreign_index *fi, struct foreign_clock *fc);
+
+/**
+ * Get the bucket of the hash table for an identity.
+ * @param pid  A sourcePortIdentity.
+ * @return     The index of the bucket in @a buckets.
+ */
+unsigned int foreign_index_bucket(struct PortIdentity *pid);
+
+/**
+ * Find a foreign master.
+ * @param fi   The index of the port.
+ * @param pid  The sourcePortIdentity of the foreign master.
+ * @return     The record, or NULL if there is none.
+ */
+struct foreign_clock *foreign_index_find(struct foreign_index *fi,
+					 struct PortIdentity *pid);
+
+/**
+ * Qualify a foreign master, or move it to its place after its data set
+ * changed.
+ * @param fi  The index of the port.
+ * @param fc  A record of the index.
+ * @return    Zero on success, -1 if out of memory.
+ */
+int foreign_index_qualify(struct foreign_index *fi, struct foreign_clock *fc);
+
+/**
+ * Take a foreign master out of the qualified ones. Does nothing if it
+ * is not qualified.
+ * @param fi  The index of the port.
+ * @param fc  A record of the index.
+ */
+void foreign_index_disqualify(struct foreign_index *fi,
+			      struct foreign_clock *fc);
+
+/**
+ * Get the best qualified foreign master.
+ * @param fi  The index of the port.
+ * @return    The best record, or NULL if none is qualified.
+ */
+static inline struct foreign_clock *foreign_index_best(struct foreign_index *fi)
+{
+	return fi->count ? fi->heap[0] : NULL;
+}
+
+/**
+ * Free the memory of the index. The records stay with the caller.
+ * @param fi  The index of the port.
+ */
+void foreign_index_destroy(struct foreign_index *fi);
+
 #endif
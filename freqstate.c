@@ -0,0 +1,311 @@
+/**
+ * @file freqstate.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clockadj.h"
+#include "freqstate.h"
+#include "print.h"
+
+/* Offset in ns below which the clock counts as settled */
+#define SETTLED_OFFSET 1000
+
+#define NS_PER_SEC ((int64_t) 1000000000)
+
+/* What a checkpoint saves besides the identity and the time. */
+struct freqstate_record {
+	double freq;
+	double rate_ratio;
+};
+
+struct freqstate {
+	char *path;
+	char *id;
+	clockid_t clkid;
+	int interval;
+	int max_age;
+	int restored;
+	/* Means of the locked servo since the last checkpoint */
+	double freq_sum;
+	double ratio_sum;
+	int freq_cnt;
+	int64_t last_save;
+	/* Time to lock metrics, relative to the first sample */
+	int64_t first_sample;
+	int locked;
+	int settled;
+	/* The writer thread, which takes the checkpoints under the lock. */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct freqstate_record pending;
+	int dirty;
+	int stop;
+	int writer;
+};
+
+static int64_t freqstate_now(clockid_t clkid)
+{
+	struct timespec ts;
+
+	clock_gettime(clkid, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* Makes the rename of the file durable. */
+static void freqstate_sync_dir(const char *path)
+{
+	char dir[PATH_MAX];
+	int fd;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	fd = open(dirname(dir), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return;
+	if (fsync(fd))
+		pr_warning("failed to sync %s: %m", dir);
+	close(fd);
+}
+
+/* Called by the writer thread. */
+static void freqstate_save(struct freqstate *fs, struct freqstate_record *rec)
+{
+	char tmp[PATH_MAX];
+	double phc_freq;
+	FILE *f;
+	int err;
+
+	phc_freq = clockadj_get_freq(fs->clkid);
+
+	/*
+	 * Replace the file in one step, so that a crash leaves no stub,
+	 * and sync it first, so that the rename never points to data which
+	 * did not reach the disk.
+	 */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fs->path);
+	f = fopen(tmp, "w");
+	if (!f) {
+		pr_err("failed to write %s: %m", tmp);
+		return;
+	}
+	fprintf(f, "identity %s\nfrequency %.3f\nphc_frequency %.3f\n"
+		"rate_ratio %.12f\ntime %" PRId64 "\n",
+		fs->id, rec->freq, phc_freq, rec->rate_ratio,
+		freqstate_now(CLOCK_REALTIME) / NS_PER_SEC);
+	err = fflush(f) || fsync(fileno(f));
+	if (fclose(f) || err || rename(tmp, fs->path)) {
+		pr_err("failed to write %s: %m", fs->path);
+		remove(tmp);
+		return;
+	}
+	freqstate_sync_dir(fs->path);
+	pr_debug("saved frequency %.3f ppb to %s", rec->freq, fs->path);
+}
+
+static void *freqstate_run(void *arg)
+{
+	struct freqstate *fs = arg;
+	struct freqstate_record rec;
+
+	pthread_mutex_lock(&fs->lock);
+	while (1) {
+		if (fs->dirty) {
+			rec = fs->pending;
+			fs->dirty = 0;
+			pthread_mutex_unlock(&fs->lock);
+			freqstate_save(fs, &rec);
+			pthread_mutex_lock(&fs->lock);
+		} else if (fs->stop) {
+			break;
+		} else {
+			pthread_cond_wait(&fs->cond, &fs->lock);
+		}
+	}
+	pthread_mutex_unlock(&fs->lock);
+	return NULL;
+}
+
+struct freqstate *freqstate_create(const char *path, const char *id,
+				   clockid_t clkid, int interval, int max_age)
+{
+	struct freqstate *fs;
+	sigset_t all, old;
+	int err;
+
+	fs = calloc(1, sizeof(*fs));
+	if (!fs)
+		return NULL;
+	pthread_mutex_init(&fs->lock, NULL);
+	pthread_cond_init(&fs->cond, NULL);
+	fs->path = strdup(path);
+	fs->id = strdup(id);
+	if (!fs->path || !fs->id) {
+		freqstate_destroy(fs);
+		return NULL;
+	}
+	fs->clkid = clkid;
+	fs->interval = interval;
+	fs->max_age = max_age;
+
+	if (!fs->path[0])
+		return fs;
+	/* Signals are for the clock thread to handle. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&fs->thread, NULL, freqstate_run, fs);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		pr_err("failed to start the servo state writer: %s",
+		       strerror(err));
+		freqstate_destroy(fs);
+		return NULL;
+	}
+	fs->writer = 1;
+	return fs;
+}
+
+void freqstate_destroy(struct freqstate *fs)
+{
+	if (fs->writer) {
+		/* The writer saves a pending checkpoint before it stops. */
+		pthread_mutex_lock(&fs->lock);
+		fs->stop = 1;
+		pthread_cond_signal(&fs->cond);
+		pthread_mutex_unlock(&fs->lock);
+		pthread_join(fs->thread, NULL);
+	}
+	pthread_cond_destroy(&fs->cond);
+	pthread_mutex_destroy(&fs->lock);
+	free(fs->path);
+	free(fs->id);
+	free(fs);
+}
+
+int freqstate_restore(struct freqstate *fs, struct freqstate_saved *saved)
+{
+	char line[128], key[32], value[80], id[80] = "";
+	int64_t when = 0;
+	int found = 0;
+	FILE *f;
+
+	if (!fs->path[0])
+		return -1;
+	f = fopen(fs->path, "r");
+	if (!f) {
+		pr_info("no saved frequency in %s", fs->path);
+		return -1;
+	}
+	/* Files of older versions lack the PHC frequency and the ratio. */
+	saved->phc_freq = NAN;
+	saved->rate_ratio = 1.0;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%31s %79s", key, value) != 2)
+			continue;
+		if (!strcmp(key, "identity")) {
+			snprintf(id, sizeof(id), "%s", value);
+			found |= 1;
+		} else if (!strcmp(key, "frequency")) {
+			found |= (sscanf(value, "%lf", &saved->freq) == 1) << 1;
+		} else if (!strcmp(key, "time")) {
+			found |= (sscanf(value, "%" SCNd64, &when) == 1) << 2;
+		} else if (!strcmp(key, "phc_frequency")) {
+			sscanf(value, "%lf", &saved->phc_freq);
+		} else if (!strcmp(key, "rate_ratio")) {
+			sscanf(value, "%lf", &saved->rate_ratio);
+		}
+	}
+	fclose(f);
+
+	if (found != 7) {
+		pr_warning("ignoring malformed %s", fs->path);
+		return -1;
+	}
+	if (strcmp(id, fs->id)) {
+		pr_info("ignoring frequency saved for clock %s", id);
+		return -1;
+	}
+	saved->age = freqstate_now(CLOCK_REALTIME) / NS_PER_SEC - when;
+	if (saved->age < 0 || saved->age > fs->max_age) {
+		pr_info("ignoring frequency saved %" PRId64 " s ago", saved->age);
+		return -1;
+	}
+	pr_info("restored frequency %.3f ppb saved %" PRId64 " s ago",
+		saved->freq, saved->age);
+	if (!isnan(saved->phc_freq))
+		pr_info("saved clock frequency %.3f ppb, rate ratio %.12f",
+			saved->phc_freq, saved->rate_ratio);
+	fs->restored = 1;
+	return 0;
+}
+
+void freqstate_update(struct freqstate *fs, int64_t offset, double freq,
+		      double rate_ratio, enum servo_state state)
+{
+	int64_t now = freqstate_now(CLOCK_MONOTONIC);
+
+	if (!fs->first_sample)
+		fs->first_sample = now;
+
+	if (state != SERVO_LOCKED)
+		return;
+
+	if (!fs->locked) {
+		fs->locked = 1;
+		fs->last_save = now;
+		pr_info("servo locked %.3f s after the first sample, %s frequency",
+			(now - fs->first_sample) / 1e9,
+			fs->restored ? "restored" : "estimated");
+	}
+	if (!fs->settled && llabs(offset) < SETTLED_OFFSET) {
+		fs->settled = 1;
+		pr_info("offset within %d ns %.3f s after the first sample",
+			SETTLED_OFFSET, (now - fs->first_sample) / 1e9);
+	}
+
+	if (!fs->writer)
+		return;
+	fs->freq_sum += freq;
+	fs->ratio_sum += rate_ratio;
+	fs->freq_cnt++;
+	if (now - fs->last_save < fs->interval * NS_PER_SEC)
+		return;
+
+	/* The writer does the file system work, off the servo path. */
+	pthread_mutex_lock(&fs->lock);
+	fs->pending.freq = fs->freq_sum / fs->freq_cnt;
+	fs->pending.rate_ratio = fs->ratio_sum / fs->freq_cnt;
+	fs->dirty = 1;
+	pthread_cond_signal(&fs->cond);
+	pthread_mutex_unlock(&fs->lock);
+
+	fs->freq_sum = 0.0;
+	fs->ratio_sum = 0.0;
+	fs->freq_cnt = 0;
+	fs->last_save = now;
+}
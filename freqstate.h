@@ -0,0 +1,85 @@
+/**
+ * @file freqstate.h
+ * @brief Keeps the frequency of a locked clock across restarts.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_FREQSTATE_H
+#define HAVE_FREQSTATE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "servo.h"
+
+/** Opaque type */
+struct freqstate;
+
+/** A state saved by an earlier run. */
+struct freqstate_saved {
+	double freq;       /* mean frequency adjustment of the servo, ppb */
+	double phc_freq;   /* frequency read back from the clock, ppb, or NAN */
+	double rate_ratio; /* mean rate ratio of the servo, 1.0 if unknown */
+	int64_t age;       /* seconds since it was saved */
+};
+
+/**
+ * Create a frequency state. It also measures the time to the first
+ * lock, which is logged with or without a state file. With a state file,
+ * a thread writes the checkpoints, so that the servo never waits for
+ * the file system.
+ * @param path      The state file, or an empty string to not keep the
+ *                  frequency.
+ * @param id        Identifies the clock, so that the state of another
+ *                  clock is never restored.
+ * @param clkid     The clock, whose frequency is saved along with the
+ *                  one of the servo.
+ * @param interval  Seconds between two checkpoints of the frequency.
+ * @param max_age   Maximum age in seconds of a state to be restored.
+ * @return          A pointer to a new state on success, NULL otherwise.
+ */
+struct freqstate *freqstate_create(const char *path, const char *id,
+				   clockid_t clkid, int interval, int max_age);
+
+/**
+ * Destroy a frequency state. A pending checkpoint is written first, and
+ * the file is kept.
+ * @param fs  Pointer obtained via @ref freqstate_create().
+ */
+void freqstate_destroy(struct freqstate *fs);
+
+/**
+ * Read the state saved by an earlier run.
+ * @param fs     Pointer obtained via @ref freqstate_create().
+ * @param saved  Returns the saved state.
+ * @return       Zero if a recent state of this clock was found,
+ *               non-zero otherwise.
+ */
+int freqstate_restore(struct freqstate *fs, struct freqstate_saved *saved);
+
+/**
+ * Feed a servo sample. While the servo is locked, the mean frequency and
+ * rate ratio are handed to the writer every interval.
+ * @param fs          Pointer obtained via @ref freqstate_create().
+ * @param offset      The master offset in nanoseconds.
+ * @param freq        The frequency adjustment of the servo in ppb.
+ * @param rate_ratio  The rate ratio of the servo, see servo_rate_ratio().
+ * @param state       The state of the servo.
+ */
+void freqstate_update(struct freqstate *fs, int64_t offset, double freq,
+		      double rate_ratio, enum servo_state state);
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * @file kalman.c
+ * @brief Implements a clock servo using a two state Kalman filter.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <math.h>
+
+#include "config.h"
+#include "kalman.h"
+#include "print.h"
+#include "servo_private.h"
+
+/* Measurement noise variance in ns^2 until the delay was measured */
+#define HWTS_NOISE_INITIAL 1e2
+#define SWTS_NOISE_INITIAL 1e6
+/* Lower limit of the measurement noise variance in ns^2 */
+#define NOISE_MIN 1.0
+/* Normalized squared innovation above which the model is not trusted */
+#define INNOV_LIMIT 9.0
+/* Initial frequency variance in ppb^2 */
+#define FREQ_VAR_INITIAL 1e10
+/* Time constant of the phase correction in sync intervals */
+#define TIME_CONSTANT_INTERVALS 4.0
+
+/*
+ * The state is the offset of the local clock in ns and its frequency
+ * offset in ppb, before the adjustment requested by the servo. The
+ * offset grows by (freq - adj) * dt between two samples.
+ */
+struct kalman_servo {
+	struct servo servo;
+	double offset;
+	double freq;
+	double p[2][2];
+	double noise;
+	double adj;
+	uint64_t last_ts;
+	double interval;
+	int count;
+	/* configuration: */
+	double phase_noise;
+	double freq_noise;
+	double time_constant;
+	double noise_initial;
+};
+
+static void kalman_destroy(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	free(s);
+}
+
+static void kalman_init(struct kalman_servo *s, int64_t offset,
+			uint64_t local_ts)
+{
+	s->offset = offset;
+	s->p[0][0] = s->noise;
+	s->p[0][1] = 0.0;
+	s->p[1][0] = 0.0;
+	s->p[1][1] = FREQ_VAR_INITIAL;
+	s->last_ts = local_ts;
+}
+
+static void kalman_predict(struct kalman_servo *s, double dt)
+{
+	double p00 = s->p[0][0], p01 = s->p[0][1], p11 = s->p[1][1];
+	double q1 = s->phase_noise, q2 = s->freq_noise;
+
+	s->offset += (s->freq - s->adj) * dt;
+
+	/* P = F P F' + Q for white and random walk frequency noise */
+	s->p[0][0] = p00 + 2 * dt * p01 + dt * dt * p11 +
+		     q1 * dt + q2 * dt * dt * dt / 3;
+	s->p[0][1] = p01 + dt * p11 + q2 * dt * dt / 2;
+	s->p[1][0] = s->p[0][1];
+	s->p[1][1] = p11 + q2 * dt;
+}
+
+static void kalman_update(struct kalman_servo *s, double z, double weight)
+{
+	double p00 = s->p[0][0], p01 = s->p[0][1], p11 = s->p[1][1];
+	double innov = z - s->offset, r, k0, k1, nis, scale;
+
+	/*
+	 * An innovation far outside of the predicted variance means that
+	 * the frequency changed more than the model allows, e.g. during the
+	 * acquisition. Widen the covariance, so that the state follows.
+	 */
+	r = s->noise / weight;
+	nis = innov * innov / (p00 + r);
+	if (nis > INNOV_LIMIT) {
+		scale = nis / INNOV_LIMIT;
+		p00 *= scale;
+		p01 *= scale;
+		p11 *= scale;
+	}
+
+	k0 = p00 / (p00 + r);
+	k1 = p01 / (p00 + r);
+
+	s->offset += k0 * innov;
+	s->freq += k1 * innov;
+
+	s->p[0][0] = (1 - k0) * p00;
+	s->p[0][1] = (1 - k0) * p01;
+	s->p[1][0] = s->p[0][1];
+	s->p[1][1] = p11 - k1 * p01;
+}
+
+static double kalman_sample(struct servo *servo,
+			    int64_t offset,
+			    uint64_t local_ts,
+			    double weight,
+			    enum servo_state *state)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	double dt, tau;
+
+	if (weight <= 0.0 || weight > 1.0)
+		weight = 1.0;
+
+	switch (s->count) {
+	case 0:
+		kalman_init(s, offset, local_ts);
+		*state = SERVO_UNLOCKED;
+		s->count = 1;
+		return s->adj;
+	case 1:
+		/* Make sure the first sample is older than the second. */
+		if (local_ts <= s->last_ts) {
+			*state = SERVO_UNLOCKED;
+			s->count = 0;
+			return s->adj;
+		}
+		break;
+	default:
+		if (servo->step_threshold &&
+		    servo->step_threshold < fabs(offset)) {
+			*state = SERVO_UNLOCKED;
+			s->count = 0;
+			return s->adj;
+		}
+		break;
+	}
+
+	dt = (local_ts - s->last_ts) / 1e9;
+	s->last_ts = local_ts;
+	kalman_predict(s, dt > 0.0 ? dt : 0.0);
+	kalman_update(s, offset, weight);
+
+	if (s->freq < -servo->max_frequency)
+		s->freq = -servo->max_frequency;
+	else if (s->freq > servo->max_frequency)
+		s->freq = servo->max_frequency;
+
+	if (s->count == 1) {
+		s->count = 2;
+		if ((servo->first_update &&
+		     servo->first_step_threshold &&
+		     servo->first_step_threshold < fabs(offset)) ||
+		    (servo->step_threshold &&
+		     servo->step_threshold < fabs(offset))) {
+			/* The caller steps the clock by the offset. */
+			s->offset = 0.0;
+			s->p[0][0] = s->noise;
+			s->adj = s->freq;
+			*state = SERVO_JUMP;
+			return s->adj;
+		}
+	}
+
+	/* Remove the estimated offset within the time constant. */
+	tau = s->time_constant;
+	if (tau <= 0.0)
+		tau = TIME_CONSTANT_INTERVALS * s->interval;
+	if (tau < dt)
+		tau = dt;
+	s->adj = s->freq + (tau > 0.0 ? s->offset / tau : 0.0);
+
+	if (s->adj < -servo->max_frequency)
+		s->adj = -servo->max_frequency;
+	else if (s->adj > servo->max_frequency)
+		s->adj = servo->max_frequency;
+
+	*state = SERVO_LOCKED;
+	return s->adj;
+}
+
+static void kalman_sync_interval(struct servo *servo, double interval)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->interval = interval;
+
+	pr_debug("Kalman servo: sync interval %.3f", interval);
+}
+
+static void kalman_reset(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->count = 0;
+}
+
+static void kalman_offset_variance(struct servo *servo, double variance)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	/* Follow the measured path delay variation, if there is any. */
+	if (variance <= 0.0)
+		s->noise = s->noise_initial;
+	else if (variance < NOISE_MIN)
+		s->noise = NOISE_MIN;
+	else
+		s->noise = variance;
+}
+
+struct servo *kalman_servo_create(struct config *cfg, int fadj, int sw_ts)
+{
+	struct kalman_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = kalman_destroy;
+	s->servo.sample  = kalman_sample;
+	s->servo.sync_interval = kalman_sync_interval;
+	s->servo.reset   = kalman_reset;
+	s->servo.offset_variance = kalman_offset_variance;
+	s->freq          = fadj;
+	s->adj           = fadj;
+	s->interval      = 1.0;
+	s->phase_noise   = config_get_double(cfg, NULL, "kalman_phase_noise");
+	s->freq_noise    = config_get_double(cfg, NULL, "kalman_freq_noise");
+	s->time_constant = config_get_double(cfg, NULL, "kalman_time_constant");
+	s->noise_initial = sw_ts ? SWTS_NOISE_INITIAL : HWTS_NOISE_INITIAL;
+	s->noise         = s->noise_initial;
+
+	return &s->servo;
+}
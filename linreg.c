@@ -31,6 +31,10 @@
 
 #define MAX_POINTS (1 << MAX_SIZE)
 
+/* Number of samples after which the sums are recomputed from the points,
+   which bounds the accumulated rounding error */
+#define RECOMPUTE_INTERVAL MAX_POINTS
+
 /* Smoothing factor used for long-term prediction error */
 #define ERR_SMOOTH 0.02
 /* Number of updates used for initialization */
@@ -45,6 +49,15 @@ struct point {
 	double w;
 };
 
+/* Weighted sums over the newest points of one size, relative to base */
+struct sums {
+	double x;
+	double y;
+	double xy;
+	double x2;
+	double w;
+};
+
 struct result {
 	/* Slope and intercept from latest regression */
 	double slope;
@@ -61,6 +74,12 @@ struct linreg_servo {
 	struct point points[MAX_POINTS];
 	/* Current time in x, y */
 	struct point reference;
+	/* Origin of the points in the sums, the reference at the last recompute */
+	struct point base;
+	/* Running sums for all sizes */
+	struct sums sums[MAX_SIZE - MIN_SIZE + 1];
+	/* Number of samples since the sums were recomputed */
+	unsigned int updates;
 	/* Number of stored points */
 	unsigned int num_points;
 	/* Index of the newest point */
@@ -123,9 +142,54 @@ static void update_reference(struct linreg_servo *s, uint64_t local_ts)
 	s->last_update = local_ts;
 }
 
+static void sums_update(struct sums *sums, struct linreg_servo *s,
+			unsigned int l, int sign)
+{
+	double x, y, w;
+
+	x = (int64_t)(s->points[l].x - s->base.x);
+	y = (int64_t)(s->points[l].y - s->base.y);
+	w = sign * s->points[l].w;
+
+	sums->x += x * w;
+	sums->y += y * w;
+	sums->xy += x * y * w;
+	sums->x2 += x * x * w;
+	sums->w += w;
+}
+
+static void recompute_sums(struct linreg_servo *s)
+{
+	struct sums sums = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+	unsigned int i, l, size;
+
+	s->base = s->reference;
+	s->updates = 0;
+
+	for (i = 0, size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		for (; i < (1U << size) && i < s->num_points; i++) {
+			/* Iterate points from newest to oldest */
+			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
+			sums_update(&sums, s, l, 1);
+		}
+		s->sums[size - MIN_SIZE] = sums;
+	}
+}
+
 static void add_sample(struct linreg_servo *s, int64_t offset, double weight)
 {
-	s->last_point = (s->last_point + 1) % MAX_POINTS;
+	unsigned int n, size, next = (s->last_point + 1) % MAX_POINTS;
+
+	/* Drop the points which leave the windows, before the oldest
+	   one is overwritten */
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		n = 1 << size;
+		if (s->num_points >= n)
+			sums_update(&s->sums[size - MIN_SIZE], s,
+				    (MAX_POINTS + next - n) % MAX_POINTS, -1);
+	}
+
+	s->last_point = next;
 
 	s->points[s->last_point].x = s->reference.x;
 	s->points[s->last_point].y = s->reference.y - offset;
@@ -133,19 +197,29 @@ static void add_sample(struct linreg_servo *s, int64_t offset, double weight)
 
 	if (s->num_points < MAX_POINTS)
 		s->num_points++;
+
+	if (++s->updates >= RECOMPUTE_INTERVAL) {
+		recompute_sums(s);
+		return;
+	}
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++)
+		sums_update(&s->sums[size - MIN_SIZE], s, s->last_point, 1);
 }
 
 static void regress(struct linreg_servo *s)
 {
-	double x, y, y0, e, x_sum, y_sum, xy_sum, x2_sum, w, w_sum;
-	unsigned int i, l, n, size;
+	double dx, dy, y0, e, x_sum, y_sum, xy_sum, x2_sum, w_sum;
+	unsigned int n, size;
 	struct result *res;
-
-	x_sum = 0.0, y_sum = 0.0, xy_sum = 0.0, x2_sum = 0.0; w_sum = 0.0;
-	i = 0;
+	struct sums *sums;
 
 	y0 = (int64_t)(s->points[s->last_point].y - s->reference.y);
 
+	/* The sums are relative to base, move them to the reference */
+	dx = (int64_t)(s->reference.x - s->base.x);
+	dy = (int64_t)(s->reference.y - s->base.y);
+
 	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
 		n = 1 << size;
 		if (n > s->num_points)
@@ -167,20 +241,12 @@ static void regress(struct linreg_servo *s)
 			}
 		}
 
-		for (; i < n; i++) {
-			/* Iterate points from newest to oldest */
-			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
-
-			x = (int64_t)(s->points[l].x - s->reference.x);
-			y = (int64_t)(s->points[l].y - s->reference.y);
-			w = s->points[l].w;
-
-			x_sum += x * w;
-			y_sum += y * w;
-			xy_sum += x * y * w;
-			x2_sum += x * x * w;
-			w_sum += w;
-		}
+		sums = &s->sums[size - MIN_SIZE];
+		w_sum = sums->w;
+		x_sum = sums->x - dx * w_sum;
+		y_sum = sums->y - dy * w_sum;
+		xy_sum = sums->xy - dx * sums->y - dy * sums->x + dx * dy * w_sum;
+		x2_sum = sums->x2 - 2.0 * dx * sums->x + dx * dx * w_sum;
 
 		/* Get new intercept and slope */
 		res->slope = (xy_sum - x_sum * y_sum / w_sum) /
@@ -302,6 +368,7 @@ static void linreg_reset(struct servo *servo)
 	s->last_update = 0;
 	s->size = 0;
 	s->frequency_ratio = 1.0;
+	recompute_sums(s);
 
 	for (i = MIN_SIZE; i <= MAX_SIZE; i++) {
 		s->results[i - MIN_SIZE].slope = 0.0;
@@ -19,8 +19,10 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <malloc.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
 
 #include <asm/byteorder.h>
 
@@ -44,11 +46,36 @@ struct message_storage {
 
 static TAILQ_HEAD(msg_pool, ptp_message) msg_pool = TAILQ_HEAD_INITIALIZER(msg_pool);
 
+/*
+ * Preallocated messages start on a cache line, with the head room at
+ * the end of the previous one.
+ */
+#define MSG_POOL_ALIGN		64
+#define MSG_POOL_OFFSET		(MSG_POOL_ALIGN - MSG_HEADROOM)
+#define MSG_POOL_HUGEPAGE	(2 * 1024 * 1024)
+
+/* Usage in percent at which the pool alarm is raised and cleared. */
+#define MSG_POOL_ALARM		90
+#define MSG_POOL_ALARM_CLEAR	75
+/* Minimum time in seconds between two logged alarms. */
+#define MSG_POOL_ALARM_INTERVAL	60
+
 static struct {
 	int total;
 	int count;
+	int high_water;
+	int exhausted;
 } pool_stats;
 
+static struct {
+	unsigned char *base;
+	size_t length;
+	int size;
+	int alarm;
+	int alarm_logged;
+	time_t alarm_ts;
+} pool_region;
+
 #ifdef DEBUG_POOL
 static void pool_debug(const char *str, void *addr)
 {
@@ -182,6 +209,139 @@ static void timestamp_pre_send(struct Timestamp *ts)
 
 /* public methods */
 
+static int pool_owns(struct message_storage *s)
+{
+	unsigned char *addr = (unsigned char *) s;
+
+	return addr >= pool_region.base &&
+		addr < pool_region.base + pool_region.length;
+}
+
+static void pool_check_usage(void)
+{
+	int in_use = pool_stats.total - pool_stats.count;
+	struct timespec now;
+
+	if (in_use > pool_stats.high_water)
+		pool_stats.high_water = in_use;
+
+	if (!pool_region.size)
+		return;
+
+	if (!pool_region.alarm &&
+	    in_use * 100 >= pool_region.size * MSG_POOL_ALARM) {
+		pool_region.alarm = 1;
+		/* A pool which hovers around the limit logs rarely. */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (pool_region.alarm_ts &&
+		    now.tv_sec - pool_region.alarm_ts < MSG_POOL_ALARM_INTERVAL)
+			return;
+		pool_region.alarm_logged = 1;
+		pool_region.alarm_ts = now.tv_sec;
+		pr_warning("message pool running low, %d of %d messages in use",
+			   in_use, pool_region.size);
+	} else if (pool_region.alarm &&
+		   in_use * 100 < pool_region.size * MSG_POOL_ALARM_CLEAR) {
+		pool_region.alarm = 0;
+		if (!pool_region.alarm_logged)
+			return;
+		pool_region.alarm_logged = 0;
+		pr_info("message pool recovered, %d of %d messages in use",
+			in_use, pool_region.size);
+	}
+}
+
+/*
+ * Free messages have an all zero PDU beyond their dirty length, so only
+ * the part used by the previous owner and the metadata need clearing.
+ */
+static void msg_clear(struct ptp_message *m)
+{
+	int dirty = m->pdu_dirty;
+
+	if (dirty < 0 || dirty > (int) sizeof(m->data))
+		dirty = sizeof(m->data);
+	memset(m, 0, dirty);
+	memset(&m->tail_room, 0,
+	       sizeof(*m) - offsetof(struct ptp_message, tail_room));
+	m->pdu_dirty = -1;
+}
+
+/*
+ * Record how much of the PDU is in use, once the message length is known.
+ */
+static void msg_set_dirty(struct ptp_message *m, int len)
+{
+	if (len > m->pdu_dirty)
+		m->pdu_dirty = len;
+}
+
+int msg_pool_init(int size, int lock, int hugepages)
+{
+	size_t stride, length;
+	unsigned char *base = MAP_FAILED;
+	struct ptp_message *m;
+	int i;
+
+	if (size <= 0 || pool_region.base)
+		return 0;
+
+	stride = (MSG_POOL_OFFSET + sizeof(struct message_storage) +
+		  MSG_POOL_ALIGN - 1) &
+		~(size_t) (MSG_POOL_ALIGN - 1);
+	length = stride * size;
+
+	if (hugepages) {
+		length = (length + MSG_POOL_HUGEPAGE - 1) &
+			~(size_t) (MSG_POOL_HUGEPAGE - 1);
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			    MAP_POPULATE, -1, 0);
+		if (base == MAP_FAILED) {
+			pr_warning("no huge pages for the message pool: %m");
+			length = stride * size;
+		}
+	}
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	}
+	if (base == MAP_FAILED) {
+		pr_err("failed to map the message pool: %m");
+		return -1;
+	}
+	if (lock && mlock(base, length)) {
+		pr_err("failed to lock the message pool: %m");
+		munmap(base, length);
+		return -1;
+	}
+
+	/*
+	 * Fresh pages are zero, so nothing needs clearing on first use. The
+	 * storage starts at MSG_POOL_OFFSET, so its message right after the
+	 * head room is aligned to MSG_POOL_ALIGN.
+	 */
+	for (i = 0; i < size; i++) {
+		m = (struct ptp_message *) (base + i * stride + MSG_POOL_ALIGN);
+		TAILQ_INSERT_TAIL(&msg_pool, m, list);
+	}
+	pool_stats.total += size;
+	pool_stats.count += size;
+
+	pool_region.base = base;
+	pool_region.length = length;
+	pool_region.size = size;
+	return 0;
+}
+
+void msg_pool_get_stats(struct msg_pool_stats *stats)
+{
+	stats->size = pool_region.size;
+	stats->in_use = pool_stats.total - pool_stats.count;
+	stats->high_water = pool_stats.high_water;
+	stats->exhausted = pool_stats.exhausted;
+}
+
 struct ptp_message *msg_allocate(void)
 {
 	struct message_storage *s;
@@ -192,16 +352,25 @@ struct ptp_message *msg_allocate(void)
 		pool_stats.count--;
 		pool_debug("dequeue", m);
 	} else {
-		s = malloc(sizeof(*s));
+		s = calloc(1, sizeof(*s));
 		if (s) {
 			m = &s->msg;
 			pool_stats.total++;
+			if (pool_region.size) {
+				pool_stats.exhausted++;
+				/* Log the 1st, 2nd, 4th, ... time only. */
+				if (!(pool_stats.exhausted &
+				      (pool_stats.exhausted - 1)))
+					pr_err("message pool exhausted %d times",
+					       pool_stats.exhausted);
+			}
 			pool_debug("allocate", m);
 		}
 	}
 	if (m) {
-		memset(m, 0, sizeof(*m));
+		msg_clear(m);
 		m->refcnt = 1;
+		pool_check_usage();
 	}
 
 	return m;
@@ -213,8 +382,16 @@ void msg_cleanup(void)
 	struct ptp_message *m;
 	while ((m = TAILQ_FIRST(&msg_pool)) != NULL) {
 		TAILQ_REMOVE(&msg_pool, m, list);
+		pool_stats.total--;
+		pool_stats.count--;
 		s = container_of(m, struct message_storage, msg);
-		free(s);
+		if (!pool_owns(s))
+			free(s);
+	}
+	/* The region stays if any of its messages is still in use. */
+	if (pool_region.base && !pool_stats.total) {
+		munmap(pool_region.base, pool_region.length);
+		memset(&pool_region, 0, sizeof(pool_region));
 	}
 }
 
@@ -228,6 +405,8 @@ int msg_post_recv(struct ptp_message *m, int cnt)
 	int pdulen, type, err;
 	uint8_t *suffix = NULL;
 
+	msg_set_dirty(m, cnt);
+
 	if (cnt < (int)sizeof(struct ptp_header))
 		return -EBADMSG;
 
@@ -330,6 +509,8 @@ int msg_pre_send(struct ptp_message *m)
 	int type;
 	uint8_t *suffix = NULL;
 
+	msg_set_dirty(m, m->header.messageLength);
+
 	if (hdr_pre_send(&m->header))
 		return -1;
 
@@ -447,6 +628,7 @@ void msg_put(struct ptp_message *m)
 		pool_stats.count++;
 		pool_debug("recycle", m);
 		TAILQ_INSERT_HEAD(&msg_pool, m, list);
+		pool_check_usage();
 	}
 }
 
@@ -183,6 +183,11 @@ struct ptp_message {
 		struct management_msg      management;
 		struct message_data        data;
 	} PACKED;
+	/**
+	 * Number of leading PDU bytes which may be non-zero when the
+	 * message goes back into the pool, or -1 if unknown.
+	 */
+	int pdu_dirty;
 	/**/
 	int tail_room;
 	int refcnt;
@@ -290,6 +295,38 @@ struct ptp_message *msg_allocate(void);
  */
 void msg_cleanup(void);
 
+/**
+ * Statistics of the message cache.
+ */
+struct msg_pool_stats {
+	int size;       /* messages preallocated by msg_pool_init() */
+	int in_use;     /* messages currently allocated */
+	int high_water; /* largest value of in_use so far */
+	int exhausted;  /* allocations which found the preallocated pool empty */
+};
+
+/**
+ * Preallocate the message cache.
+ *
+ * The messages are carved out of one memory region, each starting on a
+ * cache line. Once they are all in use, @ref msg_allocate() falls back
+ * to malloc() and counts the allocation as exhausted. A warning is
+ * logged when the pool is nearly used up.
+ *
+ * @param size       Number of messages to preallocate, zero to allocate
+ *                   all messages on demand.
+ * @param lock       Lock the region into memory if non-zero.
+ * @param hugepages  Try to back the region with huge pages if non-zero.
+ * @return           Zero on success, non-zero otherwise.
+ */
+int msg_pool_init(int size, int lock, int hugepages);
+
+/**
+ * Obtain the statistics of the message cache.
+ * @param stats  Returns the current statistics.
+ */
+void msg_pool_get_stats(struct msg_pool_stats *stats);
+
 /**
  * Obtain a reference to a message, increasing its reference count by one.
  * @param m A message obtained using @ref msg_allocate().
@@ -1,7 +1,7 @@
 /**
  * @file ntpshm.c
- * @brief Implements a servo providing the NTP SHM reference clock to
- *        send the samples to another process.
+ * @brief Implements servos providing the NTP SHM and the chrony SOCK
+ *        reference clocks to send the samples to another process.
  * @note Copyright (C) 2014 Miroslav Lichvar <mlichvar@redhat.com>
  *
  * This program is free software; you can redistribute it and/or modify
@@ -19,8 +19,13 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/shm.h>
+#include <sys/un.h>
 
 #include "config.h"
 #include "print.h"
@@ -59,12 +64,45 @@ struct shmTime {
 	int    dummy[8];
 };
 
+/* Magic value of a chrony SOCK sample */
+#define SOCK_MAGIC 0x534f434b
+
+/* Declaration of the SOCK sample from chrony (refclock_sock.c) */
+struct sock_sample {
+	struct timeval tv; /* system time of the measurement */
+	double offset;     /* true time minus system time, in seconds */
+	int pulse;
+	int leap;
+	int _pad;
+	int magic;
+};
+
 struct ntpshm_servo {
 	struct servo servo;
 	struct shmTime *shm;
 	int leap;
 };
 
+struct ntpsock_servo {
+	struct servo servo;
+	struct sockaddr_un addr;
+	int fd;
+	int leap;
+	int failed;
+};
+
+static int ntp_leap(int leap)
+{
+	switch (leap) {
+	case -1:
+		return LEAP_DELETE;
+	case 1:
+		return LEAP_INSERT;
+	default:
+		return LEAP_NORMAL;
+	}
+}
+
 static void ntpshm_destroy(struct servo *servo)
 {
 	struct ntpshm_servo *s = container_of(servo, struct ntpshm_servo, servo);
@@ -81,11 +119,17 @@ static double ntpshm_sample(struct servo *servo,
 {
 	struct ntpshm_servo *s = container_of(servo, struct ntpshm_servo, servo);
 	uint64_t clock_ts = local_ts - offset;
+	int count;
 
-	s->shm->mode = 1;
-	s->shm->count++;
-	s->shm->valid = 0;
-	/* TODO: write memory barrier */
+	/*
+	 * The reader copies the segment and drops the copy unless 'valid'
+	 * was set and 'count' did not change meanwhile, so both must be
+	 * stored before the values, and after them again.
+	 */
+	count = __atomic_load_n(&s->shm->count, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->shm->count, count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->shm->valid, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
 
 	s->shm->clockTimeStampSec = clock_ts / NS_PER_SEC;
 	s->shm->clockTimeStampNSec = clock_ts % NS_PER_SEC;
@@ -94,22 +138,10 @@ static double ntpshm_sample(struct servo *servo,
 	s->shm->receiveTimeStampNSec = local_ts % NS_PER_SEC;
 	s->shm->receiveTimeStampUSec = s->shm->receiveTimeStampNSec / 1000;
 	s->shm->precision = -30; /* 1 nanosecond */
+	s->shm->leap = ntp_leap(s->leap);
 
-	switch (s->leap) {
-		case -1:
-			s->shm->leap = LEAP_DELETE;
-			break;
-		case 1:
-			s->shm->leap = LEAP_INSERT;
-			break;
-		default:
-			s->shm->leap = LEAP_NORMAL;
-	}
-
-	/* TODO: write memory barrier */
-
-	s->shm->count++;
-	s->shm->valid = 1;
+	__atomic_store_n(&s->shm->count, count + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->shm->valid, 1, __ATOMIC_RELEASE);
 
 	*state = SERVO_UNLOCKED;
 	return 0.0;
@@ -160,6 +192,90 @@ struct servo *ntpshm_servo_create(struct config *cfg)
 		free(s);
 		return NULL;
 	}
+	s->shm->mode = 1;
+
+	return &s->servo;
+}
+
+static void ntpsock_destroy(struct servo *servo)
+{
+	struct ntpsock_servo *s = container_of(servo, struct ntpsock_servo, servo);
+
+	close(s->fd);
+	free(s);
+}
+
+static double ntpsock_sample(struct servo *servo,
+			     int64_t offset,
+			     uint64_t local_ts,
+			     double weight,
+			     enum servo_state *state)
+{
+	struct ntpsock_servo *s = container_of(servo, struct ntpsock_servo, servo);
+	uint64_t clock_ts = local_ts - offset, tv_ts;
+	struct sock_sample sample;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.tv.tv_sec = local_ts / NS_PER_SEC;
+	sample.tv.tv_usec = local_ts % NS_PER_SEC / 1000;
+	/* Keep the nanoseconds lost in the timeval in the offset. */
+	tv_ts = local_ts - local_ts % 1000;
+	sample.offset = (int64_t) (clock_ts - tv_ts) / 1e9;
+	sample.leap = ntp_leap(s->leap);
+	sample.magic = SOCK_MAGIC;
+
+	/* The socket is not connected, so that chronyd may restart. */
+	if (sendto(s->fd, &sample, sizeof(sample), MSG_DONTWAIT,
+		   (struct sockaddr *) &s->addr, sizeof(s->addr)) !=
+	    sizeof(sample)) {
+		if (!s->failed)
+			pr_err("ntpsock: sendto %s failed: %m", s->addr.sun_path);
+		s->failed = 1;
+	} else if (s->failed) {
+		pr_info("ntpsock: sending samples to %s", s->addr.sun_path);
+		s->failed = 0;
+	}
+
+	*state = SERVO_UNLOCKED;
+	return 0.0;
+}
+
+static void ntpsock_leap(struct servo *servo, int leap)
+{
+	struct ntpsock_servo *s = container_of(servo, struct ntpsock_servo, servo);
+
+	s->leap = leap;
+}
+
+struct servo *ntpsock_servo_create(struct config *cfg)
+{
+	char *path = config_get_string(cfg, NULL, "ntpsock_path");
+	struct ntpsock_servo *s;
+
+	if (strlen(path) >= sizeof(s->addr.sun_path)) {
+		pr_err("ntpsock: path %s too long", path);
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = ntpsock_destroy;
+	s->servo.sample = ntpsock_sample;
+	s->servo.sync_interval = ntpshm_sync_interval;
+	s->servo.reset = ntpshm_reset;
+	s->servo.leap = ntpsock_leap;
+
+	s->addr.sun_family = AF_LOCAL;
+	strcpy(s->addr.sun_path, path);
+
+	s->fd = socket(AF_LOCAL, SOCK_DGRAM, 0);
+	if (s->fd < 0) {
+		pr_err("ntpsock: socket failed: %m");
+		free(s);
+		return NULL;
+	}
 
 	return &s->servo;
 }
@@ -23,4 +23,12 @@
 
 struct servo *ntpshm_servo_create(struct config *cfg);
 
+/**
+ * Create a servo which sends every sample to chronyd, over the Unix
+ * datagram socket of a SOCK reference clock.
+ * @param cfg  The configuration, which provides the socket path.
+ * @return     A pointer to a new servo on success, NULL otherwise.
+ */
+struct servo *ntpsock_servo_create(struct config *cfg);
+
 #endif
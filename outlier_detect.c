@@ -16,6 +16,7 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -26,6 +27,7 @@
 
 #include "outlier_detect.h"
 #include "filter_private.h"
+#include "swindow.h"
 
 #define NSEC_PER_SEC 1000000000
 
@@ -33,56 +35,15 @@ struct outlier_detector {
     struct filter filter;   // base "class"
 
     double max_offset;      // defined offset limit for servo
-    tmv_t limit;            // current offset limit (defined by middle value of 'sample' array)
+    tmv_t limit;            // current offset limit (defined by 'percentile' of the window)
 
-    size_t len;            // size of '*order' and '*samples' array
-    size_t cnt;            // current number samples in '*samples'  ('cnt' <= 'len')
+    double percentile;      // rank of the window used as limit
+    int hysteresis;         // clamped samples in a row which are accepted as a step
+    int clamped;            // clamped samples in a row so far
 
-    int index;              // next index to be changed in 'samples' ('idx' <= 'cnt')
-    int *order;             // sorted values stored as index of 'samples'
-    tmv_t *samples;         // array of samples to be used inside this filter as circular buffer
+    struct swindow *window; // absolute values of the last samples
 };
 
-/*
- * private local functions
- */
-
-static int update_sorted_array(struct outlier_detector *od) {
-    unsigned i;
-
-    if (od->cnt < od->len) {
-        od->cnt++;
-    } else {
-        /* remove index of the replaced value from order. */
-        for (i = 0; i < od->cnt - 1; i++) {
-            // look for the oldest element (thats the one to replace) in 'od->order'
-            if (od->order[i] == od->index) {
-                break;
-            }
-        }
-        for (; i + 1 < od->cnt; i++) {
-            // overwrite it by copying all successors one element ahead
-            // Note: this causes the last element to be doubled
-            od->order[i] = od->order[i + 1];
-        }
-    }
-
-    /* insert index of the new value to order. */
-    for (i = od->cnt - 1; i > 0; i--) {
-        // now find where to place the new 'sample' in 'order', we are searching from tail here
-        if (od->samples[od->order[i - 1]] <= od->samples[od->index]) {
-            break;
-        }
-        // push elements that are to big one element back
-        // Note: this "repairs" the doubled last element, either by overwriting the last element below, or by overwriting one of its predecessors
-        od->order[i] = od->order[i - 1];
-    }
-    // now put the new element to the appropriate place
-    od->order[i] = od->index;
-
-    return (1 + od->index) % od->len; // next element in order to be replaced
-}
-
 /*
  * Interface implementation starts here
  */
@@ -90,8 +51,7 @@ static int update_sorted_array(struct outlier_detector *od) {
 static void outlier_detect_destroy(struct filter *filter)
 {
     struct outlier_detector *od = container_of(filter, struct outlier_detector, filter);
-    free(od->samples);
-    free(od->order);
+    swindow_destroy(od->window);
     free(od);
 }
 
@@ -99,31 +59,23 @@ static void outlier_detect_reset(struct filter *filter)
 {
     struct outlier_detector *od = container_of(filter, struct outlier_detector, filter);
 
-    od->cnt = 0;
-    od->index = 0;
-
     od->limit = od->max_offset;
+    od->clamped = 0;
 
-    memset(od->order, 0, od->len);
-    memset(od->samples, 0, od->len);
+    // constant time, the window only drops its counters
+    swindow_reset(od->window);
 }
 
 static tmv_t outlier_detect_sample(struct filter *filter, tmv_t sample)
 {
     struct outlier_detector *od = container_of(filter, struct outlier_detector, filter);
 
-    // add new sample to circular buffer
-    od->samples[od->index] = llabs(sample);
-
-    // update sorted array of 'sample'-buffer
-    od->index = update_sorted_array(od);
-
-    if (od->cnt % 2) {
-        // odd number of samples, so 'limit' is the middle value in 'samples'
-        od->limit = od->samples[od->order[od->cnt / 2]];
+    // add new sample to the window, 'limit' is the percentile of the window
+    swindow_add(od->window, llabs(sample));
+    if (od->percentile == 0.5) {
+        od->limit = swindow_median(od->window);
     } else {
-        // even number of samples, so 'limit' is the average of the both middle values in 'samples'
-        od->limit = tmv_div(tmv_add(od->samples[od->order[od->cnt / 2 - 1]], od->samples[od->order[od->cnt / 2]]), 2);
+        od->limit = swindow_rank(od->window);
     }
 
     //pr_info("sample %10" PRId64 " current limit %10" PRId64,tmv_to_nanoseconds(sample), tmv_to_nanoseconds(od->limit));
@@ -138,17 +90,25 @@ static tmv_t outlier_detect_sample(struct filter *filter, tmv_t sample)
     // servo in locked state
     // check if out of limit
     if (llabs(sample) > od->limit) {
+        if (od->hysteresis && ++od->clamped > od->hysteresis) {
+            // the offset stayed out of limit, take it as a real step
+            pr_debug("outlier detector: accepting step to %" PRId64, tmv_to_nanoseconds(sample));
+            outlier_detect_reset(filter);
+            return sample;
+        }
         return (sample < 0) ? -(od->limit) : od->limit;
     }
+    od->clamped = 0;
 
     return sample; // innerhalb des limits keine beeinflussung von sample
 }
 
-struct filter *outlier_detect_create(int length, double threshold)
+struct filter *outlier_detect_create(int length, double threshold,
+				     double percentile, int hysteresis)
 {
     struct outlier_detector *od;
 
-    if (length < 1) {
+    if (length < 1 || hysteresis < 0) {
         return NULL;
     }
 
@@ -167,22 +127,16 @@ struct filter *outlier_detect_create(int length, double threshold)
         od->max_offset = threshold * NSEC_PER_SEC;
     }
     //pr_info("caught: %f %f!", configured_pi_offset, od->max_offset);
+    od->limit = od->max_offset;
+    od->percentile = percentile;
+    od->hysteresis = hysteresis;
 
     // prepare outlier detector data structures
-    od->order = calloc(1, length * sizeof(*od->order));
-    if (!od->order) {
-        free(od);
-        return NULL;
-    }
-
-    od->samples = calloc(1, length * sizeof(*od->samples));
-    if (!od->samples) {
-        free(od->order);
+    od->window = swindow_create(length, percentile);
+    if (!od->window) {
         free(od);
         return NULL;
     }
 
-    od->len = length;
-
     return &od->filter;
 }
@@ -23,6 +23,18 @@
 #include "filter.h"
 
 
-struct filter *outlier_detect_create(int length, double threshold);
+/**
+ * Create an outlier detector. Samples whose magnitude exceeds the given
+ * percentile of the magnitudes in the window are clamped to it.
+ * @param length      Number of samples in the window.
+ * @param threshold   Offset in seconds above which the detector resets.
+ * @param percentile  Percentile of the window used as the limit, 0.5 for the
+ *                    median.
+ * @param hysteresis  Number of consecutive clamped samples after which a
+ *                    step is accepted as legitimate, 0 to always clamp.
+ * @return A pointer to a new filter on success, NULL otherwise.
+ */
+struct filter *outlier_detect_create(int length, double threshold,
+				     double percentile, int hysteresis);
 
 #endif
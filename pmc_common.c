@@ -192,6 +192,9 @@ static int pmc_tlv_datalen(struct pmc *pmc, int id)
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		len += sizeof(struct grandmaster_settings_np);
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		len += sizeof(struct msg_pool_stats_np);
+		break;
 	case TLV_NULL_MANAGEMENT:
 		break;
 	case TLV_CLOCK_DESCRIPTION:
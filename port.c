@@ -27,6 +27,7 @@
 #include "rv_ptp_ifc.h"
 
 #include "bmc.h"
+#include "capture.h"
 #include "clock.h"
 #include "filter.h"
 #include "missing.h"
@@ -34,7 +35,11 @@
 #include "phc.h"
 #include "port.h"
 #include "print.h"
+#include "rxthread.h"
 #include "sk.h"
+#include "standby.h"
+#include "theilsen.h"
+#include "timerq.h"
 #include "tlv.h"
 #include "tmv.h"
 #include "tsproc.h"
@@ -45,6 +50,10 @@
 
 #define ALLOWED_LOST_RESPONSES 3
 #define ANNOUNCE_SPAN 1
+#define N_TX_PENDING 8
+
+/* Requests, responses and the last Sync kept by a port */
+#define PORT_MSG_HELD 8
 
 enum syfu_state {
 	SF_EMPTY,
@@ -61,6 +70,8 @@ enum syfu_event {
 
 struct nrate_estimator {
 	double ratio;
+	/* Robust fit over the last exchanges, NULL for the two point mode */
+	struct theilsen *fit;
 	tmv_t origin1;
 	tmv_t ingress1;
 	unsigned int max_count;
@@ -68,6 +79,16 @@ struct nrate_estimator {
 	int ratio_valid;
 };
 
+/*
+ * An event message whose transmit time stamp is still on the error
+ * queue, together with the follow up waiting for that time stamp.
+ */
+struct tx_pending {
+	struct ptp_message *msg;
+	struct ptp_message *fup;
+	struct timespec sent;
+};
+
 struct port {
 	LIST_ENTRY(port) list;
 	char *name;
@@ -75,13 +96,17 @@ struct port {
 	struct transport *trp;
 	enum timestamp_type timestamping;
 	struct fdarray fda;
-	int fault_fd;
+	struct rxq *rxq; /* NULL unless a receive thread serves the port */
+	/* Timers of the FD_*_TIMER events, in the clock's timer queue. */
+	struct tmr tmr[N_TIMER_FDS];
+	struct tmr fault_tmr;
 	int phc_index;
 	int jbod;
 	struct foreign_clock *best;
 	enum syfu_state syfu;
 	struct ptp_message *last_syncfup;
 	struct ptp_message *delay_req;
+	struct ptp_message *delay_resp; /* waiting for the delay_req time stamp */
 	struct ptp_message *peer_delay_req;
 	struct ptp_message *peer_delay_resp;
 	struct ptp_message *peer_delay_fup;
@@ -102,11 +127,23 @@ struct port {
     
 	tmv_t peer_delay;
 	struct tsproc *tsproc;
+	/* Candidate masters kept converged, NULL if disabled. */
+	struct standby *standby;
+	/* Entry of the current master, whose tsproc is p->tsproc. */
+	struct standby_master *active;
 	int log_sync_interval;
 	struct nrate_estimator nrate;
 	unsigned int pdr_missing;
 	unsigned int multiple_seq_pdr_count;
 	unsigned int multiple_pdr_detected;
+	struct tx_pending tx_pending[N_TX_PENDING];
+	unsigned int rv_dirty; /* RV_PTP_DIRTY_* bits not yet exported */
+	struct ptp_message *rx_batch[TRANSPORT_RECV_BATCH];
+	int rx_len[TRANSPORT_RECV_BATCH];
+	struct ptp_message *tx_batch[TRANSPORT_SEND_BATCH];
+	int tx_batch_len;
+	unsigned long delay_resp_sent;
+	unsigned long delay_resp_flushes;
 	/* portDS */
 	struct PortIdentity portIdentity;
 	enum port_state     state; /*portState*/
@@ -135,7 +172,15 @@ struct port {
 	enum fault_type     last_fault_type;
 	unsigned int        versionNumber; /*UInteger4*/
 	/* foreignMasterDS */
-	LIST_HEAD(fm, foreign_clock) foreign_masters;
+	struct foreign_index foreign_masters;
+	/* Next hash bucket to expire old announce messages from. */
+	unsigned int fm_sweep;
+	/* Erbest as of the last port_compute_best(). */
+	struct dataset erbest;
+	int erbest_changed;
+	/* Last recommended state and the port state right after it. */
+	enum fsm_event last_rs;
+	enum port_state last_rs_state;
 };
 
 #define portnum(p) (p->portIdentity.portNumber)
@@ -145,6 +190,13 @@ struct port {
 static int port_capable(struct port *p);
 static int port_is_ieee8021as(struct port *p);
 static void port_nrate_initialize(struct port *p);
+static void port_peer_delay(struct port *p);
+static void process_delay_resp(struct port *p, struct ptp_message *m);
+static void rv_set_port_dirty(struct port *p, unsigned int dirty);
+static enum fsm_event port_rx_message(struct port *p, struct ptp_message *msg,
+				      int cnt);
+static enum fsm_event port_rx_parsed(struct port *p, struct ptp_message *msg,
+				     int err);
 
 static int announce_compare(struct ptp_message *m1, struct ptp_message *m2)
 {
@@ -228,9 +280,20 @@ int fault_interval(struct port *port, enum fault_type ft,
 	return 0;
 }
 
-int port_fault_fd(struct port *port)
+void port_tag_timers(struct port *p, uint64_t base)
+{
+	int i;
+
+	for (i = 0; i < N_TIMER_FDS; i++)
+		p->tmr[i].data = base + FD_ANNOUNCE_TIMER + i;
+	p->fault_tmr.data = base + N_POLLFD;
+}
+
+static struct tmr *port_tmr(struct port *p, int index)
 {
-	return port->fault_fd;
+	if (index == N_POLLFD)
+		return &p->fault_tmr;
+	return &p->tmr[index - FD_ANNOUNCE_TIMER];
 }
 
 struct fdarray *port_fda(struct port *port)
@@ -238,11 +301,14 @@ struct fdarray *port_fda(struct port *port)
 	return &port->fda;
 }
 
-int set_tmo_log(int fd, unsigned int scale, int log_seconds)
+int port_rxq_fd(struct port *port)
+{
+	return port->rxq ? rxq_fd(port->rxq) : -1;
+}
+
+int set_tmo_log(struct port *p, int index, unsigned int scale,
+		int log_seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 	uint64_t ns;
 	int i;
 
@@ -252,35 +318,23 @@ int set_tmo_log(int fd, unsigned int scale, int log_seconds)
 		for (i = 1, ns = scale * 500000000ULL; i < log_seconds; i++) {
 			ns >>= 1;
 		}
-		tmo.it_value.tv_nsec = ns;
-
-		while (tmo.it_value.tv_nsec >= NS_PER_SEC) {
-			tmo.it_value.tv_nsec -= NS_PER_SEC;
-			tmo.it_value.tv_sec++;
-		}
 
 	} else
-		tmo.it_value.tv_sec = scale * (1 << log_seconds);
+		ns = (uint64_t) scale * (1 << log_seconds) * NS_PER_SEC;
 
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return timerq_arm(clock_timerq(p->clock), port_tmr(p, index), ns);
 }
 
-int set_tmo_lin(int fd, int seconds)
+int set_tmo_lin(struct port *p, int index, int seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-
-	tmo.it_value.tv_sec = seconds;
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return timerq_arm(clock_timerq(p->clock), port_tmr(p, index),
+			  (uint64_t) seconds * NS_PER_SEC);
 }
 
-int set_tmo_random(int fd, int min, int span, int log_seconds)
+int set_tmo_random(struct port *p, int index, int min, int span,
+		   int log_seconds)
 {
 	uint64_t value_ns, min_ns, span_ns;
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 
 	if (log_seconds >= 0) {
 		min_ns = min * NS_PER_SEC << log_seconds;
@@ -292,21 +346,32 @@ int set_tmo_random(int fd, int min, int span, int log_seconds)
 
 	value_ns = min_ns + (span_ns * (random() % (1 << 15) + 1) >> 15);
 
-	tmo.it_value.tv_sec = value_ns / NS_PER_SEC;
-	tmo.it_value.tv_nsec = value_ns % NS_PER_SEC;
-
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return timerq_arm(clock_timerq(p->clock), port_tmr(p, index), value_ns);
 }
 
 int port_set_fault_timer_log(struct port *port,
 			     unsigned int scale, int log_seconds)
 {
-	return set_tmo_log(port->fault_fd, scale, log_seconds);
+	return set_tmo_log(port, N_POLLFD, scale, log_seconds);
 }
 
 int port_set_fault_timer_lin(struct port *port, int seconds)
 {
-	return set_tmo_lin(port->fault_fd, seconds);
+	return set_tmo_lin(port, N_POLLFD, seconds);
+}
+
+/*
+ * Refresh the data set from the latest announce message, and move the
+ * foreign master to its place in the index of qualified masters.
+ */
+static void fm_update(struct port *p, struct foreign_clock *fc)
+{
+	announce_to_dataset(TAILQ_FIRST(&fc->messages), p, &fc->dataset);
+
+	if (fc->n_messages < FOREIGN_MASTER_THRESHOLD)
+		foreign_index_disqualify(&p->foreign_masters, fc);
+	else if (foreign_index_qualify(&p->foreign_masters, fc))
+		pr_err("low memory, failed to qualify foreign master");
 }
 
 static void fc_clear(struct foreign_clock *fc)
@@ -319,6 +384,7 @@ static void fc_clear(struct foreign_clock *fc)
 		fc->n_messages--;
 		msg_put(m);
 	}
+	foreign_index_disqualify(&fc->port->foreign_masters, fc);
 }
 
 static void fc_prune(struct foreign_clock *fc)
@@ -343,6 +409,9 @@ static void fc_prune(struct foreign_clock *fc)
 		fc->n_messages--;
 		msg_put(m);
 	}
+
+	if (fc->n_messages < FOREIGN_MASTER_THRESHOLD)
+		foreign_index_disqualify(&fc->port->foreign_masters, fc);
 }
 
 static void ts_add(struct timespec *ts, int ns)
@@ -377,10 +446,8 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 	struct ptp_message *tmp;
 	int broke_threshold = 0, diff = 0;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		if (msg_source_equal(m, fc))
-			break;
-	}
+	fc = foreign_index_find(&p->foreign_masters,
+				&m->header.sourcePortIdentity);
 	if (!fc) {
         char foreign_master[64];
         
@@ -394,9 +461,9 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 		}
 		memset(fc, 0, sizeof(*fc));
 		TAILQ_INIT(&fc->messages);
-		LIST_INSERT_HEAD(&p->foreign_masters, fc, list);
 		fc->port = p;
 		fc->dataset.sender = m->header.sourcePortIdentity;
+		foreign_index_add(&p->foreign_masters, fc);
 		/* We do not count this first message, see 9.5.3(b) */
 		return 0;
 	}
@@ -414,6 +481,7 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 	msg_get(m);
 	fc->n_messages++;
 	TAILQ_INSERT_HEAD(&fc->messages, m, list);
+	fm_update(p, fc);
 
 	/*
 	 * Test if this announcement contains changed information.
@@ -456,10 +524,166 @@ static struct follow_up_info_tlv *follow_up_info_extract(struct ptp_message *m)
 static void free_foreign_masters(struct port *p)
 {
 	struct foreign_clock *fc;
-	while ((fc = LIST_FIRST(&p->foreign_masters)) != NULL) {
-		LIST_REMOVE(fc, list);
-		fc_clear(fc);
-		free(fc);
+	int i;
+
+	for (i = 0; i < FOREIGN_MASTER_BUCKETS; i++) {
+		while ((fc = LIST_FIRST(&p->foreign_masters.buckets[i]))) {
+			LIST_REMOVE(fc, list);
+			fc_clear(fc);
+			free(fc);
+		}
+	}
+}
+
+/* Returns the qualified foreign master with the given identity, if any. */
+static struct foreign_clock *fc_find(struct port *p, struct PortIdentity *pid)
+{
+	struct foreign_clock *fc = foreign_index_find(&p->foreign_masters, pid);
+
+	return fc && fc->index >= 0 ? fc : NULL;
+}
+
+/*
+ * Find the standby entry of a master, or claim one for it if it ranks
+ * among the best qualified foreign masters of the port. The entry of the
+ * current master is never taken.
+ */
+static struct standby_master *port_standby_select(struct port *p,
+						   struct PortIdentity *source)
+{
+	struct foreign_clock *fc, *mfc, *vfc = NULL;
+	struct standby_master *m, *victim = NULL;
+	int i;
+
+	m = standby_find(p->standby, source);
+	if (m)
+		return m;
+	fc = fc_find(p, source);
+	if (!fc)
+		return NULL;
+
+	for (i = 0; i < standby_size(p->standby); i++) {
+		m = standby_get(p->standby, i);
+		if (m == p->active)
+			continue;
+		mfc = m->used ? fc_find(p, &m->source) : NULL;
+		if (!mfc) {
+			/* Free, or its master is no longer qualified. */
+			victim = m;
+			vfc = NULL;
+			break;
+		}
+		if (!victim || dscmp(&mfc->dataset, &vfc->dataset) < 0) {
+			victim = m;
+			vfc = mfc;
+		}
+	}
+	if (!victim || (vfc && dscmp(&fc->dataset, &vfc->dataset) <= 0))
+		return NULL;
+
+	standby_claim(victim, source);
+	return victim;
+}
+
+/* Switch the port's time stamp processor to the entry of a new master. */
+static void port_standby_activate(struct port *p, struct PortIdentity *source)
+{
+	struct standby_master *m;
+
+	m = port_standby_select(p, source);
+	if (!m || m == p->active)
+		return;
+	if (m->sync) {
+		msg_put(m->sync);
+		m->sync = NULL;
+	}
+	p->active = m;
+	p->tsproc = m->tsproc;
+	if (p->state == PS_UNCALIBRATED || p->state == PS_SLAVE)
+		clock_update_filter(p->clock, p->tsproc);
+}
+
+/* Track a sync or follow up from a master other than the current one. */
+static void port_standby_sync(struct port *p, struct ptp_message *m)
+{
+	struct ptp_message *syn, *fup;
+	struct standby_master *sm;
+	tmv_t t1c, t2;
+
+	sm = port_standby_select(p, &m->header.sourcePortIdentity);
+	if (!sm || sm == p->active)
+		return;
+
+	switch (msg_type(m)) {
+	case SYNC:
+		if (one_step(m)) {
+			syn = fup = m;
+			break;
+		}
+		if (sm->sync)
+			msg_put(sm->sync);
+		msg_get(m);
+		sm->sync = m;
+		return;
+	case FOLLOW_UP:
+		syn = sm->sync;
+		if (!syn || syn->header.sequenceId != m->header.sequenceId)
+			return;
+		fup = m;
+		break;
+	default:
+		return;
+	}
+
+	t2 = timespec_to_tmv(syn->hwts.ts);
+	t1c = tmv_add(timestamp_to_tmv(fup->ts.pdu),
+		      correction_to_tmv(syn->header.correction + p->asymmetry));
+	if (fup != syn)
+		t1c = tmv_add(t1c, correction_to_tmv(fup->header.correction));
+
+	tsproc_set_clock_rate_ratio(sm->tsproc, clock_rate_ratio(p->clock));
+	standby_sync(sm, t1c, t2, syn->header.logMessageInterval);
+
+	if (sm->sync) {
+		msg_put(sm->sync);
+		sm->sync = NULL;
+	}
+}
+
+/* Track the delay to a master other than the current one. */
+static void port_standby_delay(struct port *p, struct ptp_message *m)
+{
+	struct standby_master *sm;
+	tmv_t t3, t4c, delay;
+
+	sm = standby_find(p->standby, &m->header.sourcePortIdentity);
+	if (!sm || sm == p->active)
+		return;
+
+	t3 = timespec_to_tmv(p->delay_req->hwts.ts);
+	t4c = tmv_sub(timestamp_to_tmv(m->ts.pdu),
+		      correction_to_tmv(m->header.correction));
+	tsproc_up_ts(sm->tsproc, t3, t4c);
+	tsproc_update_delay(sm->tsproc, &delay);
+}
+
+/* The peer delay is the same for all masters, keep their filters warm. */
+static void port_standby_peer_delay(struct port *p, tmv_t t1, tmv_t t2,
+				    tmv_t t3c, tmv_t t4)
+{
+	struct standby_master *sm;
+	tmv_t delay;
+	int i;
+
+	for (i = 0; i < standby_size(p->standby); i++) {
+		sm = standby_get(p->standby, i);
+		if (!sm->used || sm == p->active)
+			continue;
+		tsproc_set_clock_rate_ratio(sm->tsproc, p->nrate.ratio *
+					    clock_rate_ratio(p->clock));
+		tsproc_up_ts(sm->tsproc, t1, t2);
+		tsproc_down_ts(sm->tsproc, t3c, t4);
+		tsproc_update_delay(sm->tsproc, &delay);
 	}
 }
 
@@ -618,12 +842,9 @@ not_capable:
 	return 0;
 }
 
-static int port_clr_tmo(int fd)
+static void port_clr_tmo(struct port *p, int index)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	timerq_cancel(clock_timerq(p->clock), port_tmr(p, index));
 }
 
 static int port_ignore(struct port *p, struct ptp_message *m)
@@ -926,6 +1147,17 @@ static void port_nrate_calculate(struct port *p, tmv_t origin, tmv_t ingress)
 	 */
 	p->pdr_missing = 0;
 
+	if (n->fit) {
+		if (theilsen_add(n->fit, ingress, origin)) {
+			pr_debug("port %hu: ignoring outlier in nrate calculation",
+				 portnum(p));
+			return;
+		}
+		/* Invalid until the window refills after a reset. */
+		n->ratio_valid = !theilsen_slope(n->fit, &n->ratio);
+		return;
+	}
+
 	if (!n->ingress1) {
 		n->ingress1 = ingress;
 		n->origin1 = origin;
@@ -971,46 +1203,58 @@ static void port_nrate_initialize(struct port *p)
 	p->nrate.count = 0;
 	p->nrate.ratio = 1.0;
 	p->nrate.ratio_valid = 0;
+	if (p->nrate.fit)
+		theilsen_reset(p->nrate.fit);
+}
+
+void port_clock_stepped(struct port *p)
+{
+	p->nrate.origin1 = tmv_zero();
+	p->nrate.ingress1 = tmv_zero();
+	p->nrate.count = 0;
+	if (p->nrate.fit) {
+		theilsen_reset(p->nrate.fit);
+		p->nrate.ratio_valid = 0;
+	}
 }
 
 static int port_set_announce_tmo(struct port *p)
 {
-	return set_tmo_random(p->fda.fd[FD_ANNOUNCE_TIMER],
-			      p->announceReceiptTimeout,
+	return set_tmo_random(p, FD_ANNOUNCE_TIMER, p->announceReceiptTimeout,
 			      p->announce_span, p->logAnnounceInterval);
 }
 
 static int port_set_delay_tmo(struct port *p)
 {
 	if (p->delayMechanism == DM_P2P) {
-		return set_tmo_log(p->fda.fd[FD_DELAY_TIMER], 1,
+		return set_tmo_log(p, FD_DELAY_TIMER, 1,
 			       p->logMinPdelayReqInterval);
 	} else {
-		return set_tmo_random(p->fda.fd[FD_DELAY_TIMER], 0, 2,
+		return set_tmo_random(p, FD_DELAY_TIMER, 0, 2,
 				p->logMinDelayReqInterval);
 	}
 }
 
 static int port_set_manno_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, p->logAnnounceInterval);
+	return set_tmo_log(p, FD_MANNO_TIMER, 1, p->logAnnounceInterval);
 }
 
 static int port_set_qualification_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_QUALIFICATION_TIMER],
+	return set_tmo_log(p, FD_QUALIFICATION_TIMER,
 		       1+clock_steps_removed(p->clock), p->logAnnounceInterval);
 }
 
 static int port_set_sync_rx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_RX_TIMER],
+	return set_tmo_log(p, FD_SYNC_RX_TIMER,
 			   p->syncReceiptTimeout, p->logSyncInterval);
 }
 
 static int port_set_sync_tx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_TX_TIMER], 1, p->logSyncInterval);
+	return set_tmo_log(p, FD_SYNC_TX_TIMER, 1, p->logSyncInterval);
 }
 
 static void port_show_transition(struct port *p,
@@ -1040,6 +1284,7 @@ static void port_synchronize(struct port *p,
 			     struct timestamp origin_ts,
 			     Integer64 correction1, Integer64 correction2)
 {
+	struct capture *cap = clock_capture(p->clock);
 	enum servo_state state;
 	tmv_t t1, t1c, t2, c1, c2;
 
@@ -1051,10 +1296,30 @@ static void port_synchronize(struct port *p,
 	c2 = correction_to_tmv(correction2);
 	t1c = tmv_add(t1, tmv_add(c1, c2));
 
+	if (cap) {
+		struct capture_record r = {
+			.type = CAPTURE_SYNC,
+			.port = portnum(p),
+			.t1 = t1,
+			.t2 = t2,
+			.correction = correction1 + correction2,
+			.asymmetry = p->asymmetry,
+		};
+		capture_add(cap, &r);
+	}
+
     // update for local port path delay calculation
     tsproc_down_ts(p->tsproc, t1c, t2);
     if(p->state == PS_PASSIVE) {
-        // don't synchronize clock to PASSIVE ports
+        // don't synchronize clock to PASSIVE ports, only keep an estimate
+        // of the offset for a handover
+        if (p->standby && p->active->used) {
+            tmv_t offset;
+            double weight;
+
+            if (!tsproc_update_offset(p->tsproc, &offset, &weight))
+                standby_set_offset(p->active, offset, p->log_sync_interval);
+        }
         return;
     }
     
@@ -1070,6 +1335,10 @@ static void port_synchronize(struct port *p,
 			msg_put(p->delay_req);
 			p->delay_req = NULL;
 		}
+		if (p->delay_resp) {
+			msg_put(p->delay_resp);
+			p->delay_resp = NULL;
+		}
 		if (p->peer_delay_req) {
 			msg_put(p->peer_delay_req);
 			p->peer_delay_req = NULL;
@@ -1166,6 +1435,200 @@ static void port_syfufsm(struct port *p, enum syfu_event event,
 	}
 }
 
+/*
+ * Deferred transmit time stamps. Instead of polling the error queue
+ * right after each event message, the message is kept in the port's
+ * tx_pending table and completed from port_tx_event() once the event
+ * socket signals the time stamp.
+ */
+static void tx_pending_clear(struct tx_pending *txp)
+{
+	msg_put(txp->msg);
+	if (txp->fup) {
+		msg_put(txp->fup);
+	}
+	memset(txp, 0, sizeof(*txp));
+}
+
+static int tx_pending_match(struct tx_pending *txp, unsigned char *buf,
+			    int cnt)
+{
+	struct ptp_header *hdr = &txp->msg->header;
+	int off = cnt - ntohs(hdr->messageLength);
+
+	/*
+	 * The looped back frame still carries the lower layer headers,
+	 * and perhaps some padding, so search backwards for our header.
+	 */
+	for (; off >= 0; off--) {
+		if (!memcmp(buf + off, hdr, sizeof(*hdr)))
+			return 1;
+	}
+	return 0;
+}
+
+static void flush_tx_batch(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < p->tx_batch_len; i++)
+		msg_put(p->tx_batch[i]);
+	p->tx_batch_len = 0;
+}
+
+static void flush_tx_pending(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < N_TX_PENDING; i++) {
+		if (p->tx_pending[i].msg)
+			tx_pending_clear(&p->tx_pending[i]);
+	}
+}
+
+static int port_tx_complete(struct port *p, struct tx_pending *txp,
+			    struct hw_timestamp *hwts)
+{
+	struct ptp_message *msg = txp->msg, *fup = txp->fup, *rsp;
+	int err = 0;
+
+	msg->hwts.ts = hwts->ts;
+	ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
+
+	switch (msg_type(msg)) {
+	case SYNC:
+		ts_to_timestamp(&msg->hwts.ts,
+				&fup->follow_up.preciseOriginTimestamp);
+		err = port_prepare_and_send(p, fup, 0);
+		if (err)
+			pr_err("port %hu: send follow up failed", portnum(p));
+		break;
+	case PDELAY_RESP:
+		ts_to_timestamp(&msg->hwts.ts,
+				&fup->pdelay_resp_fup.responseOriginTimestamp);
+		err = peer_prepare_and_send(p, fup, 0);
+		if (err)
+			pr_err("port %hu: send pdelay_resp_fup failed",
+			       portnum(p));
+		break;
+	case DELAY_REQ:
+		/* The response may have overtaken our time stamp. */
+		if (msg == p->delay_req && p->delay_resp) {
+			rsp = p->delay_resp;
+			p->delay_resp = NULL;
+			process_delay_resp(p, rsp);
+			msg_put(rsp);
+		}
+		break;
+	case PDELAY_REQ:
+		/* The response may have overtaken our time stamp. */
+		if (msg == p->peer_delay_req)
+			port_peer_delay(p);
+		break;
+	}
+	tx_pending_clear(txp);
+	return err;
+}
+
+static int port_tx_collect(struct port *p)
+{
+	unsigned char buf[1600];
+	struct hw_timestamp hwts;
+	int cnt, err = 0, i;
+
+	while (1) {
+		hwts.type = p->timestamping;
+		cnt = transport_txts(p->trp, &p->fda, buf, sizeof(buf), &hwts);
+		if (cnt <= 0)
+			break;
+		if (!hwts.ts.tv_sec && !hwts.ts.tv_nsec)
+			continue;
+		for (i = 0; i < N_TX_PENDING; i++) {
+			if (p->tx_pending[i].msg &&
+			    tx_pending_match(&p->tx_pending[i], buf, cnt)) {
+				if (port_tx_complete(p, &p->tx_pending[i], &hwts))
+					err = -1;
+				break;
+			}
+		}
+	}
+	return err;
+}
+
+/*
+ * Drops the requests which have waited longer than tx_timestamp_timeout.
+ * Returns the number of dropped requests.
+ */
+static int port_tx_expire(struct port *p)
+{
+	struct tx_pending *txp;
+	struct timespec now;
+	int64_t age;
+	int cnt = 0, i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < N_TX_PENDING; i++) {
+		txp = &p->tx_pending[i];
+		if (!txp->msg)
+			continue;
+		age = (now.tv_sec - txp->sent.tv_sec) * NSEC2SEC +
+			now.tv_nsec - txp->sent.tv_nsec;
+		if (age < sk_tx_timeout * 1000000LL)
+			continue;
+		pr_err("port %hu: timed out while waiting for %s tx timestamp",
+		       portnum(p), msg_type_string(msg_type(txp->msg)));
+		pr_err("increasing tx_timestamp_timeout may correct "
+		       "this issue, but it is likely caused by a driver bug");
+		tx_pending_clear(txp);
+		cnt++;
+	}
+	return cnt;
+}
+
+/*
+ * Sends an event message without waiting for its time stamp. The
+ * optional follow up is sent as soon as the time stamp arrives.
+ */
+static int port_tx_deferred(struct port *p, struct ptp_message *msg,
+			    struct ptp_message *fup, int peer)
+{
+	struct tx_pending *txp = NULL;
+	int err, i;
+
+	port_tx_collect(p);
+	if (port_tx_expire(p))
+		return -1;
+
+	for (i = 0; i < N_TX_PENDING; i++) {
+		if (!p->tx_pending[i].msg) {
+			txp = &p->tx_pending[i];
+			break;
+		}
+	}
+	if (!txp) {
+		pr_err("port %hu: too many pending tx timestamps", portnum(p));
+		return -1;
+	}
+
+	if (peer) {
+		err = peer_prepare_and_send(p, msg, TRANS_DEFER_EVENT);
+	} else {
+		err = port_prepare_and_send(p, msg, TRANS_DEFER_EVENT);
+	}
+	if (err)
+		return err;
+
+	msg_get(msg);
+	txp->msg = msg;
+	if (fup) {
+		msg_get(fup);
+		txp->fup = fup;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &txp->sent);
+	return 0;
+}
+
 static int port_pdelay_request(struct port *p)
 {
 	struct ptp_message *msg;
@@ -1198,12 +1661,16 @@ static int port_pdelay_request(struct port *p)
 	msg->header.logMessageInterval = port_is_ieee8021as(p) ?
 		p->logMinPdelayReqInterval : 0x7f;
 
-	err = peer_prepare_and_send(p, msg, 1);
+	if (sk_tx_async) {
+		err = port_tx_deferred(p, msg, NULL, 1);
+	} else {
+		err = peer_prepare_and_send(p, msg, 1);
+	}
 	if (err) {
 		pr_err("port %hu: send peer delay request failed", portnum(p));
 		goto out;
 	}
-	if (msg_sots_missing(msg)) {
+	if (!sk_tx_async && msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted peer delay request");
 		goto out;
 	}
@@ -1224,6 +1691,7 @@ out:
 static int port_delay_request(struct port *p)
 {
 	struct ptp_message *msg;
+	int err;
 
     if(!p->received_announce) {
         return 0;
@@ -1264,17 +1732,26 @@ static int port_delay_request(struct port *p)
 		msg->header.flagField[0] |= UNICAST;
 	}
 
-	if (port_prepare_and_send(p, msg, 1)) {
+	if (sk_tx_async) {
+		err = port_tx_deferred(p, msg, NULL, 0);
+	} else {
+		err = port_prepare_and_send(p, msg, 1);
+	}
+	if (err) {
 		pr_err("port %hu: send delay request failed", portnum(p));
 		goto out;
 	}
-	if (msg_sots_missing(msg)) {
+	if (!sk_tx_async && msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted delay request");
 		goto out;
 	}
 
 	if (p->delay_req)
 		msg_put(p->delay_req);
+	if (p->delay_resp) {
+		msg_put(p->delay_resp);
+		p->delay_resp = NULL;
+	}
 
 	p->delay_req = msg;
 	return 0;
@@ -1367,21 +1844,8 @@ static int port_tx_sync(struct port *p)
 	if (p->timestamping != TS_ONESTEP)
 		msg->header.flagField[0] |= TWO_STEP;
 
-	err = port_prepare_and_send(p, msg, event);
-	if (err) {
-		pr_err("port %hu: send sync failed", portnum(p));
-		goto out;
-	}
-	if (p->timestamping == TS_ONESTEP) {
-		goto out;
-	} else if (msg_sots_missing(msg)) {
-		pr_err("missing timestamp on transmitted sync");
-		err = -1;
-		goto out;
-	}
-
 	/*
-	 * Send the follow up message right away.
+	 * Prepare the follow up message, it only lacks the time stamp.
 	 */
 	pdulen = sizeof(struct follow_up_msg);
 	fup->hwts.type = p->timestamping;
@@ -1394,10 +1858,33 @@ static int port_tx_sync(struct port *p)
 	fup->header.messageLength      = pdulen;
 	fup->header.domainNumber       = clock_domain_number(p->clock);
 	fup->header.sourcePortIdentity = p->portIdentity;
-	fup->header.sequenceId         = p->seqnum.sync - 1;
+	fup->header.sequenceId         = msg->header.sequenceId;
 	fup->header.control            = CTL_FOLLOW_UP;
 	fup->header.logMessageInterval = p->logSyncInterval;
 
+	if (sk_tx_async && p->timestamping != TS_ONESTEP) {
+		err = port_tx_deferred(p, msg, fup, 0);
+		if (err)
+			pr_err("port %hu: send sync failed", portnum(p));
+		goto out;
+	}
+
+	err = port_prepare_and_send(p, msg, event);
+	if (err) {
+		pr_err("port %hu: send sync failed", portnum(p));
+		goto out;
+	}
+	if (p->timestamping == TS_ONESTEP) {
+		goto out;
+	} else if (msg_sots_missing(msg)) {
+		pr_err("missing timestamp on transmitted sync");
+		err = -1;
+		goto out;
+	}
+
+	/*
+	 * Send the follow up message right away.
+	 */
 	ts_to_timestamp(&msg->hwts.ts, &fup->follow_up.preciseOriginTimestamp);
 
 	err = port_prepare_and_send(p, fup, 0);
@@ -1445,6 +1932,10 @@ static void flush_delay_req(struct port *p)
 		msg_put(p->delay_req);
 		p->delay_req = NULL;
 	}
+	if (p->delay_resp) {
+		msg_put(p->delay_resp);
+		p->delay_resp = NULL;
+	}
 }
 
 static void flush_peer_delay(struct port *p)
@@ -1478,22 +1969,27 @@ static void port_disable(struct port *p)
 	flush_last_sync(p);
 	flush_delay_req(p);
 	flush_peer_delay(p);
+	flush_tx_pending(p);
+	flush_tx_batch(p);
 
 	p->best = NULL;
 	free_foreign_masters(p);
+	if (p->standby)
+		standby_reset(p->standby);
+	if (p->rxq)
+		rxq_detach(p->rxq);
 	transport_close(p->trp, &p->fda);
 
 	for (i = 0; i < N_TIMER_FDS; i++) {
-		close(p->fda.fd[FD_ANNOUNCE_TIMER + i]);
+		port_clr_tmo(p, FD_ANNOUNCE_TIMER + i);
 	}
 	port_clear_fda(p, N_POLLFD);
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 }
 
 static int port_initialize(struct port *p)
 {
 	struct config *cfg = clock_config(p->clock);
-	int fd[N_TIMER_FDS], i;
 
 	p->multiple_seq_pdr_count  = 0;
 	p->multiple_pdr_detected   = 0;
@@ -1510,22 +2006,10 @@ static int port_initialize(struct port *p)
 	p->neighborPropDelayThresh = config_get_int(cfg, p->name, "neighborPropDelayThresh");
 	p->min_neighbor_prop_delay = config_get_int(cfg, p->name, "min_neighbor_prop_delay");
 
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = -1;
-	}
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (fd[i] < 0) {
-			pr_err("timerfd_create: %s", strerror(errno));
-			goto no_timers;
-		}
-	}
 	if (transport_open(p->trp, p->name, &p->fda, p->timestamping))
-		goto no_tropen;
-
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		p->fda.fd[FD_ANNOUNCE_TIMER + i] = fd[i];
-	}
+		return -1;
+	if (p->rxq && rxq_attach(p->rxq, &p->fda))
+		goto no_rxq;
 
     p->received_announce = 0;
     memset(&p->announce_sourcePortIdentity, 0, sizeof(struct PortIdentity));
@@ -1537,17 +2021,15 @@ static int port_initialize(struct port *p)
 
 	port_nrate_initialize(p);
 
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return 0;
 
 no_tmo:
+	if (p->rxq)
+		rxq_detach(p->rxq);
+no_rxq:
 	transport_close(p->trp, &p->fda);
-no_tropen:
-no_timers:
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		if (fd[i] >= 0)
-			close(fd[i]);
-	}
+	port_clear_fda(p, N_POLLFD);
 	return -1;
 }
 
@@ -1559,12 +2041,14 @@ static int port_renew_transport(struct port *p)
 	if (!port_is_enabled(p)) {
 		return 0;
 	}
+	flush_tx_pending(p);
+	flush_tx_batch(p);
 	transport_close(p->trp, &p->fda);
 	port_clear_fda(p, FD_ANNOUNCE_TIMER);
 	res = transport_open(p->trp, p->name, &p->fda, p->timestamping);
 	// Need to call clock_fda_changed even if transport_open failed in
         // order to update clock to the now closed descriptors.
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return res;
 }
 */
@@ -1609,6 +2093,7 @@ static int update_current_master(struct port *p, struct ptp_message *m)
 	msg_get(m);
 	fc->n_messages++;
 	TAILQ_INSERT_HEAD(&fc->messages, m, list);
+	fm_update(p, fc);
 	if (fc->n_messages > 1) {
 		tmp = TAILQ_NEXT(m, list);
 		return announce_compare(m, tmp);
@@ -1656,6 +2141,24 @@ static int process_announce(struct port *p, struct ptp_message *m)
 	return result;
 }
 
+/*
+ * Queues a general message for port_tx_flush(), which sends all of the
+ * queued messages with a single system call.
+ */
+static int port_tx_queue(struct port *p, struct ptp_message *msg)
+{
+	if (msg_pre_send(msg))
+		return -1;
+
+	msg_get(msg);
+	p->tx_batch[p->tx_batch_len++] = msg;
+
+	if (p->tx_batch_len == TRANSPORT_SEND_BATCH)
+		return port_tx_flush(p) == EV_NONE ? 0 : -1;
+
+	return 0;
+}
+
 static int process_delay_req(struct port *p, struct ptp_message *m)
 {
 	struct ptp_message *msg;
@@ -1695,9 +2198,7 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		msg->header.logMessageInterval = 0x7f;
 	}
 
-	err = port_prepare_and_send(p, msg, 0);
-	if (err)
-		pr_err("port %hu: send delay response failed", portnum(p));
+	err = port_tx_queue(p, msg);
 	msg_put(msg);
 	return err;
 }
@@ -1706,8 +2207,10 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
 {
 	struct delay_req_msg *req;
 	struct delay_resp_msg *rsp = &m->delay_resp;
+	struct capture *cap = clock_capture(p->clock);
 	struct PortIdentity master;
 	tmv_t c3, t3, t4, t4c;
+	int err;
     
 	if (!p->delay_req)
 		return;
@@ -1728,8 +2231,19 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
         return;
     if (rsp->hdr.sequenceId != ntohs(req->hdr.sequenceId))
         return;
-    if (!pid_eq(&master, &m->header.sourcePortIdentity))
+    if (!msg_sots_valid(p->delay_req)) {
+        // process it once the deferred time stamp arrives
+        if (sk_tx_async && !p->delay_resp) {
+            msg_get(m);
+            p->delay_resp = m;
+        }
         return;
+    }
+    if (!pid_eq(&master, &m->header.sourcePortIdentity)) {
+        if (p->standby)
+            port_standby_delay(p, m);
+        return;
+    }
 
     c3 = correction_to_tmv(m->header.correction);
     t3 = timespec_to_tmv(p->delay_req->hwts.ts);
@@ -1738,11 +2252,27 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
 
     // local port path delay calculation for PS_UNCALIBRATED, PS_SLAVE and PS_PASSIVE ports
     tsproc_up_ts(p->tsproc, t3, t4c);
-    if(tsproc_update_delay(p->tsproc, &p->path_delay)) {
+    err = tsproc_update_delay(p->tsproc, &p->path_delay);
+
+    if (cap) {
+        struct capture_record r = {
+            .type = CAPTURE_DELAY,
+            .port = portnum(p),
+            .t3 = t3,
+            .t4 = t4,
+            .correction = m->header.correction,
+            .asymmetry = p->asymmetry,
+            .offset = tmv_to_nanoseconds(p->path_delay),
+        };
+        capture_add(cap, &r);
+    }
+
+    if (err) {
         //something went wrong
         return;
     }
     stats_add_value(p->delay, tmv_to_nanoseconds(p->path_delay));
+    rv_set_port_dirty(p, RV_PTP_DIRTY_PATH_DELAY);
 
     // update global clock path delay for PS_UNCALIBRATED and PS_SLAVE ports only
     if(p->state != PS_PASSIVE) {
@@ -1770,6 +2300,12 @@ static void process_delay_resp(struct port *p, struct ptp_message *m)
 void port_log_path_delay(struct port *p) {
     struct stats_result delay_stats;
     
+    if (p->delay_resp_flushes) {
+        pr_info("port %hu: %lu delay responses in %lu flushes, %.1f per flush",
+                portnum(p), p->delay_resp_sent, p->delay_resp_flushes,
+                (double) p->delay_resp_sent / p->delay_resp_flushes);
+    }
+
     if(!p->received_announce) {
         return;
     }
@@ -1805,6 +2341,8 @@ static void process_follow_up(struct port *p, struct ptp_message *m)
             return;
         }
         if(!pid_eq(&p->announce_sourcePortIdentity, &m->header.sourcePortIdentity)) {
+            if (p->standby)
+                port_standby_sync(p, m);
             return;
         }
         break;
@@ -1813,6 +2351,8 @@ static void process_follow_up(struct port *p, struct ptp_message *m)
         {
             struct PortIdentity master = clock_parent_identity(p->clock);
             if(!pid_eq(&master, &m->header.sourcePortIdentity)) {
+                if (p->standby)
+                    port_standby_sync(p, m);
                 return;
             }
         }
@@ -1917,6 +2457,14 @@ static int process_pdelay_req(struct port *p, struct ptp_message *m)
 
 	fup->pdelay_resp_fup.requestingPortIdentity = m->header.sourcePortIdentity;
 
+	if (sk_tx_async) {
+		err = port_tx_deferred(p, rsp, fup, 1);
+		if (err)
+			pr_err("port %hu: send peer delay response failed",
+			       portnum(p));
+		goto out;
+	}
+
 	err = peer_prepare_and_send(p, rsp, 1);
 	if (err) {
 		pr_err("port %hu: send peer delay response failed", portnum(p));
@@ -1943,9 +2491,11 @@ out:
 static void port_peer_delay(struct port *p)
 {
 	tmv_t c1, c2, t1, t2, t3, t3c, t4;
+	int err;
 	struct ptp_message *req = p->peer_delay_req;
 	struct ptp_message *rsp = p->peer_delay_resp;
 	struct ptp_message *fup = p->peer_delay_fup;
+	struct capture *cap = clock_capture(p->clock);
 
 	/* Check for response, validate port and sequence number. */
 
@@ -1958,6 +2508,10 @@ static void port_peer_delay(struct port *p)
 	if (rsp->header.sequenceId != ntohs(req->header.sequenceId))
 		return;
 
+	/* Our own transmit time stamp may still be pending. */
+	if (!msg_sots_valid(req))
+		return;
+
 	t1 = timespec_to_tmv(req->hwts.ts);
 	t4 = timespec_to_tmv(rsp->hwts.ts);
 	c1 = correction_to_tmv(rsp->header.correction + p->asymmetry);
@@ -1994,7 +2548,28 @@ calc:
 				    clock_rate_ratio(p->clock));
 	tsproc_up_ts(p->tsproc, t1, t2);
 	tsproc_down_ts(p->tsproc, t3c, t4);
-	if (tsproc_update_delay(p->tsproc, &p->peer_delay))
+	err = tsproc_update_delay(p->tsproc, &p->peer_delay);
+	if (p->standby)
+		port_standby_peer_delay(p, t1, t2, t3c, t4);
+
+	if (cap) {
+		struct capture_record r = {
+			.type = CAPTURE_PDELAY,
+			.port = portnum(p),
+			.t1 = t1,
+			.t2 = t2,
+			.t3 = t3,
+			.t4 = t4,
+			.correction = rsp->header.correction +
+				      (fup && !one_step(rsp) ?
+				       fup->header.correction : 0),
+			.asymmetry = p->asymmetry,
+			.offset = tmv_to_nanoseconds(p->peer_delay),
+		};
+		capture_add(cap, &r);
+	}
+
+	if (err)
 		return;
 
 	p->peerMeanPathDelay = tmv_to_TimeInterval(p->peer_delay);
@@ -2093,14 +2668,19 @@ static void process_sync(struct port *p, struct ptp_message *m)
             return;
         }
         if(!pid_eq(&p->announce_sourcePortIdentity, &m->header.sourcePortIdentity)) {
+            if (p->standby)
+                port_standby_sync(p, m);
             return;
         }
+        p->log_sync_interval = m->header.logMessageInterval;
         break;
 	case PS_UNCALIBRATED:
 	case PS_SLAVE:
         {
             struct PortIdentity master = clock_parent_identity(p->clock);
             if(!pid_eq(&master, &m->header.sourcePortIdentity)) {
+                if (p->standby)
+                    port_standby_sync(p, m);
                 return;
             }
 
@@ -2128,72 +2708,169 @@ static void process_sync(struct port *p, struct ptp_message *m)
 	port_syfufsm(p, event, m);
 }
 
+static struct tsproc *tsproc_from_config(struct config *cfg, const char *name)
+{
+	return tsproc_create(config_get_int(cfg, name, "tsproc_mode"),
+			     config_get_int(cfg, name, "delay_filter"),
+			     config_get_int(cfg, name, "delay_filter_length"),
+			     config_get_double(cfg, name, "step_threshold"),
+			     config_get_int(cfg, name, "outlier_filter_length"),
+			     config_get_double(cfg, name, "outlier_filter_percentile"),
+			     config_get_int(cfg, name, "outlier_filter_hysteresis"));
+}
+
+/*
+ * Create the time stamp processor of the port, or one per entry of the
+ * standby table, with p->tsproc set to the first one.
+ */
+static int port_tsproc_create(struct port *p, struct config *cfg)
+{
+	struct standby_master *m;
+	int i, n = config_get_int(cfg, p->name, "standby_masters");
+
+	if (!n) {
+		p->tsproc = tsproc_from_config(cfg, p->name);
+		return p->tsproc ? 0 : -1;
+	}
+
+	p->standby = standby_create(n + 1);
+	if (!p->standby)
+		return -1;
+	for (i = 0; i <= n; i++) {
+		m = standby_get(p->standby, i);
+		m->tsproc = tsproc_from_config(cfg, p->name);
+		if (!m->tsproc) {
+			standby_destroy(p->standby);
+			p->standby = NULL;
+			return -1;
+		}
+	}
+	p->active = standby_get(p->standby, 0);
+	p->tsproc = p->active->tsproc;
+	return 0;
+}
+
+static void port_tsproc_destroy(struct port *p)
+{
+	if (p->standby)
+		standby_destroy(p->standby);
+	else
+		tsproc_destroy(p->tsproc);
+}
+
 /* public methods */
 
 void port_close(struct port *p)
 {
+	int i;
+
 	if (port_is_enabled(p)) {
 		port_disable(p);
 	}
 
 	stats_destroy(p->delay);
 
+	for (i = 0; i < TRANSPORT_RECV_BATCH; i++) {
+		if (p->rx_batch[i])
+			msg_put(p->rx_batch[i]);
+	}
+	if (p->rxq)
+		rxq_destroy(p->rxq);
 	transport_destroy(p->trp);
-	tsproc_destroy(p->tsproc);
-	if (p->fault_fd >= 0)
-		close(p->fault_fd);
+	port_tsproc_destroy(p);
+	if (p->nrate.fit)
+		theilsen_destroy(p->nrate.fit);
+	port_clr_tmo(p, N_POLLFD);
+	foreign_index_destroy(&p->foreign_masters);
 	free(p);
 }
 
+/*
+ * The qualified foreign masters are kept in order as their announce
+ * messages arrive, so only the top of the index needs checking here.
+ * Records which went stale below the top can not change the result,
+ * they drop out once they reach the top or their bucket is swept.
+ */
 struct foreign_clock *port_compute_best(struct port *p)
 {
-	struct foreign_clock *fc;
+	struct foreign_clock *fc, *old = p->best;
 	struct ptp_message *tmp;
 
-	p->best = NULL;
-
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		tmp = TAILQ_FIRST(&fc->messages);
-		if (!tmp)
-			continue;
+	LIST_FOREACH(fc, &p->foreign_masters.buckets[p->fm_sweep], list) {
+		fc_prune(fc);
+	}
+	p->fm_sweep = (p->fm_sweep + 1) & (FOREIGN_MASTER_BUCKETS - 1);
 
-		announce_to_dataset(tmp, p, &fc->dataset);
+	p->best = NULL;
 
+	while ((fc = foreign_index_best(&p->foreign_masters))) {
 		fc_prune(fc);
+		if (fc->index >= 0) {
+			p->best = fc;
+			break;
+		}
+	}
 
-		if (fc->n_messages < FOREIGN_MASTER_THRESHOLD)
-			continue;
+	if (!p->best) {
+		if (old)
+			p->erbest_changed = 1;
+		return NULL;
+	}
+	p->received_announce = 1;
 
-		if (!p->best) {
-			p->best = fc;
-            // save portIdentity of announcing device for passive port (where PTP-Master != PS_PASSIVE_MASTER)
-            memcpy(&p->announce_sourcePortIdentity, &tmp->header.sourcePortIdentity, sizeof(struct PortIdentity));             
-            memcpy(&p->master_ip, &tmp->address.sin.sin_addr, sizeof(struct in_addr));
-            memcpy(&p->grandmasterIdentity, &fc->dataset.identity, sizeof(struct ClockIdentity));
-            p->received_announce = 1;
-        } else if (dscmp(&fc->dataset, &p->best->dataset) > 0) {
-			p->best = fc;
+	/* Both data sets are zeroed before use, so memcmp() is fine. */
+	if (p->best != old ||
+	    memcmp(&p->best->dataset, &p->erbest, sizeof(p->erbest))) {
+		memcpy(&p->erbest, &p->best->dataset, sizeof(p->erbest));
+		p->erbest_changed = 1;
 
-            memcpy(&p->announce_sourcePortIdentity, &tmp->header.sourcePortIdentity, sizeof(struct PortIdentity));    
-            memcpy(&p->master_ip, &tmp->address.sin.sin_addr, sizeof(struct in_addr));
-            memcpy(&p->grandmasterIdentity, &fc->dataset.identity, sizeof(struct ClockIdentity));
-            p->received_announce = 1;
-        } else {
-			fc_clear(fc);
-        }
+		tmp = TAILQ_FIRST(&p->best->messages);
+		rv_set_port_dirty(p, RV_PTP_DIRTY_PORT_STATE);
+		if (p->standby)
+			port_standby_activate(p, &tmp->header.sourcePortIdentity);
+		// save portIdentity of announcing device for passive port (where PTP-Master != PS_PASSIVE_MASTER)
+		memcpy(&p->announce_sourcePortIdentity, &tmp->header.sourcePortIdentity, sizeof(struct PortIdentity));
+		memcpy(&p->master_ip, &tmp->address.sin.sin_addr, sizeof(struct in_addr));
+		memcpy(&p->grandmasterIdentity, &p->best->dataset.identity, sizeof(struct ClockIdentity));
 	}
 
 	return p->best;
 }
 
+int port_standby_offset(struct port *p, tmv_t *offset)
+{
+	if (!p->standby)
+		return -1;
+	return standby_offset(p->active, offset);
+}
+
+int port_decision_due(struct port *p)
+{
+	return p->erbest_changed || p->state != p->last_rs_state;
+}
+
+int port_dispatch_decision(struct port *p, enum fsm_event event, int mdiff)
+{
+	int err = 0;
+
+	p->erbest_changed = 0;
+
+	if (mdiff || event != p->last_rs || p->state != p->last_rs_state)
+		err = port_dispatch(p, event, mdiff);
+
+	p->last_rs = event;
+	p->last_rs_state = p->state;
+	return err;
+}
+
 static void port_e2e_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_DELAY_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(p, FD_ANNOUNCE_TIMER);
+	port_clr_tmo(p, FD_SYNC_RX_TIMER);
+	port_clr_tmo(p, FD_DELAY_TIMER);
+	port_clr_tmo(p, FD_QUALIFICATION_TIMER);
+	port_clr_tmo(p, FD_MANNO_TIMER);
+	port_clr_tmo(p, FD_SYNC_TX_TIMER);
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2214,7 +2891,7 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
         p->received_announce = 0;
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		set_tmo_log(p, FD_MANNO_TIMER, 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2238,12 +2915,12 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 
 static void port_p2p_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(p, FD_ANNOUNCE_TIMER);
+	port_clr_tmo(p, FD_SYNC_RX_TIMER);
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(p, FD_QUALIFICATION_TIMER);
+	port_clr_tmo(p, FD_MANNO_TIMER);
+	port_clr_tmo(p, FD_SYNC_TX_TIMER);
 
 	switch (next) {
 	case PS_INITIALIZING:
@@ -2264,7 +2941,7 @@ static void port_p2p_transition(struct port *p, enum port_state next)
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
         p->received_announce = 0;
-		set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+		set_tmo_log(p, FD_MANNO_TIMER, 1, -10); /*~1ms*/
 		port_set_sync_tx_tmo(p);
 		break;
 	case PS_PASSIVE:
@@ -2311,6 +2988,7 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff)
 		next = port_initialize(p) ? PS_FAULTY : PS_LISTENING;
 		port_show_transition(p, next, event);
 		p->state = next;
+		rv_set_port_dirty(p, RV_PTP_DIRTY_PORT_STATE);
 		if (next == PS_LISTENING && p->delayMechanism == DM_P2P) {
 			port_set_delay_tmo(p);
 		}
@@ -2334,6 +3012,7 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff)
     }
 	
 	p->state = next;
+	rv_set_port_dirty(p, RV_PTP_DIRTY_PORT_STATE);
 	port_notify_event(p, NOTIFY_PORT_STATE);
 
 	if((next == PS_UNCALIBRATED) || (next == PS_SLAVE)) {
@@ -2351,11 +3030,50 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	return 0;
 }
 
+/*
+ * Merges the event of one message of a batch into the event of the
+ * batch. A fault or a state decision is never replaced by a later event.
+ */
+static enum fsm_event port_merge_event(enum fsm_event event,
+				       enum fsm_event ev)
+{
+	switch (event) {
+	case EV_FAULT_DETECTED:
+		return event;
+	case EV_STATE_DECISION_EVENT:
+		return ev == EV_FAULT_DETECTED ? ev : event;
+	default:
+		return ev != EV_NONE ? ev : event;
+	}
+}
+
+/* Handles the messages which the receive thread passed on. */
+static enum fsm_event port_rx_queue(struct port *p)
+{
+	struct ptp_message *msg[TRANSPORT_RECV_BATCH];
+	int cnt[TRANSPORT_RECV_BATCH], err[TRANSPORT_RECV_BATCH], i, n;
+	enum fsm_event ev, event = EV_NONE;
+
+	n = rxq_recv(p->rxq, msg, cnt, err, TRANSPORT_RECV_BATCH);
+	for (i = 0; i < n; i++) {
+		if (event == EV_FAULT_DETECTED) {
+			msg_put(msg[i]);
+			continue;
+		}
+		if (cnt[i] <= 0)
+			ev = port_rx_message(p, msg[i], cnt[i]);
+		else
+			ev = port_rx_parsed(p, msg[i], err[i]);
+		event = port_merge_event(event, ev);
+	}
+	return event;
+}
+
 enum fsm_event port_event(struct port *p, int fd_index)
 {
-	enum fsm_event event = EV_NONE;
+	enum fsm_event ev, event = EV_NONE;
 	struct ptp_message *msg;
-	int cnt, fd = p->fda.fd[fd_index], err;
+	int cnt, fd = p->fda.fd[fd_index], i, n;
 
     switch (fd_index) {
 	case FD_ANNOUNCE_TIMER:
@@ -2374,6 +3092,7 @@ enum fsm_event port_event(struct port *p, int fd_index)
         memset(&p->announce_sourcePortIdentity, 0, sizeof(struct PortIdentity));
         memset(&p->grandmasterIdentity, 0, sizeof(struct ClockIdentity));
         memset(&p->master_ip, 0, sizeof(struct in_addr));
+        rv_set_port_dirty(p, RV_PTP_DIRTY_PORT_STATE);
 		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
 
 	case FD_DELAY_TIMER:
@@ -2396,19 +3115,63 @@ enum fsm_event port_event(struct port *p, int fd_index)
 		return port_tx_sync(p) ? EV_FAULT_DETECTED : EV_NONE;
 	}
 
-	msg = msg_allocate();
-	if (!msg)
+	if (p->rxq)
+		return port_rx_queue(p);
+
+	/*
+	 * Drain the socket into the port's receive batch. Messages which
+	 * were not filled stay in the batch for the next time around.
+	 * Transports without batch support take one message at a time.
+	 */
+	n = transport_can_recv_batch(p->trp) ? TRANSPORT_RECV_BATCH : 1;
+	for (i = 0; i < n; i++) {
+		if (p->rx_batch[i])
+			continue;
+		p->rx_batch[i] = msg_allocate();
+		if (!p->rx_batch[i])
+			return EV_FAULT_DETECTED;
+		p->rx_batch[i]->hwts.type = p->timestamping;
+	}
+
+	cnt = transport_recv_batch(p->trp, fd, p->rx_batch, p->rx_len, n);
+	if (cnt < 0) {
+		pr_err("port %hu: recv message failed", portnum(p));
 		return EV_FAULT_DETECTED;
+	}
 
-	msg->hwts.type = p->timestamping;
+	for (i = 0; i < cnt; i++) {
+		msg = p->rx_batch[i];
+		p->rx_batch[i] = NULL;
+		if (event == EV_FAULT_DETECTED) {
+			msg_put(msg);
+			continue;
+		}
+		ev = port_rx_message(p, msg, p->rx_len[i]);
+		event = port_merge_event(event, ev);
+	}
+	return event;
+}
 
-	cnt = transport_recv(p->trp, fd, msg);
+static enum fsm_event port_rx_message(struct port *p, struct ptp_message *msg,
+				      int cnt)
+{
 	if (cnt <= 0) {
 		pr_err("port %hu: recv message failed", portnum(p));
 		msg_put(msg);
 		return EV_FAULT_DETECTED;
 	}
-	err = msg_post_recv(msg, cnt);
+	return port_rx_parsed(p, msg, msg_post_recv(msg, cnt));
+}
+
+/*
+ * Handles a received message, given the result of msg_post_recv(),
+ * which the receive thread already called for ports which have one.
+ */
+static enum fsm_event port_rx_parsed(struct port *p, struct ptp_message *msg,
+				     int err)
+{
+	enum fsm_event event = EV_NONE;
+
 	if (err) {
 		switch (err) {
 		case -EBADMSG:
@@ -2476,6 +3239,38 @@ enum fsm_event port_event(struct port *p, int fd_index)
 	return event;
 }
 
+enum fsm_event port_tx_flush(struct port *p)
+{
+	int cnt, n = p->tx_batch_len;
+
+	if (!n)
+		return EV_NONE;
+
+	cnt = transport_send_batch(p->trp, &p->fda, p->tx_batch, n);
+	flush_tx_batch(p);
+
+	if (cnt > 0) {
+		p->delay_resp_sent += cnt;
+		p->delay_resp_flushes++;
+	}
+	if (cnt < n) {
+		pr_err("port %hu: send delay response failed", portnum(p));
+		return EV_FAULT_DETECTED;
+	}
+	return EV_NONE;
+}
+
+enum fsm_event port_tx_event(struct port *p)
+{
+	int err;
+
+	err = port_tx_collect(p);
+	if (port_tx_expire(p))
+		err = -1;
+
+	return err ? EV_FAULT_DETECTED : EV_NONE;
+}
+
 int port_forward(struct port *p, struct ptp_message *msg)
 {
 	int cnt;
@@ -2701,6 +3496,35 @@ err:
 	msg_put(msg);
 }
 
+static int port_rxq_length(struct config *cfg)
+{
+	return rxq_length(config_get_int(cfg, NULL, "msg_pool_size"),
+			  cfg->n_interfaces);
+}
+
+int port_msg_reserve(struct config *cfg, const char *name)
+{
+	int rx = 1, standby = config_get_int(cfg, name, "standby_masters");
+
+	switch (config_get_int(cfg, name, "network_transport")) {
+	case TRANS_UDP_IPV4:
+	case TRANS_UDP_IPV6:
+		rx = config_get_int(cfg, NULL, "rx_threads") ?
+			rxq_reserve(port_rxq_length(cfg)) :
+			TRANSPORT_RECV_BATCH;
+		break;
+	default:
+		break;
+	}
+	/*
+	 * Room for the messages of the best master, the standby masters
+	 * and another one, plus the requests, responses and time stamps
+	 * which a port holds on to.
+	 */
+	return rx + standby + (FOREIGN_MASTER_THRESHOLD + 1) * (standby + 2) +
+		N_TX_PENDING + PORT_MSG_HELD;
+}
+
 struct port *port_open(int phc_index,
 		       enum timestamp_type timestamping,
 		       int number,
@@ -2710,7 +3534,8 @@ struct port *port_open(int phc_index,
 	struct config *cfg = clock_config(clock);
 	struct port *p = malloc(sizeof(*p));
 	enum transport_type transport;
-	int i;
+	struct rxthread *rxt;
+	int i, n;
 
 	if (!p)
 		return NULL;
@@ -2760,6 +3585,7 @@ struct port *port_open(int phc_index,
 	p->versionNumber = PTP_VERSION;
 
     p->delay = stats_create();
+    p->rv_dirty = RV_PTP_DIRTY_ALL;
 
 	if (p->hybrid_e2e && p->delayMechanism != DM_E2E) {
 		pr_warning("port %d: hybrid_e2e only works with E2E", number);
@@ -2777,29 +3603,42 @@ struct port *port_open(int phc_index,
 	p->flt_interval_pertype[FT_UNSPECIFIED].val =
 		config_get_int(cfg, p->name, "fault_reset_interval");
 
-	p->tsproc = tsproc_create(config_get_int(cfg, p->name, "tsproc_mode"),
-				  config_get_int(cfg, p->name, "delay_filter"),
-				  config_get_int(cfg, p->name, "delay_filter_length"),
-				  config_get_double(cfg, p->name, "step_threshold"));
-	if (!p->tsproc) {
+	if (port_tsproc_create(p, cfg)) {
 		pr_err("Failed to create time stamp processor");
 		goto err_transport;
 	}
+	n = config_get_int(cfg, p->name, "nrate_window");
+	if (n) {
+		p->nrate.fit = theilsen_create(n + 1);
+		if (!p->nrate.fit)
+			goto err_tsproc;
+	}
 	p->nrate.ratio = 1.0;
 
 	port_clear_fda(p, N_POLLFD);
-	p->fault_fd = -1;
-	if (number) {
-		p->fault_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (p->fault_fd < 0) {
-			pr_err("timerfd_create failed: %m");
-			goto err_tsproc;
-		}
+	for (i = 0; i < N_TIMER_FDS; i++) {
+		tmr_init(&p->tmr[i], FD_ANNOUNCE_TIMER + i);
+	}
+	tmr_init(&p->fault_tmr, N_POLLFD);
+
+	/* Only transports which receive without blocking suit a thread. */
+	rxt = number ? clock_rx_thread(clock, number) : NULL;
+	if (rxt && !transport_can_recv_batch(p->trp)) {
+		pr_warning("port %d: transport can not use a receive thread",
+			   number);
+	} else if (rxt) {
+		p->rxq = rxq_create(rxt, p->trp, timestamping,
+				    port_rxq_length(cfg));
+		if (!p->rxq)
+			goto err_nrate;
 	}
 	return p;
 
+err_nrate:
+	if (p->nrate.fit)
+		theilsen_destroy(p->nrate.fit);
 err_tsproc:
-	tsproc_destroy(p->tsproc);
+	port_tsproc_destroy(p);
 err_transport:
 	transport_destroy(p->trp);
 err_port:
@@ -2818,7 +3657,32 @@ enum port_state port_state(struct port *port)
 #include "netinet/in.h"
 #include "arpa/inet.h"
 
-int rv_get_port_status(struct rv_ptpport_t *rv_ptpport, struct port *p) {
+extern void rv_set_clock_dirty(struct clock *c, unsigned int dirty);
+
+static void rv_set_port_dirty(struct port *p, unsigned int dirty) {
+    p->rv_dirty |= dirty;
+    rv_set_clock_dirty(p->clock, dirty);
+}
+
+// Rebuilds the exported port status if it is dirty, either on its own or
+// because the caller passes in 'dirty' bits of its own.
+int rv_get_port_status(struct rv_ptpport_t *rv_ptpport, struct port *p, unsigned int dirty) {
+
+    dirty |= p->rv_dirty;
+    p->rv_dirty = 0;
+
+    if(!dirty) {
+        return 0;
+    }
+
+    if(dirty == RV_PTP_DIRTY_PATH_DELAY) {
+        // a new measurement, the rest of the port status is unchanged
+        if((p->state == PS_PASSIVE && p->received_announce) ||
+           p->state == PS_UNCALIBRATED || p->state == PS_SLAVE) {
+            rv_ptpport->path_delay = p->path_delay;
+        }
+        return 0;
+    }
 
     memset(rv_ptpport, 0, sizeof(struct rv_ptpport_t));
     strncpy(rv_ptpport->ifc_name, p->name, RV_IFC_NAME_LEN - 1);
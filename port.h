@@ -24,6 +24,7 @@
 #include "foreign.h"
 #include "fsm.h"
 #include "notification.h"
+#include "tmv.h"
 #include "transport.h"
 
 /* forward declarations */
@@ -62,6 +63,39 @@ void port_close(struct port *port);
  */
 struct foreign_clock *port_compute_best(struct port *port);
 
+/**
+ * Find out whether the state decision for a port needs to be repeated,
+ * because its best foreign master or its state changed since the last
+ * call to @ref port_dispatch_decision().
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return One if a new decision is due, zero otherwise.
+ */
+int port_decision_due(struct port *port);
+
+/**
+ * Obtain the offset from the best foreign master of a port, as measured
+ * while the port was not synchronizing the clock to it. Only available
+ * if the port keeps standby masters.
+ *
+ * @param port   A pointer previously obtained via port_open().
+ * @param offset Returns the offset from the master.
+ * @return Zero if a recent estimate is available, non-zero otherwise.
+ */
+int port_standby_offset(struct port *port, tmv_t *offset);
+
+/**
+ * Dispatch the recommended state from a state decision. The event is
+ * skipped if the port already acted on the same recommendation and has
+ * not changed its state since, unless a new master has been selected.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @param event The recommended state event, see @ref port_dispatch().
+ * @param mdiff Whether a new master has been selected.
+ * @return The return value of @ref port_dispatch(), or zero if skipped.
+ */
+int port_dispatch_decision(struct port *port, enum fsm_event event, int mdiff);
+
 /**
  * Dispatch a port event. This may cause a state transition on the
  * port, with the associated side effect.
@@ -84,6 +118,25 @@ int port_dispatch(struct port *p, enum fsm_event event, int mdiff);
  */
 enum fsm_event port_event(struct port *port, int fd_index);
 
+/**
+ * Sends the general messages which the port queued while handling its
+ * events, using one system call. Call this once per poll iteration.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return One of the @a fsm_event codes.
+ */
+enum fsm_event port_tx_flush(struct port *port);
+
+/**
+ * Collects the transmit time stamps which are pending on the port's
+ * event socket and sends the follow up messages waiting for them.
+ * Call this when the event socket signals POLLERR.
+ *
+ * @param port A pointer previously obtained via port_open().
+ * @return One of the @a fsm_event codes.
+ */
+enum fsm_event port_tx_event(struct port *port);
+
 /**
  * Forward a message on a given port.
  * @param port    A pointer previously obtained via port_open().
@@ -199,6 +252,16 @@ struct ptp_message *port_management_notify(struct PortIdentity pid,
  */
 void port_notify_event(struct port *p, enum notification event);
 
+/**
+ * Estimate the number of messages which a port keeps for a long time,
+ * that is its receive batch or queue, the announce messages of its
+ * foreign masters and the Sync messages of its standby masters.
+ * @param cfg   The configuration.
+ * @param name  The name of the interface.
+ * @return      The number of messages.
+ */
+int port_msg_reserve(struct config *cfg, const char *name);
+
 /**
  * Open a network port.
  * @param phc_index     The PHC device index for the network device.
@@ -222,8 +285,8 @@ struct port *port_open(int phc_index,
 enum port_state port_state(struct port *port);
 
 /**
- * Return array of file descriptors for this port. The fault fd is not
- * included.
+ * Return array of file descriptors for this port. The timers live in
+ * the clock's timer queue, so their entries are always -1.
  * @param port	A port instance
  * @return	Array of file descriptors. Unused descriptors are guranteed
  *		to be set to -1.
@@ -231,55 +294,80 @@ enum port_state port_state(struct port *port);
 struct fdarray *port_fda(struct port *port);
 
 /**
- * Return file descriptor of the port.
+ * Set the data of the port's timers, see struct tmr. Each timer gets
+ * @a base plus the descriptor index it stands for in port_event(), and
+ * N_POLLFD for the fault timer.
+ * @param port  A port instance.
+ * @param base  The data of descriptor index zero.
+ */
+void port_tag_timers(struct port *port, uint64_t base);
+
+/**
+ * Tell a port that the clock was stepped. The port starts its neighbor
+ * rate ratio estimate over, since the time stamps taken before the step
+ * no longer line up with the new ones.
+ * @param port  A port instance.
+ */
+void port_clock_stepped(struct port *port);
+
+/**
+ * Return the descriptor of the port's receive queue. When the port has
+ * a receive thread, the clock waits on this descriptor instead of the
+ * event and general sockets, and passes it to port_event() as FD_GENERAL.
  * @param port	A port instance.
- * @return	File descriptor or -1 if not applicable.
+ * @return	The descriptor, or -1 if the port has no receive thread.
  */
-int port_fault_fd(struct port *port);
+int port_rxq_fd(struct port *port);
 
 /**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a port timer.
  *
- * This function sets the timer 'fd' to the value M(2^N), where M is
+ * This function sets the timer 'index' to the value M(2^N), where M is
  * the value of the 'scale' parameter and N in the value of the
  * 'log_seconds' parameter.
  *
  * Passing both 'scale' and 'log_seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param p A port instance.
+ * @param index One of the FD_*_TIMER indices, or N_POLLFD for the fault timer.
  * @param scale The multiplicative factor for the timer.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_log(int fd, unsigned int scale, int log_seconds);
+int set_tmo_log(struct port *p, int index, unsigned int scale,
+		int log_seconds);
 
 /**
- * Utility function for setting a file descriptor timer.
+ * Utility function for setting a port timer.
  *
- * This function sets the timer 'fd' to a random value between M * 2^N and
+ * This function sets the timer 'index' to a random value between M * 2^N and
  * (M + S) * 2^N, where M is the value of the 'min' parameter, S is the value
  * of the 'span' parameter, and N in the value of the 'log_seconds' parameter.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param p A port instance.
+ * @param index One of the FD_*_TIMER indices, or N_POLLFD for the fault timer.
  * @param min The minimum value for the timer.
  * @param span The span value for the timer. Must be a positive value.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_random(int fd, int min, int span, int log_seconds);
+int set_tmo_random(struct port *p, int index, int min, int span,
+		   int log_seconds);
 
 /**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a port timer.
  *
- * This function sets the timer 'fd' to the value of the 'seconds' parameter.
+ * This function sets the timer 'index' to the value of the 'seconds'
+ * parameter.
  *
  * Passing 'seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param p A port instance.
+ * @param index One of the FD_*_TIMER indices, or N_POLLFD for the fault timer.
  * @param seconds The timeout value for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_lin(int fd, int seconds);
+int set_tmo_lin(struct port *p, int index, int seconds);
 
 /**
  * Sets port's fault file descriptor timer.
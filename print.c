@@ -16,19 +16,90 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "print.h"
 
+/* Bytes of packed arguments per queued message. */
+#define PRINT_REC_DATA 216
+
 static int verbose = 0;
 static int print_level = LOG_INFO;
 static int use_syslog = 1;
 static const char *progname;
 
+/* What a conversion takes from the argument list. */
+enum arg_class {
+	ARG_NONE,
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_INTMAX,
+	ARG_SIZE,
+	ARG_PTRDIFF,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_PTR,
+	ARG_STR,
+	ARG_ERRNO,
+	ARG_PERCENT,
+};
+
+struct conv {
+	int len;
+	int star_width;
+	int star_prec;
+	enum arg_class cls;
+};
+
+/*
+ * A message waiting for the writer thread. The arguments are packed
+ * in the order of the conversions, strings are copied.
+ */
+struct print_rec {
+	unsigned long seq;
+	int level;
+	int err;
+	struct timespec ts;
+	const char *format;
+	unsigned short len;
+	unsigned char trunc;
+	char data[PRINT_REC_DATA];
+};
+
+struct print_queue {
+	struct print_rec *rec;
+	unsigned long mask;
+	/* Claimed by the producers, which may be any thread. */
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long dropped;
+	/* Set by the writer thread before it waits on wake_fd. */
+	int sleeping;
+	/* Used by the writer thread only. */
+	unsigned long tail __attribute__((aligned(64)));
+	unsigned long dropped_reported;
+	int stop;
+	int wake_fd;
+	pthread_t thread;
+};
+
+static struct print_queue *queue;
+static int queue_writers;
+
 void print_set_progname(const char *name)
 {
 	progname = name;
@@ -49,31 +120,532 @@ void print_set_verbose(int value)
 	verbose = value ? 1 : 0;
 }
 
+static void print_output(int level, struct timespec *ts, const char *buf)
+{
+	FILE *f;
+
+	if (verbose) {
+		f = level >= LOG_NOTICE ? stdout : stderr;
+		fprintf(f, "%s[%lld.%03ld]: %s\n",
+			progname ? progname : "",
+			(long long)ts->tv_sec, ts->tv_nsec / 1000000, buf);
+		fflush(f);
+	}
+	if (use_syslog) {
+		syslog(level, "[%lld.%03ld] %s",
+		       (long long)ts->tv_sec, ts->tv_nsec / 1000000, buf);
+	}
+}
+
+/* Parses the conversion at 'p', which points to a '%'. */
+static void parse_conv(const char *p, struct conv *c)
+{
+	const char *q = p + 1;
+	int l = 0, h = 0, L = 0, j = 0, z = 0, t = 0;
+
+	memset(c, 0, sizeof(*c));
+	while (*q && strchr("-+ #0'", *q))
+		q++;
+	if (*q == '*') {
+		c->star_width = 1;
+		q++;
+	}
+	while (*q >= '0' && *q <= '9')
+		q++;
+	if (*q == '.') {
+		q++;
+		if (*q == '*') {
+			c->star_prec = 1;
+			q++;
+		}
+		while (*q >= '0' && *q <= '9')
+			q++;
+	}
+	for (;; q++) {
+		if (*q == 'l')
+			l++;
+		else if (*q == 'h')
+			h++;
+		else if (*q == 'L' || *q == 'q')
+			L++;
+		else if (*q == 'j')
+			j++;
+		else if (*q == 'z')
+			z++;
+		else if (*q == 't')
+			t++;
+		else
+			break;
+	}
+
+	switch (*q) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+		if (j)
+			c->cls = ARG_INTMAX;
+		else if (z)
+			c->cls = ARG_SIZE;
+		else if (t)
+			c->cls = ARG_PTRDIFF;
+		else if (l > 1 || L)
+			c->cls = ARG_LLONG;
+		else if (l)
+			c->cls = ARG_LONG;
+		else
+			c->cls = ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		c->cls = L ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		c->cls = l ? ARG_NONE : ARG_STR;
+		break;
+	case 'p':
+		c->cls = ARG_PTR;
+		break;
+	case 'm':
+		c->cls = ARG_ERRNO;
+		break;
+	case '%':
+		c->cls = ARG_PERCENT;
+		break;
+	default:
+		/* Including %n, which has no business in a log message. */
+		c->cls = ARG_NONE;
+		return;
+	}
+	c->len = q + 1 - p;
+}
+
+static void *rec_slot(struct print_rec *r, size_t size)
+{
+	size_t off = (r->len + size - 1) / size * size;
+
+	if (r->trunc || off + size > sizeof(r->data)) {
+		r->trunc = 1;
+		return NULL;
+	}
+	r->len = off + size;
+	return r->data + off;
+}
+
+#define PACK(r, type, value) do {				\
+		type *__slot = rec_slot(r, sizeof(type));	\
+		if (__slot)					\
+			memcpy(__slot, &(type){value}, sizeof(type)); \
+	} while (0)
+
+static void pack_str(struct print_rec *r, const char *s)
+{
+	unsigned short *n;
+	size_t room;
+
+	n = rec_slot(r, sizeof(*n));
+	if (!n)
+		return;
+	room = sizeof(r->data) - r->len - 1;
+	*n = strnlen(s ? s : "(null)", room);
+	memcpy(r->data + r->len, s ? s : "(null)", *n);
+	r->data[r->len + *n] = 0;
+	r->len += *n + 1;
+	if (s && s[*n])
+		r->trunc = 1;
+}
+
+static void pack_args(struct print_rec *r, const char *format, va_list ap)
+{
+	struct conv c;
+	const char *p;
+
+	for (p = format; *p && !r->trunc; p++) {
+		if (*p != '%')
+			continue;
+		parse_conv(p, &c);
+		if (c.cls == ARG_NONE)
+			break;
+		if (c.star_width)
+			PACK(r, int, va_arg(ap, int));
+		if (c.star_prec)
+			PACK(r, int, va_arg(ap, int));
+		switch (c.cls) {
+		case ARG_INT:
+			PACK(r, int, va_arg(ap, int));
+			break;
+		case ARG_LONG:
+			PACK(r, long, va_arg(ap, long));
+			break;
+		case ARG_LLONG:
+			PACK(r, long long, va_arg(ap, long long));
+			break;
+		case ARG_INTMAX:
+			PACK(r, intmax_t, va_arg(ap, intmax_t));
+			break;
+		case ARG_SIZE:
+			PACK(r, size_t, va_arg(ap, size_t));
+			break;
+		case ARG_PTRDIFF:
+			PACK(r, ptrdiff_t, va_arg(ap, ptrdiff_t));
+			break;
+		case ARG_DOUBLE:
+			PACK(r, double, va_arg(ap, double));
+			break;
+		case ARG_LDOUBLE:
+			PACK(r, long double, va_arg(ap, long double));
+			break;
+		case ARG_PTR:
+			PACK(r, void *, va_arg(ap, void *));
+			break;
+		case ARG_STR:
+			pack_str(r, va_arg(ap, const char *));
+			break;
+		default:
+			break;
+		}
+		p += c.len - 1;
+	}
+}
+
+static void *unpack(struct print_rec *r, size_t *off, size_t size)
+{
+	size_t pos = (*off + size - 1) / size * size;
+
+	if (pos + size > r->len)
+		return NULL;
+	*off = pos + size;
+	return r->data + pos;
+}
+
+#define EMIT(value) do {						\
+		if (c.star_width && c.star_prec)			\
+			n = snprintf(o, end - o, spec, w, pr, value);	\
+		else if (c.star_width)					\
+			n = snprintf(o, end - o, spec, w, value);	\
+		else if (c.star_prec)					\
+			n = snprintf(o, end - o, spec, pr, value);	\
+		else							\
+			n = snprintf(o, end - o, spec, value);		\
+	} while (0)
+
+#define UNPACK(type) do {						\
+		type *__v = unpack(r, &off, sizeof(type));		\
+		if (!__v)						\
+			goto out;					\
+		EMIT(*__v);						\
+	} while (0)
+
+/* Formats a queued message, the way vsnprintf() would have. */
+static void format_rec(struct print_rec *r, char *buf, size_t size)
+{
+	char *o = buf, *end = buf + size - 1, spec[32];
+	const char *p = r->format, *s;
+	size_t off = 0;
+	struct conv c;
+	int n, w = 0, pr = 0, *v;
+
+	while (*p && o < end) {
+		if (*p != '%') {
+			*o++ = *p++;
+			continue;
+		}
+		parse_conv(p, &c);
+		if (c.cls == ARG_NONE || c.len >= (int) sizeof(spec))
+			break;
+		memcpy(spec, p, c.len);
+		spec[c.len] = 0;
+		p += c.len;
+
+		if (c.star_width) {
+			if (!(v = unpack(r, &off, sizeof(int))))
+				goto out;
+			w = *v;
+		}
+		if (c.star_prec) {
+			if (!(v = unpack(r, &off, sizeof(int))))
+				goto out;
+			pr = *v;
+		}
+		n = 0;
+		switch (c.cls) {
+		case ARG_INT:
+			UNPACK(int);
+			break;
+		case ARG_LONG:
+			UNPACK(long);
+			break;
+		case ARG_LLONG:
+			UNPACK(long long);
+			break;
+		case ARG_INTMAX:
+			UNPACK(intmax_t);
+			break;
+		case ARG_SIZE:
+			UNPACK(size_t);
+			break;
+		case ARG_PTRDIFF:
+			UNPACK(ptrdiff_t);
+			break;
+		case ARG_DOUBLE:
+			UNPACK(double);
+			break;
+		case ARG_LDOUBLE:
+			UNPACK(long double);
+			break;
+		case ARG_PTR:
+			UNPACK(void *);
+			break;
+		case ARG_STR:
+			if (!unpack(r, &off, sizeof(unsigned short)))
+				goto out;
+			s = r->data + off;
+			off += strlen(s) + 1;
+			EMIT(s);
+			break;
+		case ARG_ERRNO:
+			n = snprintf(o, end - o, "%s", strerror(r->err));
+			break;
+		case ARG_PERCENT:
+			n = snprintf(o, end - o, "%%");
+			break;
+		default:
+			break;
+		}
+		o += n < 0 ? 0 : n;
+		if (o > end)
+			o = end;
+	}
+out:
+	if (r->trunc && o + 3 <= end) {
+		memcpy(o, "...", 3);
+		o += 3;
+	}
+	*o = 0;
+}
+
+static int print_queue_drain(struct print_queue *q)
+{
+	struct print_rec *r;
+	unsigned long dropped;
+	char buf[1024];
+	int cnt = 0;
+
+	for (;; q->tail++, cnt++) {
+		r = &q->rec[q->tail & q->mask];
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != q->tail + 1)
+			break;
+		format_rec(r, buf, sizeof(buf));
+		print_output(r->level, &r->ts, buf);
+		/* Hand the slot to the producers of the next lap. */
+		__atomic_store_n(&r->seq, q->tail + q->mask + 1,
+				 __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+	if (dropped != q->dropped_reported) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		snprintf(buf, sizeof(buf), "log queue full, %lu messages lost",
+			 dropped - q->dropped_reported);
+		print_output(LOG_WARNING, &ts, buf);
+		q->dropped_reported = dropped;
+	}
+	return cnt;
+}
+
+/*
+ * The eventfd is non-blocking and there is nowhere to report its errors
+ * to, as the writer thread is the log.
+ */
+static void print_queue_wake(struct print_queue *q)
+{
+	uint64_t one = 1;
+	ssize_t n;
+
+	n = write(q->wake_fd, &one, sizeof(one));
+	(void) n;
+}
+
+static void print_queue_wait(struct print_queue *q)
+{
+	struct pollfd pfd = { q->wake_fd, POLLIN, 0 };
+	uint64_t val;
+	ssize_t n;
+
+	if (poll(&pfd, 1, -1) > 0) {
+		n = read(q->wake_fd, &val, sizeof(val));
+		(void) n;
+	}
+}
+
+static void *print_queue_run(void *arg)
+{
+	struct print_queue *q = arg;
+
+	while (1) {
+		if (print_queue_drain(q))
+			continue;
+		if (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE))
+			break;
+		/*
+		 * Announce the wait, then look again, so that a producer
+		 * either sees the flag or its message is found here.
+		 */
+		__atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (print_queue_drain(q) ||
+		    __atomic_load_n(&q->stop, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		print_queue_wait(q);
+		__atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+	}
+	/* Whatever came in before the stop request. */
+	print_queue_drain(q);
+	return NULL;
+}
+
+/* Queues a message, never blocks. Returns non-zero if there is no queue. */
+static int print_queue_put(int level, int err, char const *format, va_list ap)
+{
+	struct print_queue *q;
+	struct print_rec *r;
+	unsigned long pos, seq;
+	long diff;
+
+	__atomic_add_fetch(&queue_writers, 1, __ATOMIC_SEQ_CST);
+	q = __atomic_load_n(&queue, __ATOMIC_SEQ_CST);
+	if (!q) {
+		__atomic_sub_fetch(&queue_writers, 1, __ATOMIC_SEQ_CST);
+		return -1;
+	}
+
+	pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+	for (;;) {
+		r = &q->rec[pos & q->mask];
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		diff = (long) (seq - pos);
+		if (!diff) {
+			if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&queue_writers, 1, __ATOMIC_SEQ_CST);
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &r->ts);
+	r->level = level;
+	r->err = err;
+	r->format = format;
+	r->len = 0;
+	r->trunc = 0;
+	pack_args(r, format, ap);
+	__atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* Only the first message after the queue ran empty wakes it. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&q->sleeping, 0, __ATOMIC_RELAXED))
+		print_queue_wake(q);
+
+	__atomic_sub_fetch(&queue_writers, 1, __ATOMIC_SEQ_CST);
+	return 0;
+}
+
+int print_set_queue(int length)
+{
+	struct print_queue *q = queue;
+	unsigned long i, size = 1;
+	sigset_t all, old;
+	int err;
+
+	if (q) {
+		/* Let the producers which still see the queue finish. */
+		__atomic_store_n(&queue, NULL, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&queue_writers, __ATOMIC_SEQ_CST))
+			sched_yield();
+		__atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+		print_queue_wake(q);
+		pthread_join(q->thread, NULL);
+		close(q->wake_fd);
+		free(q->rec);
+		free(q);
+	}
+	if (length <= 0)
+		return 0;
+
+	while (size < (unsigned long) length)
+		size <<= 1;
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return -1;
+	q->rec = calloc(size, sizeof(*q->rec));
+	if (!q->rec)
+		goto no_rec;
+	q->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->wake_fd < 0)
+		goto no_fd;
+	q->mask = size - 1;
+	for (i = 0; i < size; i++)
+		q->rec[i].seq = i;
+
+	/* Signals are for the main thread to handle. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&q->thread, NULL, print_queue_run, q);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err)
+		goto no_thread;
+	__atomic_store_n(&queue, q, __ATOMIC_SEQ_CST);
+	return 0;
+
+no_thread:
+	close(q->wake_fd);
+no_fd:
+	free(q->rec);
+no_rec:
+	free(q);
+	return -1;
+}
+
+unsigned long print_dropped(void)
+{
+	struct print_queue *q = __atomic_load_n(&queue, __ATOMIC_SEQ_CST);
+
+	return q ? __atomic_load_n(&q->dropped, __ATOMIC_RELAXED) : 0;
+}
+
 void print(int level, char const *format, ...)
 {
 	struct timespec ts;
+	int err = errno;
 	va_list ap;
 	char buf[1024];
-	FILE *f;
 
 	if (level > print_level)
 		return;
 
+	va_start(ap, format);
+	if (!print_queue_put(level, err, format, ap)) {
+		va_end(ap);
+		errno = err;
+		return;
+	}
+	va_end(ap);
+
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 
 	va_start(ap, format);
+	errno = err;
 	vsnprintf(buf, sizeof(buf), format, ap);
 	va_end(ap);
 
-	if (verbose) {
-		f = level >= LOG_NOTICE ? stdout : stderr;
-		fprintf(f, "%s[%lld.%03ld]: %s\n",
-			progname ? progname : "",
-			(long long)ts.tv_sec, ts.tv_nsec / 1000000, buf);
-		fflush(f);
-	}
-	if (use_syslog) {
-		syslog(level, "[%lld.%03ld] %s",
-		       (long long)ts.tv_sec, ts.tv_nsec / 1000000, buf);
-	}
+	print_output(level, &ts, buf);
+	errno = err;
 }
@@ -37,6 +37,24 @@ void print_set_syslog(int value);
 void print_set_level(int level);
 void print_set_verbose(int value);
 
+/**
+ * Hand the messages to a background thread, which formats and writes
+ * them. print() then only stores the format, the arguments and a time
+ * stamp in a ring buffer, and never blocks. Messages which do not fit
+ * into the ring are counted and reported by the thread.
+ * @param length  Number of messages the ring holds, rounded up to a power
+ *                of two. Zero stops the thread after writing the queued
+ *                messages, and print() writes synchronously again.
+ * @return        Zero on success, non-zero otherwise.
+ */
+int print_set_queue(int length);
+
+/**
+ * Get the number of messages lost because the ring buffer was full.
+ * @return  The number of messages lost since print_set_queue().
+ */
+unsigned long print_dropped(void);
+
 #define pr_emerg(x...)   print(LOG_EMERG, x)
 #define pr_alert(x...)   print(LOG_ALERT, x)
 #define pr_crit(x...)    print(LOG_CRIT, x)
@@ -25,8 +25,10 @@
 
 #include "clock.h"
 #include "config.h"
+#include "msg.h"
 #include "ntpshm.h"
 #include "pi.h"
+#include "port.h"
 #include "print.h"
 #include "raw.h"
 #include "sk.h"
@@ -84,6 +86,8 @@ void ptp4l_exit(struct clock *clock) {
         clock_destroy(clock);
     }
 
+    print_set_queue(0);
+
     if(cfg) {
         config_destroy(cfg);
     }
@@ -92,8 +96,9 @@ void ptp4l_exit(struct clock *clock) {
 void* ptp4l_init(int argc, char *argv[], int force_slave_only)
 {
 	char *config = NULL, *req_phc = NULL, *progname;
-	int c, print_level;
+	int c, pool_size, print_level;
 	struct clock *clock = NULL;
+	struct interface *iface;
 
 	if (handle_term_signals())
 		return NULL;
@@ -197,12 +202,16 @@ void* ptp4l_init(int argc, char *argv[], int force_slave_only)
 	print_set_verbose(config_get_int(cfg, NULL, "verbose"));
 	print_set_syslog(config_get_int(cfg, NULL, "use_syslog"));
 	print_set_level(config_get_int(cfg, NULL, "logging_level"));
+	if (print_set_queue(config_get_int(cfg, NULL, "logging_queue_length")))
+		pr_warning("failed to start the logging thread");
 
 	assume_two_step = config_get_int(cfg, NULL, "assume_two_step");
 	sk_check_fupsync = config_get_int(cfg, NULL, "check_fup_sync");
 	sk_tx_timeout = config_get_int(cfg, NULL, "tx_timestamp_timeout");
+	sk_tx_async = config_get_int(cfg, NULL, "tx_timestamp_async");
 
-	if (config_get_int(cfg, NULL, "clock_servo") == CLOCK_SERVO_NTPSHM) {
+	if (config_get_int(cfg, NULL, "clock_servo") == CLOCK_SERVO_NTPSHM ||
+	    config_get_int(cfg, NULL, "clock_servo") == CLOCK_SERVO_NTPSOCK) {
 		config_set_int(cfg, "kernel_leap", 0);
 		config_set_int(cfg, "sanity_freq_limit", 0);
 	}
@@ -216,6 +225,19 @@ void* ptp4l_init(int argc, char *argv[], int force_slave_only)
 	if(force_slave_only) {
             config_set_int(cfg, "slaveOnly", 1);
         }
+
+	/* The pool gets the configured head room on top of what ports keep. */
+	pool_size = config_get_int(cfg, NULL, "msg_pool_size");
+	if (pool_size) {
+		STAILQ_FOREACH(iface, &cfg->interfaces, list)
+			pool_size += port_msg_reserve(cfg, iface->name);
+	}
+	if (msg_pool_init(pool_size,
+			  config_get_int(cfg, NULL, "msg_pool_lock"),
+			  config_get_int(cfg, NULL, "msg_pool_hugepages"))) {
+		fprintf(stderr, "failed to allocate the message pool\n");
+		goto out;
+	}
 	
 	clock = clock_create(cfg->n_interfaces > 1 ? CLOCK_TYPE_BOUNDARY :
 			     CLOCK_TYPE_ORDINARY, cfg, req_phc);
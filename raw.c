@@ -322,6 +322,35 @@ static int raw_send(struct transport *t, struct fdarray *fda, int event,
 	return event == TRANS_EVENT ? sk_receive(fd, pkt, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
 }
 
+static int raw_send_batch(struct transport *t, struct fdarray *fda,
+			  void *buf[], int len[], struct address *addr[], int n)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+	struct address *dst;
+	struct eth_hdr *hdr;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst = addr[i] ? addr[i] : &raw->ptp_addr;
+		buf[i] = (unsigned char *) buf[i] - sizeof(*hdr);
+		len[i] += sizeof(*hdr);
+
+		hdr = (struct eth_hdr *) buf[i];
+		addr_to_mac(&hdr->dst, dst);
+		addr_to_mac(&hdr->src, &raw->src_addr);
+		hdr->type = htons(ETH_P_1588);
+
+		addr[i] = NULL;
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], buf, len, addr, n);
+}
+
+static int raw_txts(struct transport *t, struct fdarray *fda, void *buf,
+		    int buflen, struct hw_timestamp *hwts)
+{
+	return sk_receive_txts(fda->fd[FD_EVENT], buf, buflen, hwts);
+}
+
 static void raw_release(struct transport *t)
 {
 	struct raw *raw = container_of(t, struct raw, t);
@@ -352,6 +381,8 @@ struct transport *raw_transport_create(void)
 	raw->t.open    = raw_open;
 	raw->t.recv    = raw_recv;
 	raw->t.send    = raw_send;
+	raw->t.send_batch = raw_send_batch;
+	raw->t.txts    = raw_txts;
 	raw->t.release = raw_release;
 	raw->t.physical_addr = raw_physical_addr;
 	raw->t.protocol_addr = raw_protocol_addr;
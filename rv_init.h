@@ -21,8 +21,13 @@
 #include "uv.h"
 
 #include "rv_ptp_ifc.h"
+#include "rv_ptp_snapshot.h"
+#include "rv_ptp_policy.h"
+#include "rv_ptp_telemetry.h"
 #include "rv_mqtt.h"
 
+#include "msg.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -38,9 +43,15 @@ typedef struct linuxptp_clock_t {
     struct clock *clock_handle;
     
     RvPtpClockState clock_state;
+    RvPtpSnapshot clock_snapshot;   //!< copy of clock_state for the publisher thread
     
     RvMQTTHandle mqtt_handle;
 
+    RvPtpPolicy offset_policy;
+    RvPtpPolicy path_delay_policy[RV_PTP_MAX_PORTS];
+    RvPtpTelemetry telemetry;       //!< owned by the publisher thread
+    struct msg_pool_stats msg_pool; //!< message pool statistics published last
+
     uv_thread_t timer_thread;
     uv_timer_t publish_timer;
 } LinuxPtpClock;
@@ -51,10 +62,11 @@ extern int rv_ptp_mqtt_init(LinuxPtpClock *linuxptp, char *client_id);
 extern void rv_ptp_mqtt_exit(LinuxPtpClock *linuxptp);
 
 extern int publish_ptp_clock_state(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_clock);
-extern int publish_ptp_offset(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_clock);
+extern int publish_ptp_offset(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_clock, int64_t offset);
 
 extern int publish_ptp_port_state(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_port, struct rv_ptpport_t *ptp_port_last);
-extern int publish_ptp_path_delay(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_port);
+extern int publish_ptp_path_delay(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_port, int64_t path_delay);
+extern int publish_ptp_msg_pool(RvMQTTHandle *mqtt_handle, struct msg_pool_stats *stats);
 
 extern void* ptp4l_init(int argc, char *argv[], int force_slave_only);
 extern void ptp4l_exit(struct clock* clock_handle);
@@ -0,0 +1,157 @@
+/**
+ * @file rv_json_writer.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rv_json_writer.h"
+#include "rv_jsonrpc.h" // for JSONRPC_PROTOCOL_VERSION
+#include "rv_init.h"
+#include "rv_random.h"
+
+#include <string.h>
+
+static void append(RvJsonWriter *self, const char *text, unsigned len) {
+    if(self->overflow || (self->len + len >= RV_JSON_WRITER_SIZE)) {
+        self->overflow = true;
+        return;
+    }
+    memcpy(&self->buffer[self->len], text, len);
+    self->len += len;
+    self->buffer[self->len] = 0;
+}
+
+static void append_str(RvJsonWriter *self, const char *text) {
+    append(self, text, strlen(text));
+}
+
+// quoted and escaped like json_dumps() does it
+static void append_quoted(RvJsonWriter *self, const char *text) {
+    static const char hex[] = "0123456789ABCDEF";
+    const char *start = text;
+    char escape[6] = {'\\', 'u', '0', '0', 0, 0};
+
+    append(self, "\"", 1);
+    for(; *text; ++text) {
+        unsigned char c = *text;
+
+        if((c >= 0x20) && (c != '"') && (c != '\\')) {
+            continue;
+        }
+        append(self, start, text - start);
+        start = text + 1;
+
+        switch(c) {
+            case '"':  append(self, "\\\"", 2); break;
+            case '\\': append(self, "\\\\", 2); break;
+            case '\b': append(self, "\\b", 2);  break;
+            case '\f': append(self, "\\f", 2);  break;
+            case '\n': append(self, "\\n", 2);  break;
+            case '\r': append(self, "\\r", 2);  break;
+            case '\t': append(self, "\\t", 2);  break;
+            default:
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xf];
+                append(self, escape, sizeof(escape));
+                break;
+        }
+    }
+    append(self, start, text - start);
+    append(self, "\"", 1);
+}
+
+static void append_key(RvJsonWriter *self, const char *key) {
+    if(self->need_comma) {
+        append(self, ", ", 2);
+    }
+    self->need_comma = true;
+
+    append_quoted(self, key);
+    append(self, ": ", 2);
+}
+
+static void append_int(RvJsonWriter *self, int64_t value) {
+    char digits[24];
+    unsigned idx = sizeof(digits);
+    // negate in unsigned arithmetic, INT64_MIN has no positive counterpart
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+    do {
+        digits[--idx] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while(magnitude);
+
+    if(value < 0) {
+        digits[--idx] = '-';
+    }
+    append(self, &digits[idx], sizeof(digits) - idx);
+}
+
+static void reset(RvJsonWriter *self) {
+    self->len = 0;
+    self->need_comma = false;
+    self->overflow = false;
+    self->buffer[0] = 0;
+}
+
+void rv_json_writer_notification(RvJsonWriter *self, const char *method) {
+    reset(self);
+
+    append_str(self, "{\"jsonrpc\": \"2.0\", \"method\": ");
+    append_quoted(self, method);
+    append_str(self, ", \"params\": {");
+}
+
+void rv_json_writer_health(RvJsonWriter *self) {
+    reset(self);
+
+    append(self, "{", 1);
+}
+
+void rv_json_writer_int(RvJsonWriter *self, const char *key, int64_t value) {
+    append_key(self, key);
+    append_int(self, value);
+}
+
+void rv_json_writer_string(RvJsonWriter *self, const char *key, const char *value) {
+    append_key(self, key);
+    append_quoted(self, value);
+}
+
+int rv_json_writer_notification_end(RvJsonWriter *self) {
+    char process_hash[RV_CNAME_LEN + 1] = {0};
+    RvTimeUtc time_utc = rv_gettimeofday();
+
+    // same implicit members as rv_jsonrpc_request_encode()
+    rv_random_hash(process_hash, RV_CNAME_LEN + 1);
+
+    rv_json_writer_int(self, "timestamp", time_utc.seconds);
+    rv_json_writer_string(self, "protocol_version", JSONRPC_PROTOCOL_VERSION);
+    rv_json_writer_string(self, "process_hash", process_hash);
+    append(self, "}}", 2);
+
+    return self->overflow ? -1 : (int)self->len;
+}
+
+int rv_json_writer_health_end(RvJsonWriter *self) {
+    RvTimeUtc time_utc = rv_gettimeofday();
+
+    // same implicit member as rv_mqtt_publish_health()
+    rv_json_writer_int(self, "timestamp", time_utc.seconds);
+    append(self, "}", 1);
+
+    return self->overflow ? -1 : (int)self->len;
+}
@@ -0,0 +1,66 @@
+/**
+ * @file rv_json_writer.h
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+/**
+ * \addtogroup rvutil
+ * @{
+ * \file rv_json_writer.h
+ * \brief Fixed layout JSON serializer for frequent outbound messages
+ *
+ * Writes flat JSON objects straight into a caller owned buffer, without
+ * building a jansson tree first. The output matches what
+ * rv_mqtt_publish_jsonrpc() and rv_mqtt_publish_health() produce for the
+ * same members. Inbound messages are still parsed with jansson.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RV_JSON_WRITER_SIZE 512
+
+typedef struct rv_json_writer_t {
+    char buffer[RV_JSON_WRITER_SIZE];
+    unsigned len;
+    bool need_comma;    //!< a member was written to the current object
+    bool overflow;      //!< output was truncated, message must not be sent
+} RvJsonWriter;
+
+/**
+ * Start a JSON RPC notification, members added next go to "params".
+ */
+extern void rv_json_writer_notification(RvJsonWriter *self, const char *method);
+
+/**
+ * Start a health message, a plain JSON object.
+ */
+extern void rv_json_writer_health(RvJsonWriter *self);
+
+extern void rv_json_writer_int(RvJsonWriter *self, const char *key, int64_t value);
+extern void rv_json_writer_string(RvJsonWriter *self, const char *key, const char *value);
+
+/**
+ * Append the members the encoders add implicitly and close all objects.
+ *
+ * @return length of the message in 'buffer', or -1 if it did not fit
+ */
+extern int rv_json_writer_notification_end(RvJsonWriter *self);
+extern int rv_json_writer_health_end(RvJsonWriter *self);
+
+/** @} */
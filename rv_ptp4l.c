@@ -24,33 +24,47 @@
 #include <string.h>
 
 extern int rv_get_clock_status(struct rv_ptpclock_t *rv_clock, struct clock *clock);
+extern int rv_get_clock_dirty(struct clock *clock);
 
-// On each published change, we update rv_clock_old as well. This way
-// we won't miss a slowly drifting offset/path delay.
+// Offset and path delay go through their publish policies, which decide
+// about deadband, rate limit and aggregation.
 static void check_for_state_changes(LinuxPtpClock *linuxptp) {
-    struct rv_ptpclock_t rv_clock_old = {0};
+    struct rv_ptpclock_t rv_clock_old;
     bool clock_state_change = false;
+    int64_t value;
+    int dirty;
 
-    // save old status for later comparisons
-    memcpy(&rv_clock_old, &linuxptp->clock_state, sizeof(struct rv_ptpclock_t));
+    // most wakeups are timers or messages which change nothing we export
+    dirty = rv_get_clock_dirty(linuxptp->clock_handle);
+    if(!dirty) {
+        return;
+    }
+
+    // save old status for later comparisons, a new offset alone needs no copy
+    if(dirty & ~RV_PTP_DIRTY_OFFSET) {
+        memcpy(&rv_clock_old, &linuxptp->clock_state, sizeof(struct rv_ptpclock_t));
+    }
 
-    // get new status from clock_handle
-    rv_get_clock_status(&linuxptp->clock_state, linuxptp->clock_handle);
+    // refresh the dirty parts of the status from clock_handle
+    dirty = rv_get_clock_status(&linuxptp->clock_state, linuxptp->clock_handle);
 
     // check for clock state changes
-    clock_state_change =   (rv_clock_old.port_count != linuxptp->clock_state.port_count)
+    clock_state_change = (dirty & RV_PTP_DIRTY_CLOCK) && (   (rv_clock_old.port_count != linuxptp->clock_state.port_count)
                         || (rv_clock_old.domain     != linuxptp->clock_state.domain)
                         || (rv_clock_old.slave_only != linuxptp->clock_state.slave_only)
                         || (rv_clock_old.priority1  != linuxptp->clock_state.priority1)
                         || (rv_clock_old.priority2  != linuxptp->clock_state.priority2)
                         || (rv_clock_old.event_priority   != linuxptp->clock_state.event_priority)
-                        || (rv_clock_old.general_priority != linuxptp->clock_state.general_priority);
+                        || (rv_clock_old.general_priority != linuxptp->clock_state.general_priority));
     
     if(clock_state_change) {
         publish_ptp_clock_state(&linuxptp->mqtt_handle, &linuxptp->clock_state);
     }
     
     // check for port status changes
+    if(!(dirty & (RV_PTP_DIRTY_CLOCK | RV_PTP_DIRTY_PORT_STATE | RV_PTP_DIRTY_PATH_DELAY))) {
+        goto check_offset;
+    }
     for(unsigned idx = 0; idx < linuxptp->clock_state.port_count; ++idx) {
         bool port_state_change = false;
         struct rv_ptpport_t *old_port = &rv_clock_old.port[idx];
@@ -74,22 +88,43 @@ static void check_for_state_changes(LinuxPtpClock *linuxptp) {
             publish_ptp_port_state(&linuxptp->mqtt_handle, &linuxptp->clock_state.port[idx], &linuxptp->clock_state.port_last[idx]);
         }
 
-        // publish path delay changes in 1us steps
-        if(old_port->path_delay/1000 != new_port->path_delay/1000) {
-            publish_ptp_path_delay(&linuxptp->mqtt_handle, &linuxptp->clock_state.port[idx]);
+        // a changed path delay is a new measurement
+        if((old_port->path_delay != new_port->path_delay) &&
+           rv_ptp_policy_sample(&linuxptp->path_delay_policy[idx], new_port->path_delay, &value)) {
+            publish_ptp_path_delay(&linuxptp->mqtt_handle, new_port, value);
         }
     }
     
-    // at last check for offset changes > 10us
+check_offset:
+    // at last check for a new offset
     // this must be done at last, to be able to check port state changes before overwriting them
-    if(linuxptp->clock_state.offset / 10000 != rv_clock_old.offset/10000) {
+    if((dirty & RV_PTP_DIRTY_OFFSET) &&
+       rv_ptp_policy_sample(&linuxptp->offset_policy, linuxptp->clock_state.offset, &value)) {
         // publish new status regardless of other changes
-        publish_ptp_offset(&linuxptp->mqtt_handle, &linuxptp->clock_state);
+        publish_ptp_offset(&linuxptp->mqtt_handle, &linuxptp->clock_state, value);
     }
+
+    // hand the new state over to the regular publisher
+    rv_ptp_snapshot_write(&linuxptp->clock_snapshot, &linuxptp->clock_state);
     
     return;
 }
 
+// the pool belongs to the main loop, high water mark and exhaustion count
+// only grow, so this publishes rarely
+static void check_msg_pool(LinuxPtpClock *linuxptp) {
+    struct msg_pool_stats stats;
+
+    msg_pool_get_stats(&stats);
+    if((stats.high_water == linuxptp->msg_pool.high_water) &&
+       (stats.exhausted == linuxptp->msg_pool.exhausted)) {
+        return;
+    }
+
+    publish_ptp_msg_pool(&linuxptp->mqtt_handle, &stats);
+    memcpy(&linuxptp->msg_pool, &stats, sizeof(struct msg_pool_stats));
+}
+
 int main(int argc, char *argv[]) {
     LinuxPtpClock linuxptp;
     char process_name[RV_NAME_MAX];
@@ -117,6 +152,7 @@ int main(int argc, char *argv[]) {
         }
         
         check_for_state_changes(&linuxptp);
+        check_msg_pool(&linuxptp);
     }
 
     rv_ptp_mqtt_exit(&linuxptp);
@@ -56,6 +56,21 @@ typedef enum rv_ptp_portstate_t {
 
 extern char *portstate2str[eRvPtpUnknown];
 
+//! Parts of the exported state which changed since rv_get_clock_status() ran last
+#define RV_PTP_DIRTY_CLOCK         0x01    //!< clock data set, best master or port list
+#define RV_PTP_DIRTY_OFFSET        0x02    //!< offset from master
+#define RV_PTP_DIRTY_PORT_STATE    0x04    //!< port state or the port's master
+#define RV_PTP_DIRTY_PATH_DELAY    0x08    //!< port path delay
+#define RV_PTP_DIRTY_ALL           0x0f
+
+//! How the samples between two MQTT publications of a metric are combined
+typedef enum rv_ptp_aggregate_t {
+    eRvPtpAggregateLast = 0,    //!< most recent sample
+    eRvPtpAggregateMean,
+    eRvPtpAggregateMin,
+    eRvPtpAggregateMax
+} RvPtpAggregate;
+
 typedef enum rv_ptp_delay_mechanism_t {
     eRvPtpDelayMechanismAuto = 0,
     eRvPtpDelayMechanismE2E,
@@ -21,15 +21,25 @@
 #include "rv_init.h"
 
 #include "rv_ptp_ifc.h"
+#include "rv_json_writer.h"
 
+#include "config.h"
 #include "print.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
-int publish_ptp_offset(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_clock) {
-    char mqtt_topic[RV_NAME_MAX] = {0};
+// Offset and path delay go out every second and on each change, so they are
+// written with the fixed layout serializer into reusable buffers. Both the
+// main loop and the timer thread publish them, hence one set per thread.
+static __thread RvJsonWriter offset_msg;
+static __thread RvJsonWriter offset_health_msg;
+static __thread RvJsonWriter path_delay_msg;
+
+int publish_ptp_offset(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_clock, int64_t offset) {
     bool is_slave = false;
+    int len;
     
     for(unsigned idx = 0; idx < ptp_clock->port_count; ++idx) {
         if(ptp_clock->port[idx].state == eRvPtpSlave) {
@@ -39,18 +49,20 @@ int publish_ptp_offset(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp_cloc
     }
     
     if(is_slave) {
-        json_t *offset_data = json_object();
-        json_object_set_new(offset_data, "offset_nsec", json_integer(ptp_clock->offset)); 
-        
-        snprintf(mqtt_topic, RV_NAME_MAX, "ptp/clock/offset");
-        rv_mqtt_publish_jsonrpc(mqtt_handle, mqtt_topic, "offsetToMaster", offset_data, NULL);
-        json_decref(offset_data);
-
-        json_t *health = json_object();
-        json_object_set_new(health, "value", json_integer(ptp_clock->offset)); 
-        json_object_set_new(health, "unit", json_string("ns"));
-        rv_mqtt_publish_health(mqtt_handle, "nodesys/health/ptp/clock/offset", health);
-        json_decref(health);
+        rv_json_writer_notification(&offset_msg, "offsetToMaster");
+        rv_json_writer_int(&offset_msg, "offset_nsec", offset);
+        len = rv_json_writer_notification_end(&offset_msg);
+        if(len > 0) {
+            rv_mqtt_publish(mqtt_handle, "ptp/clock/offset", 1, offset_msg.buffer, len);
+        }
+
+        rv_json_writer_health(&offset_health_msg);
+        rv_json_writer_int(&offset_health_msg, "value", offset);
+        rv_json_writer_string(&offset_health_msg, "unit", "ns");
+        len = rv_json_writer_health_end(&offset_health_msg);
+        if(len > 0) {
+            rv_mqtt_publish(mqtt_handle, "nodesys/health/ptp/clock/offset", 1, offset_health_msg.buffer, len);
+        }
     }
     
     return 0;
@@ -78,18 +90,23 @@ int publish_ptp_clock_state(RvMQTTHandle *mqtt_handle, struct rv_ptpclock_t *ptp
     return 0;
 }
 
-int publish_ptp_path_delay(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_port) {
+int publish_ptp_path_delay(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_port, int64_t path_delay) {
     char mqtt_topic[RV_NAME_MAX] = {0};
+    int len;
 
     // only of PASSIVE or slave_only
     if((ptp_port->state == eRvPtpPassive) || (ptp_port->state == eRvPtpSlave)) {
-        json_t *pathdelay_data = json_object();
-        json_object_set_new(pathdelay_data, "port_name", json_string(ptp_port->ifc_name));
-        json_object_set_new(pathdelay_data, "path_delay_nsec", json_integer(ptp_port->path_delay));
-        
+        rv_json_writer_notification(&path_delay_msg, "pathDelay");
+        rv_json_writer_string(&path_delay_msg, "port_name", ptp_port->ifc_name);
+        rv_json_writer_int(&path_delay_msg, "path_delay_nsec", path_delay);
+        len = rv_json_writer_notification_end(&path_delay_msg);
+        if(len < 0) {
+            pr_err("path delay message for %s too long", ptp_port->ifc_name);
+            return -1;
+        }
+
         snprintf(mqtt_topic, RV_NAME_MAX, "ptp/port/%s/path_delay", ptp_port->ifc_name);
-        rv_mqtt_publish_jsonrpc(mqtt_handle, mqtt_topic, "pathDelay", pathdelay_data, NULL);
-        json_decref(pathdelay_data);
+        rv_mqtt_publish(mqtt_handle, mqtt_topic, 1, path_delay_msg.buffer, len);
     }
     
     return 0;
@@ -143,17 +160,87 @@ int publish_ptp_port_state(RvMQTTHandle *mqtt_handle, struct rv_ptpport_t *ptp_p
     return 0;
 }
 
+int publish_ptp_msg_pool(RvMQTTHandle *mqtt_handle, struct msg_pool_stats *stats) {
+    json_t *health = json_object();
+
+    json_object_set_new(health, "value", json_integer(stats->high_water));
+    json_object_set_new(health, "size", json_integer(stats->size));
+    json_object_set_new(health, "in_use", json_integer(stats->in_use));
+    json_object_set_new(health, "exhausted", json_integer(stats->exhausted));
+    rv_mqtt_publish_health(mqtt_handle, "nodesys/health/ptp/msg_pool", health);
+    json_decref(health);
+
+    return 0;
+}
+
+extern struct config *clock_config(struct clock *c);
+extern struct telemetry *clock_telemetry(struct clock *c);
+
+static void publish_ptp_telemetry(RvMQTTHandle *mqtt_handle, RvPtpTelemetry *telemetry) {
+    while(rv_ptp_telemetry_drain(telemetry)) {
+        json_t *report = rv_ptp_telemetry_report(telemetry);
+
+        if(report) {
+            rv_mqtt_publish_jsonrpc(mqtt_handle, "ptp/clock/telemetry", "servoTelemetry", report, NULL);
+            json_decref(report);
+        }
+    }
+}
+
+// deferred and periodic publications, the main loop publishes changes at once
 static void regular_publisher(uv_timer_t *timer) {
     LinuxPtpClock *linuxptp = (LinuxPtpClock*)timer->data;
+    RvPtpClockState clock_state;
+    int64_t value;
+
+    // clock_state is owned by the main loop, work on a consistent copy
+    rv_ptp_snapshot_read(&linuxptp->clock_snapshot, &clock_state);
     
-    publish_ptp_offset(&linuxptp->mqtt_handle, &linuxptp->clock_state);
+    if(rv_ptp_policy_tick(&linuxptp->offset_policy, &value)) {
+        publish_ptp_offset(&linuxptp->mqtt_handle, &clock_state, value);
+    }
     
     // run through ports and publish path path_delay
-    for(unsigned idx = 0; idx < linuxptp->clock_state.port_count; ++idx) {
-        publish_ptp_path_delay(&linuxptp->mqtt_handle, &linuxptp->clock_state.port[idx]);
+    for(unsigned idx = 0; idx < clock_state.port_count; ++idx) {
+        if(rv_ptp_policy_tick(&linuxptp->path_delay_policy[idx], &value)) {
+            publish_ptp_path_delay(&linuxptp->mqtt_handle, &clock_state.port[idx], value);
+        }
+    }
+
+    publish_ptp_telemetry(&linuxptp->mqtt_handle, &linuxptp->telemetry);
+}
+
+static void policies_init(LinuxPtpClock *linuxptp) {
+    struct config *cfg = clock_config(linuxptp->clock_handle);
+
+    rv_ptp_policy_init(&linuxptp->offset_policy,
+                       config_get_int(cfg, NULL, "mqtt_offset_deadband"),
+                       config_get_int(cfg, NULL, "mqtt_offset_min_interval"),
+                       config_get_int(cfg, NULL, "mqtt_offset_max_interval"),
+                       config_get_int(cfg, NULL, "mqtt_offset_aggregate"));
+
+    for(unsigned idx = 0; idx < RV_PTP_MAX_PORTS; ++idx) {
+        rv_ptp_policy_init(&linuxptp->path_delay_policy[idx],
+                           config_get_int(cfg, NULL, "mqtt_path_delay_deadband"),
+                           config_get_int(cfg, NULL, "mqtt_path_delay_min_interval"),
+                           config_get_int(cfg, NULL, "mqtt_path_delay_max_interval"),
+                           config_get_int(cfg, NULL, "mqtt_path_delay_aggregate"));
     }
 }
 
+static int telemetry_init(LinuxPtpClock *linuxptp) {
+    struct telemetry *ring = clock_telemetry(linuxptp->clock_handle);
+    int window = config_get_int(clock_config(linuxptp->clock_handle), NULL, "mqtt_telemetry_window");
+
+    if(!ring || !window) {
+        // disabled, drain() finds no ring
+        memset(&linuxptp->telemetry, 0, sizeof(RvPtpTelemetry));
+        return 0;
+    }
+
+    return rv_ptp_telemetry_init(&linuxptp->telemetry, ring, window);
+}
+
 static void timer_thread_fn(void *arg) {
     LinuxPtpClock *linuxptp = (LinuxPtpClock*)arg;
 
@@ -162,7 +249,7 @@ static void timer_thread_fn(void *arg) {
     uv_loop_init(&timer_thread_loop);
     
     uv_timer_init(&timer_thread_loop, &linuxptp->publish_timer);
-    uv_timer_start(&linuxptp->publish_timer, regular_publisher, 1000, 1000);
+    uv_timer_start(&linuxptp->publish_timer, regular_publisher, RV_PTP_POLICY_TICK, RV_PTP_POLICY_TICK);
     linuxptp->publish_timer.data = linuxptp;
     
     uv_run(&timer_thread_loop, UV_RUN_DEFAULT);
@@ -176,6 +263,8 @@ void rv_ptp_mqtt_exit(LinuxPtpClock *linuxptp) {
     uv_close((uv_handle_t*)&linuxptp->publish_timer, 0);
     
     uv_thread_join(&linuxptp->timer_thread);
+
+    rv_ptp_telemetry_destroy(&linuxptp->telemetry);
     
     memset(&linuxptp->clock_state, 0, sizeof(struct rv_ptpclock_t));
 
@@ -185,12 +274,20 @@ void rv_ptp_mqtt_exit(LinuxPtpClock *linuxptp) {
 
 int rv_ptp_mqtt_init(LinuxPtpClock *linuxptp, char *client_id) {
     memset(&linuxptp->clock_state, 0, sizeof(struct rv_ptpclock_t));
+
+    policies_init(linuxptp);
+
+    if(telemetry_init(linuxptp) < 0) {
+        pr_err("failed to allocate the telemetry window");
+        return -1;
+    }
     
     if(!rv_mqtt_ctor(&linuxptp->mqtt_handle, client_id, "1.8.0", RV_MQTT_DEFAULT_BROKER_ADDR, RV_MQTT_DEFAULT_BROKER_PORT)) {
+        rv_ptp_telemetry_destroy(&linuxptp->telemetry);
         return -1;
     }
     
-    // start thread for frequent offset and path_delay messages here (1 per second)
+    // start thread for deferred and periodic offset and path_delay messages here
     if(uv_thread_create(&linuxptp->timer_thread, timer_thread_fn, linuxptp) < 0) {
         // thread start failed
         rv_ptp_mqtt_exit(linuxptp);
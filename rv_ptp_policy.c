@@ -0,0 +1,227 @@
+/**
+ * @file rv_ptp_policy.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rv_ptp_policy.h"
+#include "uv.h"
+
+#include <sched.h>
+#include <string.h>
+
+#define NSEC_PER_MSEC 1000000
+
+static uint64_t now_msec(void) {
+    return uv_hrtime() / NSEC_PER_MSEC;
+}
+
+// value which represents the window, the last sample if the window is empty
+static int64_t window_value(RvPtpPolicy *self) {
+    if(!self->count) {
+        return self->published ? self->value : self->last;
+    }
+
+    switch(self->aggregate) {
+        case eRvPtpAggregateMean:
+            return self->sum / (int64_t)self->count;
+        case eRvPtpAggregateMin:
+            return self->min;
+        case eRvPtpAggregateMax:
+            return self->max;
+        case eRvPtpAggregateLast:
+        default:
+            return self->last;
+    }
+}
+
+// the sample moved at least one deadband away from the last published value
+static bool leaves_deadband(RvPtpPolicy *self, int64_t sample) {
+    uint64_t distance;
+
+    if(!self->published) {
+        return true;
+    }
+    if(!self->deadband) {
+        return sample != self->value;
+    }
+    // unsigned, so that the distance of extreme values does not overflow
+    distance = (sample > self->value) ? (uint64_t)sample - (uint64_t)self->value
+                                      : (uint64_t)self->value - (uint64_t)sample;
+    return distance >= (uint64_t)self->deadband;
+}
+
+static void publish(RvPtpPolicy *self, uint64_t now, int64_t *value) {
+    *value = window_value(self);
+
+    self->value = *value;
+    self->published = true;
+    self->published_at = now;
+    self->pending = false;
+
+    self->count = 0;
+    self->sum = 0;
+}
+
+// take over a publication of the timer thread, skipped if it is just writing
+static void apply_tick(RvPtpPolicy *self) {
+    unsigned int begin = __atomic_load_n(&self->tick_sequence, __ATOMIC_ACQUIRE);
+    RvPtpPolicyTick tick;
+
+    if((begin == self->tick_seen) || (begin & 1)) {
+        return;
+    }
+
+    memcpy(&tick, &self->tick, sizeof(RvPtpPolicyTick));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&self->tick_sequence, __ATOMIC_RELAXED) != begin) {
+        return;
+    }
+    self->tick_seen = begin;
+
+    self->value = tick.value;
+    self->published = true;
+    if(tick.published_at > self->published_at) {
+        self->published_at = tick.published_at;
+    }
+    self->pending = false;
+
+    // samples which came in meanwhile stay in the window
+    if(tick.generation == self->generation) {
+        self->count = 0;
+        self->sum = 0;
+    }
+}
+
+static void write_window(RvPtpPolicy *self) {
+    unsigned int sequence = self->window_sequence;
+
+    __atomic_store_n(&self->window_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    self->window.generation = self->generation;
+    self->window.value = window_value(self);
+    self->window.pending = self->pending;
+    self->window.published = self->published;
+    self->window.published_at = self->published_at;
+
+    __atomic_store_n(&self->window_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void read_window(RvPtpPolicy *self, RvPtpPolicyWindow *window) {
+    unsigned int begin;
+
+    for(;;) {
+        begin = __atomic_load_n(&self->window_sequence, __ATOMIC_ACQUIRE);
+        if(begin & 1) {
+            // the main loop is busy, it will be done shortly
+            sched_yield();
+            continue;
+        }
+
+        memcpy(window, &self->window, sizeof(RvPtpPolicyWindow));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&self->window_sequence, __ATOMIC_RELAXED) == begin) {
+            return;
+        }
+    }
+}
+
+static void write_tick(RvPtpPolicy *self, const RvPtpPolicyTick *tick) {
+    unsigned int sequence = self->tick_sequence;
+
+    __atomic_store_n(&self->tick_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(&self->tick, tick, sizeof(RvPtpPolicyTick));
+
+    __atomic_store_n(&self->tick_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+void rv_ptp_policy_init(RvPtpPolicy *self, int64_t deadband, int min_interval, int max_interval, RvPtpAggregate aggregate) {
+    memset(self, 0, sizeof(RvPtpPolicy));
+
+    self->deadband = deadband;
+    self->min_interval = min_interval;
+    self->max_interval = max_interval;
+    self->aggregate = aggregate;
+}
+
+bool rv_ptp_policy_sample(RvPtpPolicy *self, int64_t sample, int64_t *value) {
+    uint64_t now = now_msec();
+    bool due = false;
+
+    apply_tick(self);
+
+    if(leaves_deadband(self, sample)) {
+        self->pending = true;
+    }
+
+    if(!self->count || sample < self->min) {
+        self->min = sample;
+    }
+    if(!self->count || sample > self->max) {
+        self->max = sample;
+    }
+    self->sum += sample;
+    self->last = sample;
+    ++self->count;
+    ++self->generation;
+
+    if(self->pending && (!self->published || now - self->published_at >= self->min_interval)) {
+        publish(self, now, value);
+        due = true;
+    }
+
+    write_window(self);
+
+    return due;
+}
+
+bool rv_ptp_policy_tick(RvPtpPolicy *self, int64_t *value) {
+    uint64_t now = now_msec();
+    RvPtpPolicyWindow window;
+    RvPtpPolicyTick tick;
+    uint64_t elapsed;
+    bool pending;
+
+    read_window(self, &window);
+    if(!window.published) {
+        return false;
+    }
+
+    // the main loop may not have seen our last publication yet
+    elapsed = now - window.published_at;
+    if(self->tick.published_at > window.published_at) {
+        elapsed = now - self->tick.published_at;
+    }
+    pending = window.pending && (window.generation != self->tick.generation);
+
+    if(!(pending && elapsed >= self->min_interval) &&
+       !(self->max_interval && elapsed >= self->max_interval)) {
+        return false;
+    }
+
+    tick.generation = window.generation;
+    tick.value = window.value;
+    tick.published_at = now;
+    write_tick(self, &tick);
+
+    *value = tick.value;
+    return true;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file rv_ptp_policy.h
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+/**
+ * \addtogroup rvutil
+ * @{
+ * \file rv_ptp_policy.h
+ * \brief Decides when a metric is published and which value goes out
+ *
+ * The main loop feeds every new sample. A sample which differs by at least
+ * the deadband from the last published value is published at once, unless
+ * the last publication is younger than the minimum interval; then it goes
+ * out with the next tick after the minimum interval. The timer thread ticks the
+ * policy and republishes once the maximum interval passed without any
+ * publication. The published value aggregates all samples since the last
+ * publication.
+ *
+ * Neither side blocks. The main loop owns the samples and hands the state
+ * of the window to the timer thread through a seqlock, the timer thread
+ * reports its publications back through another one. A window which got
+ * new samples while the timer thread published it is kept, so that on
+ * this rare race a few samples count towards the next publication as well.
+ */
+
+#include "rv_ptp_ifc.h"
+
+#define RV_PTP_POLICY_TICK 100  //!< ms, granularity of deferred and periodic publications
+
+// state of the window as seen by the timer thread
+typedef struct rv_ptp_policy_window_t {
+    uint64_t generation;        //!< number of samples so far
+    int64_t value;              //!< value a publication would send now
+    bool pending;               //!< deadband was left during the minimum interval
+    bool published;             //!< 'published_at' is valid
+    uint64_t published_at;      //!< ms, uv_hrtime() based
+} RvPtpPolicyWindow;
+
+// publication of the timer thread as seen by the main loop
+typedef struct rv_ptp_policy_tick_t {
+    uint64_t generation;        //!< the window which was published
+    int64_t value;
+    uint64_t published_at;      //!< ms, uv_hrtime() based
+} RvPtpPolicyTick;
+
+typedef struct rv_ptp_policy_t {
+    // configuration
+    int64_t deadband;           //!< ns, change against the published value which triggers a publication
+    uint64_t min_interval;      //!< ms between two publications at least
+    uint64_t max_interval;      //!< ms between two publications at most, 0 for no limit
+    RvPtpAggregate aggregate;
+
+    // samples since the last publication, owned by the main loop
+    uint64_t generation;
+    unsigned count;
+    int64_t sum;
+    int64_t min;
+    int64_t max;
+    int64_t last;
+
+    bool pending;               //!< deadband was left during the minimum interval
+    bool published;             //!< 'value' and 'published_at' are valid
+    int64_t value;              //!< last published value
+    uint64_t published_at;      //!< ms, uv_hrtime() based
+    unsigned int tick_seen;     //!< 'tick_sequence' of the last applied tick
+
+    // written by the main loop only, odd 'window_sequence' while in progress
+    unsigned int window_sequence;
+    RvPtpPolicyWindow window;
+
+    // written by the timer thread only, odd 'tick_sequence' while in progress
+    unsigned int tick_sequence;
+    RvPtpPolicyTick tick;
+} RvPtpPolicy;
+
+extern void rv_ptp_policy_init(RvPtpPolicy *self, int64_t deadband, int min_interval, int max_interval, RvPtpAggregate aggregate);
+
+/**
+ * Add a new sample. Must only be called from the main loop.
+ *
+ * @return true if 'value' shall be published now
+ */
+extern bool rv_ptp_policy_sample(RvPtpPolicy *self, int64_t sample, int64_t *value);
+
+/**
+ * Check for a deferred or a periodic publication. Must only be called
+ * from the timer thread.
+ *
+ * @return true if 'value' shall be published now
+ */
+extern bool rv_ptp_policy_tick(RvPtpPolicy *self, int64_t *value);
+
+/** @} */
@@ -0,0 +1,56 @@
+/**
+ * @file rv_ptp_snapshot.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rv_ptp_snapshot.h"
+
+#include <sched.h>
+#include <string.h>
+
+void rv_ptp_snapshot_write(RvPtpSnapshot *self, const RvPtpClockState *state) {
+    unsigned int sequence = __atomic_load_n(&self->sequence, __ATOMIC_RELAXED);
+
+    // mark the write as in progress before touching the data
+    __atomic_store_n(&self->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(&self->state, state, sizeof(RvPtpClockState));
+
+    __atomic_store_n(&self->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+unsigned int rv_ptp_snapshot_read(RvPtpSnapshot *self, RvPtpClockState *state) {
+    unsigned int begin, end;
+
+    for(;;) {
+        begin = __atomic_load_n(&self->sequence, __ATOMIC_ACQUIRE);
+        if(begin & 1) {
+            // writer is busy, it will be done shortly
+            sched_yield();
+            continue;
+        }
+
+        memcpy(state, &self->state, sizeof(RvPtpClockState));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&self->sequence, __ATOMIC_RELAXED);
+        if(begin == end) {
+            return begin;
+        }
+    }
+}
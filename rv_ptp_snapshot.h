@@ -0,0 +1,50 @@
+/**
+ * @file rv_ptp_snapshot.h
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+/**
+ * \addtogroup rvutil
+ * @{
+ * \file rv_ptp_snapshot.h
+ * \brief Consistent copy of the clock state for other threads
+ *
+ * The main loop is the only writer. It never blocks; a reader which
+ * overlaps with a write simply copies the state again.
+ */
+
+#include "rv_ptp_ifc.h"
+
+typedef struct rv_ptp_snapshot_t {
+    unsigned int sequence;      //!< odd while a write is in progress
+    RvPtpClockState state;
+} RvPtpSnapshot;
+
+/**
+ * Publish a new clock state. Must only be called from a single thread.
+ */
+extern void rv_ptp_snapshot_write(RvPtpSnapshot *self, const RvPtpClockState *state);
+
+/**
+ * Copy the last published clock state to 'state'.
+ *
+ * @return the generation of the copied state, which grows by two per write
+ */
+extern unsigned int rv_ptp_snapshot_read(RvPtpSnapshot *self, RvPtpClockState *state);
+
+/** @} */
@@ -0,0 +1,219 @@
+/**
+ * @file rv_ptp_telemetry.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rv_ptp_telemetry.h"
+#include "servo.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_SEC 1e9
+
+int rv_ptp_telemetry_init(RvPtpTelemetry *self, struct telemetry *ring, unsigned window) {
+    memset(self, 0, sizeof(RvPtpTelemetry));
+
+    self->ring = ring;
+    self->window = window;
+
+    self->samples = calloc(window, sizeof(struct telemetry_sample));
+    self->values = calloc(window + 1, sizeof(double));
+    self->deque = calloc(2 * window, sizeof(unsigned));
+    if(!self->samples || !self->values || !self->deque) {
+        rv_ptp_telemetry_destroy(self);
+        return -1;
+    }
+
+    return 0;
+}
+
+void rv_ptp_telemetry_destroy(RvPtpTelemetry *self) {
+    free(self->samples);
+    free(self->values);
+    free(self->deque);
+
+    memset(self, 0, sizeof(RvPtpTelemetry));
+}
+
+bool rv_ptp_telemetry_drain(RvPtpTelemetry *self) {
+    if(!self->ring) {
+        return false;
+    }
+
+    self->count += telemetry_pop(self->ring, &self->samples[self->count], self->window - self->count);
+
+    return self->count == self->window;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// nearest rank percentiles of the sorted values
+static json_t *percentiles(const double *sorted, unsigned n) {
+    json_t *result = json_object();
+    unsigned p50  = (unsigned)ceil(0.5   * n) - 1;
+    unsigned p99  = (unsigned)ceil(0.99  * n) - 1;
+    unsigned p999 = (unsigned)ceil(0.999 * n) - 1;
+
+    json_object_set_new(result, "p50",  json_integer((json_int_t)sorted[p50]));
+    json_object_set_new(result, "p99",  json_integer((json_int_t)sorted[p99]));
+    json_object_set_new(result, "p999", json_integer((json_int_t)sorted[p999]));
+    json_object_set_new(result, "max",  json_integer((json_int_t)sorted[n - 1]));
+
+    return result;
+}
+
+// overlapping Allan deviation from the time error x in ns, at tau = m * tau0
+static double adev(const struct telemetry_sample *x, unsigned n, unsigned m, double tau0) {
+    double sum = 0.0, tau = m * tau0;
+
+    for(unsigned i = 0; i + 2 * m < n; ++i) {
+        double d = (double)(x[i + 2 * m].offset - 2 * x[i + m].offset + x[i].offset) / NSEC_PER_SEC;
+        sum += d * d;
+    }
+
+    return sqrt(sum / (2.0 * tau * tau * (n - 2 * m)));
+}
+
+// time deviation in ns at tau = m * tau0, 'prefix' holds the prefix sums of x
+static double tdev(const double *prefix, unsigned n, unsigned m) {
+    double sum = 0.0;
+
+    for(unsigned j = 0; j + 3 * m <= n; ++j) {
+        double d = (prefix[j + 3 * m] - prefix[j + 2 * m])
+                 - 2.0 * (prefix[j + 2 * m] - prefix[j + m])
+                 + (prefix[j + m] - prefix[j]);
+        sum += d * d;
+    }
+
+    return sqrt(sum / (6.0 * m * m * (n - 3 * m + 1)));
+}
+
+// maximum time interval error in ns over all windows of m + 1 samples,
+// sliding window minimum and maximum keep this linear in n
+static int64_t mtie(const struct telemetry_sample *x, unsigned n, unsigned m, unsigned *deque) {
+    unsigned *lo = deque, *hi = deque + n;
+    unsigned lo_head = 0, lo_tail = 0, hi_head = 0, hi_tail = 0;
+    int64_t result = 0;
+
+    for(unsigned i = 0; i < n; ++i) {
+        while(lo_tail > lo_head && x[lo[lo_tail - 1]].offset >= x[i].offset) {
+            --lo_tail;
+        }
+        lo[lo_tail++] = i;
+        while(hi_tail > hi_head && x[hi[hi_tail - 1]].offset <= x[i].offset) {
+            --hi_tail;
+        }
+        hi[hi_tail++] = i;
+
+        if(i < m) {
+            continue;
+        }
+        if(lo[lo_head] + m < i) {
+            ++lo_head;
+        }
+        if(hi[hi_head] + m < i) {
+            ++hi_head;
+        }
+        if(x[hi[hi_head]].offset - x[lo[lo_head]].offset > result) {
+            result = x[hi[hi_head]].offset - x[lo[lo_head]].offset;
+        }
+    }
+
+    return result;
+}
+
+json_t *rv_ptp_telemetry_report(RvPtpTelemetry *self) {
+    const struct telemetry_sample *x = self->samples;
+    unsigned n = self->count;
+    unsigned long dropped = telemetry_dropped(self->ring);
+    double tau0, freq_min, freq_max, freq_sum = 0.0;
+    unsigned unlocked = 0;
+    json_t *report, *freq, *taus;
+
+    // a full window is always consumed, or drain() would never end
+    self->count = 0;
+    if(n < 2) {
+        return NULL;
+    }
+
+    report = json_object();
+    json_object_set_new(report, "samples", json_integer(n));
+    json_object_set_new(report, "dropped", json_integer(dropped - self->dropped));
+    self->dropped = dropped;
+
+    tau0 = (double)(x[n - 1].ingress - x[0].ingress) / (n - 1) / NSEC_PER_SEC;
+    json_object_set_new(report, "tau0_sec", json_real(tau0));
+
+    freq_min = freq_max = x[0].freq;
+    for(unsigned i = 0; i < n; ++i) {
+        freq_min = x[i].freq < freq_min ? x[i].freq : freq_min;
+        freq_max = x[i].freq > freq_max ? x[i].freq : freq_max;
+        freq_sum += x[i].freq;
+        if(x[i].state != SERVO_LOCKED) {
+            ++unlocked;
+        }
+    }
+    freq = json_object();
+    json_object_set_new(freq, "min", json_real(freq_min));
+    json_object_set_new(freq, "max", json_real(freq_max));
+    json_object_set_new(freq, "mean", json_real(freq_sum / n));
+    json_object_set_new(report, "freq_ppb", freq);
+    json_object_set_new(report, "unlocked_samples", json_integer(unlocked));
+
+    for(unsigned i = 0; i < n; ++i) {
+        self->values[i] = llabs(x[i].offset);
+    }
+    qsort(self->values, n, sizeof(double), cmp_double);
+    json_object_set_new(report, "offset_abs_nsec", percentiles(self->values, n));
+
+    for(unsigned i = 0; i < n; ++i) {
+        self->values[i] = x[i].path_delay;
+    }
+    qsort(self->values, n, sizeof(double), cmp_double);
+    json_object_set_new(report, "path_delay_nsec", percentiles(self->values, n));
+
+    // prefix sums of the offset for TDEV
+    self->values[0] = 0.0;
+    for(unsigned i = 0; i < n; ++i) {
+        self->values[i + 1] = self->values[i] + x[i].offset;
+    }
+
+    // octave spaced observation intervals
+    taus = json_array();
+    for(unsigned m = 1; tau0 > 0.0 && m < n; m *= 2) {
+        json_t *tau = json_object();
+
+        json_object_set_new(tau, "tau_sec", json_real(m * tau0));
+        json_object_set_new(tau, "mtie_nsec", json_integer(mtie(x, n, m, self->deque)));
+        if(2 * m < n) {
+            json_object_set_new(tau, "adev", json_real(adev(x, n, m, tau0)));
+        }
+        if(3 * m <= n) {
+            json_object_set_new(tau, "tdev_nsec", json_real(tdev(self->values, n, m)));
+        }
+        json_array_append_new(taus, tau);
+    }
+    json_object_set_new(report, "tau", taus);
+
+    return report;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file rv_ptp_telemetry.h
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+/**
+ * \addtogroup rvutil
+ * @{
+ * \file rv_ptp_telemetry.h
+ * \brief Windowed statistics over the servo samples of the clock
+ *
+ * Runs in the publisher thread. Drains the telemetry ring the clock fills
+ * on each servo sample, and summarizes each window of samples with
+ * percentiles, Allan deviation, TDEV and MTIE of the offset from master.
+ * ADEV, TDEV and MTIE assume the samples are evenly spaced, which is true
+ * as long as the sync interval does not change within a window.
+ */
+
+#include "telemetry.h"
+
+#include <jansson.h>
+#include <stdbool.h>
+
+typedef struct rv_ptp_telemetry_t {
+    struct telemetry *ring;             //!< owned by the clock
+    unsigned window;                    //!< samples per report
+    unsigned count;                     //!< samples collected for the current report
+    unsigned long dropped;              //!< ring overruns at the last report
+
+    struct telemetry_sample *samples;
+    double *values;                     //!< scratch for sorting and prefix sums
+    unsigned *deque;                    //!< scratch for the MTIE sliding window
+} RvPtpTelemetry;
+
+extern int rv_ptp_telemetry_init(RvPtpTelemetry *self, struct telemetry *ring, unsigned window);
+extern void rv_ptp_telemetry_destroy(RvPtpTelemetry *self);
+
+/**
+ * Move samples from the ring into the current window.
+ *
+ * @return true if the window is complete and a report is due
+ */
+extern bool rv_ptp_telemetry_drain(RvPtpTelemetry *self);
+
+/**
+ * Summarize the complete window and start a new one.
+ *
+ * @return new JSON object, to be released by the caller, or NULL if the
+ *         window is too short for any statistics
+ */
+extern json_t *rv_ptp_telemetry_report(RvPtpTelemetry *self);
+
+/** @} */
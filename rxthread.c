@@ -0,0 +1,475 @@
+/**
+ * @file rxthread.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "print.h"
+#include "rxthread.h"
+
+/* Bounds of the messages handed to a worker at a time, per queue. */
+#define RXQ_MIN_LENGTH 4
+#define RXQ_MAX_LENGTH 32
+#define RXTHREAD_EVENTS 16
+
+struct rxthread {
+	pthread_t thread;
+	int epoll_fd;
+	int stop_fd;
+	int stop;
+	/* Held by the worker while it services the queues. */
+	pthread_mutex_t lock;
+};
+
+struct rxq_src {
+	struct rxq *q;
+	int fd; /* -1 while detached, changed under the thread's lock */
+};
+
+struct rxq_entry {
+	struct ptp_message *msg;
+	int cnt;
+	int err;
+};
+
+/* The event and general descriptors, and the wake up of the worker. */
+enum { RXQ_SRC_WAKE = 2, RXQ_N_SRC };
+
+struct rxq {
+	struct rxthread *t;
+	struct transport *trp;
+	enum timestamp_type type;
+	int fd;
+	int wake_fd;
+	struct rxq_src src[RXQ_N_SRC];
+	int length; /* of the rings, a power of two */
+	unsigned int mask;
+
+	/* Used by the worker only. */
+	struct ptp_message *stash[TRANSPORT_RECV_BATCH];
+	int nstash;
+
+	/* Used by the clock thread only. */
+	int owned;
+
+	/* Set by the worker when it waits for empty messages. */
+	int starved;
+
+	/* Received messages, the worker produces. */
+	unsigned int rx_head __attribute__((aligned(64)));
+	unsigned int rx_tail __attribute__((aligned(64)));
+	struct rxq_entry *rx;
+
+	/* Empty messages, the clock thread produces. */
+	unsigned int free_head __attribute__((aligned(64)));
+	unsigned int free_tail __attribute__((aligned(64)));
+	struct ptp_message **free;
+};
+
+static void rxq_notify(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		pr_err("write on eventfd failed: %m");
+}
+
+static void rxq_clear(int fd)
+{
+	uint64_t val;
+
+	if (read(fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		pr_err("read on eventfd failed: %m");
+}
+
+/* Called by the clock thread. */
+static int rxq_pop(struct rxq *q, struct ptp_message *msg[], int cnt[],
+		   int err[], int n)
+{
+	unsigned int head, tail = q->rx_tail;
+	int i;
+
+	head = __atomic_load_n(&q->rx_head, __ATOMIC_ACQUIRE);
+	for (i = 0; i < n && tail != head; i++, tail++) {
+		msg[i] = q->rx[tail & q->mask].msg;
+		cnt[i] = q->rx[tail & q->mask].cnt;
+		err[i] = q->rx[tail & q->mask].err;
+	}
+	__atomic_store_n(&q->rx_tail, tail, __ATOMIC_RELEASE);
+	q->owned -= i;
+	return i;
+}
+
+/* Called by the worker, collects the empty messages handed over. */
+static void rxq_collect(struct rxq *q)
+{
+	unsigned int head, tail = q->free_tail;
+
+	head = __atomic_load_n(&q->free_head, __ATOMIC_ACQUIRE);
+	while (q->nstash < TRANSPORT_RECV_BATCH && tail != head)
+		q->stash[q->nstash++] = q->free[tail++ & q->mask];
+	__atomic_store_n(&q->free_tail, tail, __ATOMIC_RELEASE);
+}
+
+/* Called by the worker, with the thread's lock held. */
+static void rxq_service(struct rxq_src *src)
+{
+	struct rxq *q = src->q;
+	unsigned int head;
+	int cnt[TRANSPORT_RECV_BATCH], err = 0, i, n, res, pushed = 0;
+
+	while (!err) {
+		/*
+		 * The queue can not fill up, since the clock thread never
+		 * hands out more messages than it holds. Without at least
+		 * two messages transport_recv_batch() would block, so the
+		 * clock thread is behind. The messages wait in the socket
+		 * until it hands over more and wakes the worker up, rather
+		 * than being dropped here.
+		 */
+		rxq_collect(q);
+		if (q->nstash < 2) {
+			__atomic_store_n(&q->starved, 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			rxq_collect(q);
+			if (q->nstash < 2)
+				break;
+			__atomic_store_n(&q->starved, 0, __ATOMIC_RELAXED);
+		}
+
+		n = q->nstash;
+		res = transport_recv_batch(q->trp, src->fd, q->stash, cnt, n);
+		if (res < 0) {
+			/* Let the clock thread see the failure. */
+			cnt[0] = -1;
+			res = 1;
+			err = 1;
+		}
+		head = q->rx_head;
+		for (i = 0; i < res; i++, head++) {
+			q->rx[head & q->mask].msg = q->stash[i];
+			q->rx[head & q->mask].cnt = cnt[i];
+			q->rx[head & q->mask].err = cnt[i] > 0 ?
+				msg_post_recv(q->stash[i], cnt[i]) : 0;
+		}
+		__atomic_store_n(&q->rx_head, head, __ATOMIC_RELEASE);
+		q->nstash -= res;
+		memmove(q->stash, q->stash + res, q->nstash * sizeof(q->stash[0]));
+		pushed += res;
+
+		/* The descriptor is edge triggered, so read until it is empty. */
+		if (res < n)
+			break;
+	}
+	if (pushed)
+		rxq_notify(q->fd);
+}
+
+/* Called by the worker, with the thread's lock held. */
+static void rxq_wake(struct rxq *q)
+{
+	int i;
+
+	rxq_clear(q->wake_fd);
+	for (i = 0; i < RXQ_SRC_WAKE; i++) {
+		if (q->src[i].fd >= 0)
+			rxq_service(&q->src[i]);
+	}
+}
+
+static void *rxthread_run(void *arg)
+{
+	struct epoll_event ev[RXTHREAD_EVENTS];
+	struct rxthread *t = arg;
+	struct rxq_src *src;
+	int cnt, i;
+
+	while (1) {
+		cnt = epoll_wait(t->epoll_fd, ev, RXTHREAD_EVENTS, -1);
+		if (cnt < 0) {
+			if (EINTR == errno)
+				continue;
+			pr_emerg("receive thread: epoll_wait failed: %m");
+			break;
+		}
+		pthread_mutex_lock(&t->lock);
+		if (t->stop) {
+			pthread_mutex_unlock(&t->lock);
+			break;
+		}
+		for (i = 0; i < cnt; i++) {
+			src = ev[i].data.ptr;
+			/* Skip descriptors detached since epoll_wait(). */
+			if (!src || src->fd < 0)
+				continue;
+			if (src == &src->q->src[RXQ_SRC_WAKE])
+				rxq_wake(src->q);
+			else
+				rxq_service(src);
+		}
+		pthread_mutex_unlock(&t->lock);
+	}
+	return NULL;
+}
+
+struct rxthread *rxthread_create(int cpu)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL,
+	};
+	struct rxthread *t;
+	sigset_t all, old;
+	cpu_set_t set;
+	int err;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+	t->stop_fd = -1;
+	pthread_mutex_init(&t->lock, NULL);
+
+	t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (t->epoll_fd < 0) {
+		pr_err("failed to create epoll instance: %m");
+		goto no_epoll;
+	}
+	t->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (t->stop_fd < 0 ||
+	    epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->stop_fd, &ev)) {
+		pr_err("failed to create eventfd: %m");
+		goto no_stop;
+	}
+
+	/* Signals are for the clock thread to handle. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&t->thread, NULL, rxthread_run, t);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		pr_err("failed to start receive thread: %s", strerror(err));
+		goto no_stop;
+	}
+
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		err = pthread_setaffinity_np(t->thread, sizeof(set), &set);
+		if (err)
+			pr_warning("failed to bind receive thread to cpu %d: %s",
+				   cpu, strerror(err));
+	}
+	return t;
+
+no_stop:
+	if (t->stop_fd >= 0)
+		close(t->stop_fd);
+	close(t->epoll_fd);
+no_epoll:
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+	return NULL;
+}
+
+void rxthread_destroy(struct rxthread *t)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&t->lock);
+	t->stop = 1;
+	pthread_mutex_unlock(&t->lock);
+	if (write(t->stop_fd, &one, sizeof(one)) < 0)
+		pr_err("write on eventfd failed: %m");
+	pthread_join(t->thread, NULL);
+
+	close(t->stop_fd);
+	close(t->epoll_fd);
+	pthread_mutex_destroy(&t->lock);
+	free(t);
+}
+
+/* Called by the clock thread. */
+static void rxq_refill(struct rxq *q)
+{
+	struct ptp_message *msg;
+	unsigned int head = q->free_head;
+
+	while (q->owned < q->length) {
+		msg = msg_allocate();
+		if (!msg)
+			break;
+		msg->hwts.type = q->type;
+		q->free[head++ & q->mask] = msg;
+		q->owned++;
+	}
+	__atomic_store_n(&q->free_head, head, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence of the worker in rxq_service(). */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&q->starved, 0, __ATOMIC_RELAXED))
+		rxq_notify(q->wake_fd);
+}
+
+struct rxq *rxq_create(struct rxthread *t, struct transport *trp,
+		       enum timestamp_type type, int length)
+{
+	struct rxq *q;
+	int i;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+	q->rx = calloc(length, sizeof(*q->rx));
+	q->free = calloc(length, sizeof(*q->free));
+	if (!q->rx || !q->free) {
+		free(q->rx);
+		free(q->free);
+		free(q);
+		return NULL;
+	}
+	q->length = length;
+	q->mask = length - 1;
+	q->t = t;
+	q->trp = trp;
+	q->type = type;
+	for (i = 0; i < RXQ_N_SRC; i++) {
+		q->src[i].q = q;
+		q->src[i].fd = -1;
+	}
+
+	q->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	q->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (q->fd < 0 || q->wake_fd < 0) {
+		pr_err("failed to create eventfd: %m");
+		if (q->fd >= 0)
+			close(q->fd);
+		free(q->rx);
+		free(q->free);
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+void rxq_destroy(struct rxq *q)
+{
+	int i;
+
+	rxq_detach(q);
+	for (i = 0; i < q->nstash; i++)
+		msg_put(q->stash[i]);
+	while (q->free_tail != q->free_head)
+		msg_put(q->free[q->free_tail++ & q->mask]);
+	close(q->wake_fd);
+	close(q->fd);
+	free(q->rx);
+	free(q->free);
+	free(q);
+}
+
+int rxq_length(int pool_size, int nports)
+{
+	int length = RXQ_MAX_LENGTH;
+
+	if (!pool_size || nports < 1)
+		return length;
+	while (length > RXQ_MIN_LENGTH && 2 * length * nports > pool_size)
+		length /= 2;
+	return length;
+}
+
+int rxq_reserve(int length)
+{
+	return length;
+}
+
+int rxq_fd(struct rxq *q)
+{
+	return q->fd;
+}
+
+int rxq_attach(struct rxq *q, struct fdarray *fda)
+{
+	int fd[RXQ_N_SRC] = { fda->fd[FD_EVENT], fda->fd[FD_GENERAL], q->wake_fd };
+	struct epoll_event ev;
+	int i;
+
+	rxq_refill(q);
+
+	pthread_mutex_lock(&q->t->lock);
+	for (i = 0; i < RXQ_N_SRC; i++) {
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = &q->src[i];
+		if (epoll_ctl(q->t->epoll_fd, EPOLL_CTL_ADD, fd[i], &ev)) {
+			pr_err("failed to watch descriptor %d: %m", i);
+			break;
+		}
+		q->src[i].fd = fd[i];
+	}
+	pthread_mutex_unlock(&q->t->lock);
+
+	if (i < RXQ_N_SRC) {
+		rxq_detach(q);
+		return -1;
+	}
+	return 0;
+}
+
+void rxq_detach(struct rxq *q)
+{
+	struct ptp_message *msg[RXQ_MAX_LENGTH];
+	int cnt[RXQ_MAX_LENGTH], err[RXQ_MAX_LENGTH], i, n;
+
+	pthread_mutex_lock(&q->t->lock);
+	for (i = 0; i < RXQ_N_SRC; i++) {
+		if (q->src[i].fd < 0)
+			continue;
+		epoll_ctl(q->t->epoll_fd, EPOLL_CTL_DEL, q->src[i].fd, NULL);
+		q->src[i].fd = -1;
+	}
+	q->starved = 0;
+	pthread_mutex_unlock(&q->t->lock);
+
+	rxq_clear(q->fd);
+	rxq_clear(q->wake_fd);
+	n = rxq_pop(q, msg, cnt, err, q->length);
+	for (i = 0; i < n; i++)
+		msg_put(msg[i]);
+}
+
+int rxq_recv(struct rxq *q, struct ptp_message *msg[], int cnt[], int err[],
+	     int n)
+{
+	/* Clear the notification before looking at the ring. */
+	rxq_clear(q->fd);
+	n = rxq_pop(q, msg, cnt, err, n);
+
+	/* Come back for the rest after the other ports had their turn. */
+	if (q->rx_tail != __atomic_load_n(&q->rx_head, __ATOMIC_ACQUIRE))
+		rxq_notify(q->fd);
+
+	rxq_refill(q);
+	return n;
+}
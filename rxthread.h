@@ -0,0 +1,127 @@
+/**
+ * @file rxthread.h
+ * @brief Receive worker threads which hand messages to the clock thread.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_RXTHREAD_H
+#define HAVE_RXTHREAD_H
+
+#include "fd.h"
+#include "msg.h"
+#include "transport.h"
+
+/** Opaque type */
+struct rxthread;
+
+/** Opaque type */
+struct rxq;
+
+/**
+ * Choose the ring length of the receive queues, so that the rings leave
+ * at least half of the head room of the message pool to the messages in
+ * flight.
+ * @param pool_size  The head room of the message pool, zero if the pool
+ *                   is not preallocated.
+ * @param nports     The number of ports.
+ * @return           The ring length, a power of two.
+ */
+int rxq_length(int pool_size, int nports);
+
+/**
+ * Get the number of messages which a receive queue keeps for itself.
+ * @param length  The ring length, as returned by @ref rxq_length().
+ * @return        The number of messages.
+ */
+int rxq_reserve(int length);
+
+/**
+ * Start a receive worker thread.
+ * @param cpu  The CPU to run the thread on, or -1 for any CPU.
+ * @return     A pointer to a new thread on success, NULL otherwise.
+ */
+struct rxthread *rxthread_create(int cpu);
+
+/**
+ * Stop a receive worker thread. All of its queues must be destroyed.
+ * @param t  Pointer obtained via @ref rxthread_create().
+ */
+void rxthread_destroy(struct rxthread *t);
+
+/**
+ * Create the receive queue of a port, served by a worker thread.
+ *
+ * The worker receives and parses the messages of the attached
+ * descriptors, and passes them to the clock thread through a single
+ * producer, single consumer ring. The empty messages travel back the
+ * same way, so that only the clock thread uses the message pool. While
+ * the clock thread is behind, the messages wait in the socket until it
+ * hands empty ones back.
+ *
+ * @param t       The thread to serve the queue.
+ * @param trp     The transport of the port, which must support
+ *                transport_recv_batch().
+ * @param type    The time stamp type of the received messages.
+ * @param length  The ring length, as returned by @ref rxq_length().
+ * @return        A pointer to a new queue on success, NULL otherwise.
+ */
+struct rxq *rxq_create(struct rxthread *t, struct transport *trp,
+		       enum timestamp_type type, int length);
+
+/**
+ * Destroy a receive queue, releasing the messages it holds.
+ * @param q  Pointer obtained via @ref rxq_create().
+ */
+void rxq_destroy(struct rxq *q);
+
+/**
+ * Obtain the descriptor which becomes readable when messages are
+ * waiting in the queue.
+ * @param q  Pointer obtained via @ref rxq_create().
+ * @return   An eventfd owned by the queue.
+ */
+int rxq_fd(struct rxq *q);
+
+/**
+ * Let the worker receive on the event and general descriptors.
+ * @param q    Pointer obtained via @ref rxq_create().
+ * @param fda  The descriptors opened by transport_open().
+ * @return     Zero on success, non-zero otherwise.
+ */
+int rxq_attach(struct rxq *q, struct fdarray *fda);
+
+/**
+ * Stop the worker from using the descriptors, which may be closed once
+ * this returns. Messages still waiting in the queue are dropped.
+ * @param q  Pointer obtained via @ref rxq_create().
+ */
+void rxq_detach(struct rxq *q);
+
+/**
+ * Take received messages from the queue. Called by the clock thread.
+ * If more messages are waiting, the descriptor stays readable.
+ * @param q    Pointer obtained via @ref rxq_create().
+ * @param msg  Array to hold the messages, owned by the caller.
+ * @param cnt  Array to hold the message lengths, as returned by the
+ *             transport. The message is not parsed if this is not positive.
+ * @param err  Array to hold the results of msg_post_recv().
+ * @param n    Size of the arrays.
+ * @return     The number of messages taken.
+ */
+int rxq_recv(struct rxq *q, struct ptp_message *msg[], int cnt[], int err[],
+	     int n);
+
+#endif
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include "config.h"
+#include "kalman.h"
 #include "linreg.h"
 #include "ntpshm.h"
 #include "nullf.h"
@@ -48,6 +49,12 @@ struct servo *servo_create(struct config *cfg, enum servo_type type,
 	case CLOCK_SERVO_NULLF:
 		servo = nullf_servo_create();
 		break;
+	case CLOCK_SERVO_KALMAN:
+		servo = kalman_servo_create(cfg, fadj, sw_ts);
+		break;
+	case CLOCK_SERVO_NTPSOCK:
+		servo = ntpsock_servo_create(cfg);
+		break;
 	default:
 		return NULL;
 	}
@@ -124,3 +131,9 @@ void servo_leap(struct servo *servo, int leap)
 	if (servo->leap)
 		servo->leap(servo, leap);
 }
+
+void servo_offset_variance(struct servo *servo, double variance)
+{
+	if (servo->offset_variance)
+		servo->offset_variance(servo, variance);
+}
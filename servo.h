@@ -35,6 +35,8 @@ enum servo_type {
 	CLOCK_SERVO_LINREG,
 	CLOCK_SERVO_NTPSHM,
 	CLOCK_SERVO_NULLF,
+	CLOCK_SERVO_KALMAN,
+	CLOCK_SERVO_NTPSOCK,
 };
 
 /**
@@ -123,4 +125,12 @@ double servo_rate_ratio(struct servo *servo);
  */
 void servo_leap(struct servo *servo, int leap);
 
+/**
+ * Inform a clock servo about the noise of the offset measurements. Servos
+ * which do not model the noise ignore this.
+ * @param servo     Pointer to a servo obtained via @ref servo_create().
+ * @param variance  The variance of the offsets in ns^2, 0.0 if unknown.
+ */
+void servo_offset_variance(struct servo *servo, double variance);
+
 #endif
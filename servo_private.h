@@ -40,6 +40,8 @@ struct servo {
 	double (*rate_ratio)(struct servo *servo);
 
 	void (*leap)(struct servo *servo, int leap);
+
+	void (*offset_variance)(struct servo *servo, double variance);
 };
 
 #endif
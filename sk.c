@@ -39,6 +39,7 @@
 /* globals */
 
 int sk_tx_timeout = 1;
+int sk_tx_async = 1;
 int sk_check_fupsync;
 
 /* private methods */
@@ -232,17 +233,60 @@ int sk_interface_addr(const char *name, int family, struct address *addr)
 static short sk_events = POLLPRI;
 static short sk_revents = POLLPRI;
 
+static int sk_parse_cmsg(struct msghdr *msg, struct hw_timestamp *hwts)
+{
+	int level, type;
+	struct cmsghdr *cm;
+	struct timespec *sw, *ts = NULL;
+
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+		level = cm->cmsg_level;
+		type  = cm->cmsg_type;
+		if (SOL_SOCKET == level && SO_TIMESTAMPING == type) {
+			if (cm->cmsg_len < sizeof(*ts) * 3) {
+				pr_warning("short SO_TIMESTAMPING message");
+				return -1;
+			}
+			ts = (struct timespec *) CMSG_DATA(cm);
+		}
+		if (SOL_SOCKET == level && SO_TIMESTAMPNS == type) {
+			if (cm->cmsg_len < sizeof(*sw)) {
+				pr_warning("short SO_TIMESTAMPNS message");
+				return -1;
+			}
+			sw = (struct timespec *) CMSG_DATA(cm);
+			hwts->sw = *sw;
+		}
+	}
+
+	if (!ts) {
+		memset(&hwts->ts, 0, sizeof(hwts->ts));
+		return 0;
+	}
+
+	switch (hwts->type) {
+	case TS_SOFTWARE:
+		hwts->ts = ts[0];
+		break;
+	case TS_HARDWARE:
+	case TS_ONESTEP:
+		hwts->ts = ts[2];
+		break;
+	case TS_LEGACY_HW:
+		hwts->ts = ts[1];
+		break;
+	}
+	return 0;
+}
+
 int sk_receive(int fd, void *buf, int buflen,
 	       struct address *addr, struct hw_timestamp *hwts, int flags)
 {
 	char control[256];
-	int cnt = 0, res = 0, level, type;
-	struct cmsghdr *cm;
+	int cnt = 0, res = 0;
 	struct iovec iov = { buf, buflen };
 	struct msghdr msg;
-	struct timespec *sw, *ts = NULL;
 
-	memset(control, 0, sizeof(control));
 	memset(&msg, 0, sizeof(msg));
 	if (addr) {
 		msg.msg_name = &addr->ss;
@@ -269,51 +313,100 @@ int sk_receive(int fd, void *buf, int buflen,
 	}
 
 	cnt = recvmsg(fd, &msg, flags);
+	if (cnt < 0 && (flags & MSG_DONTWAIT) && errno == EAGAIN)
+		return cnt;
 	if (cnt < 1)
 		pr_err("recvmsg%sfailed: %m",
-		       flags == MSG_ERRQUEUE ? " tx timestamp " : " ");
+		       flags & MSG_ERRQUEUE ? " tx timestamp " : " ");
+	if (cnt < 0)
+		return cnt;
 
-	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
-		level = cm->cmsg_level;
-		type  = cm->cmsg_type;
-		if (SOL_SOCKET == level && SO_TIMESTAMPING == type) {
-			if (cm->cmsg_len < sizeof(*ts) * 3) {
-				pr_warning("short SO_TIMESTAMPING message");
-				return -1;
-			}
-			ts = (struct timespec *) CMSG_DATA(cm);
-		}
-		if (SOL_SOCKET == level && SO_TIMESTAMPNS == type) {
-			if (cm->cmsg_len < sizeof(*sw)) {
-				pr_warning("short SO_TIMESTAMPNS message");
-				return -1;
-			}
-			sw = (struct timespec *) CMSG_DATA(cm);
-			hwts->sw = *sw;
-		}
-	}
+	if (sk_parse_cmsg(&msg, hwts))
+		return -1;
 
 	if (addr)
 		addr->len = msg.msg_namelen;
 
-	if (!ts) {
-		memset(&hwts->ts, 0, sizeof(hwts->ts));
-		return cnt;
+	return cnt;
+}
+
+int sk_receive_batch(int fd, void *buf[], int buflen, struct address *addr[],
+		     struct hw_timestamp *hwts[], int cnt[], int n)
+{
+	char control[SK_BATCH_MAX][256];
+	struct mmsghdr mmsg[SK_BATCH_MAX];
+	struct iovec iov[SK_BATCH_MAX];
+	int i, res;
+
+	if (n > SK_BATCH_MAX)
+		n = SK_BATCH_MAX;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = buflen;
+		mmsg[i].msg_hdr.msg_name = &addr[i]->ss;
+		mmsg[i].msg_hdr.msg_namelen = sizeof(addr[i]->ss);
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_control = control[i];
+		mmsg[i].msg_hdr.msg_controllen = sizeof(control[i]);
 	}
 
-	switch (hwts->type) {
-	case TS_SOFTWARE:
-		hwts->ts = ts[0];
-		break;
-	case TS_HARDWARE:
-	case TS_ONESTEP:
-		hwts->ts = ts[2];
-		break;
-	case TS_LEGACY_HW:
-		hwts->ts = ts[1];
-		break;
+	res = recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+	if (res < 0 && errno == EAGAIN)
+		return 0;
+	if (res < 1) {
+		pr_err("recvmmsg failed: %m");
+		return res;
 	}
-	return cnt;
+
+	for (i = 0; i < res; i++) {
+		addr[i]->len = mmsg[i].msg_hdr.msg_namelen;
+		cnt[i] = mmsg[i].msg_len;
+		if (sk_parse_cmsg(&mmsg[i].msg_hdr, hwts[i]))
+			cnt[i] = -1;
+	}
+	return res;
+}
+
+int sk_send_batch(int fd, void *buf[], int len[], struct address *addr[],
+		  int n)
+{
+	struct mmsghdr mmsg[SK_BATCH_MAX];
+	struct iovec iov[SK_BATCH_MAX];
+	int i, res, sent = 0;
+
+	if (n > SK_BATCH_MAX)
+		n = SK_BATCH_MAX;
+
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = len[i];
+		if (addr[i]) {
+			mmsg[i].msg_hdr.msg_name = &addr[i]->sa;
+			mmsg[i].msg_hdr.msg_namelen = addr[i]->len;
+		}
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < n) {
+		res = sendmmsg(fd, mmsg + sent, n - sent, 0);
+		if (res < 1) {
+			pr_err("sendmmsg failed: %m");
+			return sent ? sent : -1;
+		}
+		sent += res;
+	}
+	return sent;
+}
+
+int sk_receive_txts(int fd, void *buf, int buflen, struct hw_timestamp *hwts)
+{
+	return sk_receive(fd, buf, buflen, NULL, hwts,
+			  MSG_ERRQUEUE | MSG_DONTWAIT);
 }
 
 int sk_set_priority(int fd, uint8_t dscp)
@@ -99,6 +99,53 @@ int sk_interface_addr(const char *name, int family, struct address *addr);
 int sk_receive(int fd, void *buf, int buflen,
 	       struct address *addr, struct hw_timestamp *hwts, int flags);
 
+/**
+ * The largest number of messages read by one call to sk_receive_batch().
+ */
+#define SK_BATCH_MAX 16
+
+/**
+ * Read all of the messages waiting on a socket, up to a given number,
+ * with a single system call. This call never waits.
+ * @param fd      An open socket.
+ * @param buf     Array of 'n' buffers to receive the messages.
+ * @param buflen  Size of each buffer in bytes.
+ * @param addr    Array of 'n' buffers to receive the source addresses.
+ * @param hwts    Array of 'n' buffers to receive the time stamps.
+ * @param cnt     Array of 'n' integers to receive the message lengths.
+ *                A length of -1 marks a message with bad control data.
+ * @param n       Number of buffers, at most SK_BATCH_MAX.
+ * @return        The number of messages read, zero if there were none,
+ *                or negative in case of an error.
+ */
+int sk_receive_batch(int fd, void *buf[], int buflen, struct address *addr[],
+		     struct hw_timestamp *hwts[], int cnt[], int n);
+
+/**
+ * Send a number of messages with a single system call.
+ * @param fd      An open socket.
+ * @param buf     Array of 'n' buffers holding the messages.
+ * @param len     Array of 'n' message lengths in bytes.
+ * @param addr    Array of 'n' destination addresses. An entry may be
+ *                NULL if the socket needs no address.
+ * @param n       Number of messages, at most SK_BATCH_MAX.
+ * @return        The number of messages sent, or -1 if none were sent.
+ */
+int sk_send_batch(int fd, void *buf[], int len[], struct address *addr[],
+		  int n);
+
+/**
+ * Collect one transmit time stamp from a socket's error queue without
+ * waiting for it.
+ * @param fd      An open socket with time stamping enabled.
+ * @param buf     Buffer to receive the looped back message.
+ * @param buflen  Size of 'buf' in bytes.
+ * @param hwts    Pointer to a buffer to receive the message's time stamp.
+ * @return        The number of bytes received, or -1 with errno set to
+ *                EAGAIN when the error queue is empty.
+ */
+int sk_receive_txts(int fd, void *buf, int buflen, struct hw_timestamp *hwts);
+
 /**
  * Set DSCP value for socket.
  * @param fd    An open socket.
@@ -124,6 +171,13 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
  */
 extern int sk_tx_timeout;
 
+/**
+ * When set, event messages are sent without waiting for their transmit
+ * time stamps. The time stamps are collected from the error queue once
+ * the event socket signals them, see transport_txts().
+ */
+extern int sk_tx_async;
+
 /**
  * Enables the SO_TIMESTAMPNS socket option on the both the event and
  * general sockets in order to test the order of paired sync and
@@ -0,0 +1,155 @@
+/**
+ * @file standby.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "standby.h"
+
+/* Number of sync intervals after which an offset estimate is stale */
+#define STANDBY_MAX_AGE 4
+
+struct standby {
+	int count;
+	struct standby_master *masters;
+};
+
+struct standby *standby_create(int count)
+{
+	struct standby *s;
+
+	if (count < 1)
+		return NULL;
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->masters = calloc(count, sizeof(*s->masters));
+	if (!s->masters) {
+		free(s);
+		return NULL;
+	}
+	s->count = count;
+	return s;
+}
+
+void standby_destroy(struct standby *s)
+{
+	int i;
+
+	standby_reset(s);
+	for (i = 0; i < s->count; i++)
+		tsproc_destroy(s->masters[i].tsproc);
+	free(s->masters);
+	free(s);
+}
+
+int standby_size(struct standby *s)
+{
+	return s->count;
+}
+
+struct standby_master *standby_get(struct standby *s, int i)
+{
+	return &s->masters[i];
+}
+
+struct standby_master *standby_find(struct standby *s,
+				    struct PortIdentity *source)
+{
+	int i;
+
+	for (i = 0; i < s->count; i++) {
+		if (s->masters[i].used &&
+		    !memcmp(&s->masters[i].source, source, sizeof(*source)))
+			return &s->masters[i];
+	}
+	return NULL;
+}
+
+static void standby_release(struct standby_master *m)
+{
+	if (m->sync) {
+		msg_put(m->sync);
+		m->sync = NULL;
+	}
+	m->used = 0;
+	m->updated.tv_sec = 0;
+	m->updated.tv_nsec = 0;
+}
+
+void standby_claim(struct standby_master *m, struct PortIdentity *source)
+{
+	standby_release(m);
+	tsproc_reset(m->tsproc, 1);
+	m->source = *source;
+	m->used = 1;
+}
+
+void standby_reset(struct standby *s)
+{
+	int i;
+
+	for (i = 0; i < s->count; i++)
+		standby_release(&s->masters[i]);
+}
+
+void standby_sync(struct standby_master *m, tmv_t origin, tmv_t ingress,
+		  int log_sync_interval)
+{
+	tmv_t offset;
+	double weight;
+
+	tsproc_down_ts(m->tsproc, origin, ingress);
+	if (tsproc_update_offset(m->tsproc, &offset, &weight))
+		return;
+	standby_set_offset(m, offset, log_sync_interval);
+}
+
+void standby_set_offset(struct standby_master *m, tmv_t offset,
+			int log_sync_interval)
+{
+	m->offset = offset;
+	m->log_sync_interval = log_sync_interval;
+	clock_gettime(CLOCK_MONOTONIC, &m->updated);
+}
+
+int standby_offset(struct standby_master *m, tmv_t *offset)
+{
+	struct timespec now;
+	int64_t age, max_age;
+	int log = m->log_sync_interval;
+
+	if (!m->used || (!m->updated.tv_sec && !m->updated.tv_nsec))
+		return -1;
+
+	if (log < -10)
+		log = -10;
+	if (log > 10)
+		log = 10;
+	max_age = STANDBY_MAX_AGE * NS_PER_SEC;
+	max_age = log < 0 ? max_age >> -log : max_age << log;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age = (now.tv_sec - m->updated.tv_sec) * NS_PER_SEC +
+		now.tv_nsec - m->updated.tv_nsec;
+	if (age > max_age)
+		return -1;
+
+	*offset = m->offset;
+	return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file standby.h
+ * @brief Measurement state of the candidate masters of a port.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_STANDBY_H
+#define HAVE_STANDBY_H
+
+#include <time.h>
+
+#include "ddt.h"
+#include "msg.h"
+#include "tmv.h"
+#include "tsproc.h"
+
+/**
+ * The state kept for one master, so that its delay filter and offset
+ * estimate are converged when it becomes the best master.
+ */
+struct standby_master {
+	/** Non-zero if the entry tracks a master. */
+	int used;
+
+	/** The port identity of the master. */
+	struct PortIdentity source;
+
+	/** Time stamp processor fed with the exchanges of this master. */
+	struct tsproc *tsproc;
+
+	/** Two step sync message waiting for its follow up, if any. */
+	struct ptp_message *sync;
+
+	/** Latest offset from the master, valid if 'updated' is set. */
+	tmv_t offset;
+
+	/** CLOCK_MONOTONIC time of the latest offset. */
+	struct timespec updated;
+
+	/** Sync interval announced by the master. */
+	int log_sync_interval;
+};
+
+/** Opaque type */
+struct standby;
+
+/**
+ * Create a table of standby masters. The caller provides the time stamp
+ * processors via @ref standby_get(), the table destroys them.
+ * @param count  Number of entries.
+ * @return       A pointer to a new table on success, NULL otherwise.
+ */
+struct standby *standby_create(int count);
+
+/**
+ * Destroy a table of standby masters and their time stamp processors.
+ * @param s  Pointer obtained via @ref standby_create().
+ */
+void standby_destroy(struct standby *s);
+
+/**
+ * Get the number of entries of the table.
+ * @param s  Pointer obtained via @ref standby_create().
+ * @return   The number of entries.
+ */
+int standby_size(struct standby *s);
+
+/**
+ * Get an entry of the table.
+ * @param s  Pointer obtained via @ref standby_create().
+ * @param i  Index of the entry, less than @ref standby_size().
+ * @return   The entry.
+ */
+struct standby_master *standby_get(struct standby *s, int i);
+
+/**
+ * Find the entry of a master.
+ * @param s       Pointer obtained via @ref standby_create().
+ * @param source  The port identity of the master.
+ * @return        The entry, or NULL if the master is not tracked.
+ */
+struct standby_master *standby_find(struct standby *s,
+				    struct PortIdentity *source);
+
+/**
+ * Let an entry track a new master, discarding its previous state.
+ * @param m       An entry of the table.
+ * @param source  The port identity of the master.
+ */
+void standby_claim(struct standby_master *m, struct PortIdentity *source);
+
+/**
+ * Stop tracking the masters of all entries.
+ * @param s  Pointer obtained via @ref standby_create().
+ */
+void standby_reset(struct standby *s);
+
+/**
+ * Feed a sync exchange and update the offset estimate of a master.
+ * @param m                  An entry of the table.
+ * @param origin             The corrected origin time stamp (t1).
+ * @param ingress            The ingress time stamp (t2).
+ * @param log_sync_interval  The sync interval of the master.
+ */
+void standby_sync(struct standby_master *m, tmv_t origin, tmv_t ingress,
+		  int log_sync_interval);
+
+/**
+ * Store an offset estimate of a master computed elsewhere.
+ * @param m                  An entry of the table.
+ * @param offset             The offset from the master.
+ * @param log_sync_interval  The sync interval of the master.
+ */
+void standby_set_offset(struct standby_master *m, tmv_t offset,
+			int log_sync_interval);
+
+/**
+ * Get the offset estimate of a master, if it is recent. An estimate is
+ * recent while no more than four sync intervals have passed.
+ * @param m       An entry of the table.
+ * @param offset  Returns the offset from the master.
+ * @return        Zero if the estimate is recent, non-zero otherwise.
+ */
+int standby_offset(struct standby_master *m, tmv_t *offset);
+
+#endif
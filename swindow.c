@@ -0,0 +1,212 @@
+/**
+ * @file swindow.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "swindow.h"
+
+/* Binary heap of sample slots, ordered by the sample values. */
+struct heap {
+	int *slot;
+	int n;
+	int max; /* max-heap if set, min-heap otherwise */
+};
+
+struct swindow {
+	int len;
+	int cnt;
+	int index;
+	double rank;
+	/* Values stored in circular buffer. */
+	tmv_t *samples;
+	/* Heap position of each slot, ~position for slots in 'hi'. */
+	int *pos;
+	/* Samples at or below the rank statistic, largest on top. */
+	struct heap lo;
+	/* Samples above the rank statistic, smallest on top. */
+	struct heap hi;
+};
+
+static int heap_before(struct swindow *w, struct heap *h, int a, int b)
+{
+	return h->max ? w->samples[a] > w->samples[b] :
+			w->samples[a] < w->samples[b];
+}
+
+static void heap_set(struct swindow *w, struct heap *h, int i, int slot)
+{
+	h->slot[i] = slot;
+	w->pos[slot] = h == &w->lo ? i : ~i;
+}
+
+static void heap_sift_up(struct swindow *w, struct heap *h, int i)
+{
+	int slot = h->slot[i], parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!heap_before(w, h, slot, h->slot[parent]))
+			break;
+		heap_set(w, h, i, h->slot[parent]);
+		i = parent;
+	}
+	heap_set(w, h, i, slot);
+}
+
+static void heap_sift_down(struct swindow *w, struct heap *h, int i)
+{
+	int slot = h->slot[i], child;
+
+	while ((child = 2 * i + 1) < h->n) {
+		if (child + 1 < h->n &&
+		    heap_before(w, h, h->slot[child + 1], h->slot[child]))
+			child++;
+		if (!heap_before(w, h, h->slot[child], slot))
+			break;
+		heap_set(w, h, i, h->slot[child]);
+		i = child;
+	}
+	heap_set(w, h, i, slot);
+}
+
+static void heap_push(struct swindow *w, struct heap *h, int slot)
+{
+	heap_set(w, h, h->n++, slot);
+	heap_sift_up(w, h, h->n - 1);
+}
+
+static void heap_remove(struct swindow *w, struct heap *h, int i)
+{
+	int last = h->slot[--h->n];
+
+	if (i == h->n)
+		return;
+	heap_set(w, h, i, last);
+	heap_sift_up(w, h, i);
+	heap_sift_down(w, h, w->pos[last] < 0 ? ~w->pos[last] : w->pos[last]);
+}
+
+static int heap_pop(struct swindow *w, struct heap *h)
+{
+	int top = h->slot[0];
+
+	heap_remove(w, h, 0);
+	return top;
+}
+
+/* Number of samples which belong into 'lo' for the current count. */
+static int swindow_target(struct swindow *w)
+{
+	int k = (int) ceil(w->rank * w->cnt - 1e-9);
+
+	if (k < 1)
+		k = 1;
+	if (k > w->cnt)
+		k = w->cnt;
+	return k;
+}
+
+void swindow_add(struct swindow *w, tmv_t sample)
+{
+	int k, pos;
+
+	if (w->cnt == w->len) {
+		/* Remove the replaced value from its heap. */
+		pos = w->pos[w->index];
+		if (pos >= 0)
+			heap_remove(w, &w->lo, pos);
+		else
+			heap_remove(w, &w->hi, ~pos);
+		w->cnt--;
+	}
+
+	w->samples[w->index] = sample;
+	if (w->lo.n && sample <= w->samples[w->lo.slot[0]])
+		heap_push(w, &w->lo, w->index);
+	else
+		heap_push(w, &w->hi, w->index);
+	w->cnt++;
+
+	k = swindow_target(w);
+	while (w->lo.n > k)
+		heap_push(w, &w->hi, heap_pop(w, &w->lo));
+	while (w->lo.n < k)
+		heap_push(w, &w->lo, heap_pop(w, &w->hi));
+
+	w->index = (1 + w->index) % w->len;
+}
+
+void swindow_reset(struct swindow *w)
+{
+	w->cnt = 0;
+	w->index = 0;
+	w->lo.n = 0;
+	w->hi.n = 0;
+}
+
+int swindow_count(struct swindow *w)
+{
+	return w->cnt;
+}
+
+tmv_t swindow_rank(struct swindow *w)
+{
+	return w->samples[w->lo.slot[0]];
+}
+
+tmv_t swindow_median(struct swindow *w)
+{
+	if (w->cnt % 2)
+		return w->samples[w->lo.slot[0]];
+	else
+		return tmv_div(tmv_add(w->samples[w->lo.slot[0]],
+				       w->samples[w->hi.slot[0]]), 2);
+}
+
+void swindow_destroy(struct swindow *w)
+{
+	free(w->lo.slot);
+	free(w->hi.slot);
+	free(w->pos);
+	free(w->samples);
+	free(w);
+}
+
+struct swindow *swindow_create(int length, double rank)
+{
+	struct swindow *w;
+
+	if (length < 1 || rank <= 0.0 || rank > 1.0)
+		return NULL;
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->samples = calloc(length, sizeof(*w->samples));
+	w->pos = calloc(length, sizeof(*w->pos));
+	w->lo.slot = calloc(length, sizeof(*w->lo.slot));
+	w->hi.slot = calloc(length, sizeof(*w->hi.slot));
+	if (!w->samples || !w->pos || !w->lo.slot || !w->hi.slot) {
+		swindow_destroy(w);
+		return NULL;
+	}
+	w->lo.max = 1;
+	w->len = length;
+	w->rank = rank;
+	return w;
+}
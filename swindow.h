@@ -0,0 +1,84 @@
+/**
+ * @file swindow.h
+ * @brief Sliding window of samples with fast access to a rank statistic.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_SWINDOW_H
+#define HAVE_SWINDOW_H
+
+#include "tmv.h"
+
+/** Opaque type */
+struct swindow;
+
+/**
+ * Create a new sliding window.
+ *
+ * The window keeps the last @a length samples split into two heaps at
+ * the requested rank, so that adding a sample costs O(log length) and
+ * the rank statistic is available in O(1).
+ *
+ * @param length  Maximum number of samples in the window.
+ * @param rank    Fraction of the samples at or below the rank statistic,
+ *                in the range (0, 1]. Use 0.5 for the median.
+ * @return        A pointer to a new window on success, NULL otherwise.
+ */
+struct swindow *swindow_create(int length, double rank);
+
+/**
+ * Destroy a sliding window.
+ * @param w  Pointer obtained via @ref swindow_create().
+ */
+void swindow_destroy(struct swindow *w);
+
+/**
+ * Add a sample, replacing the oldest one if the window is full.
+ * @param w       Pointer obtained via @ref swindow_create().
+ * @param sample  The new sample.
+ */
+void swindow_add(struct swindow *w, tmv_t sample);
+
+/**
+ * Remove all samples. This takes constant time.
+ * @param w  Pointer obtained via @ref swindow_create().
+ */
+void swindow_reset(struct swindow *w);
+
+/**
+ * Get the number of samples in the window.
+ * @param w  Pointer obtained via @ref swindow_create().
+ * @return   The number of samples.
+ */
+int swindow_count(struct swindow *w);
+
+/**
+ * Get the smallest sample which has at least the requested fraction of
+ * the samples at or below it. The window must not be empty.
+ * @param w  Pointer obtained via @ref swindow_create().
+ * @return   The rank statistic.
+ */
+tmv_t swindow_rank(struct swindow *w);
+
+/**
+ * Get the median, the mean of the two middle samples for an even count.
+ * Only valid for windows created with a rank of 0.5, and not empty.
+ * @param w  Pointer obtained via @ref swindow_create().
+ * @return   The median.
+ */
+tmv_t swindow_median(struct swindow *w);
+
+#endif
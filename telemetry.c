@@ -0,0 +1,89 @@
+/**
+ * @file telemetry.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+
+#include "telemetry.h"
+
+struct telemetry {
+	/* Written by the producer only. */
+	unsigned int head;
+	unsigned long dropped;
+	/* Keep the consumer index out of the producer's cache line. */
+	unsigned int tail __attribute__((aligned(64)));
+	unsigned int mask;
+	struct telemetry_sample *ring;
+};
+
+struct telemetry *telemetry_create(unsigned int length)
+{
+	struct telemetry *t;
+	unsigned int size = 1;
+
+	while (size < length && size < (1U << 31))
+		size <<= 1;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	t->ring = calloc(size, sizeof(*t->ring));
+	if (!t->ring) {
+		free(t);
+		return NULL;
+	}
+	t->mask = size - 1;
+	return t;
+}
+
+void telemetry_destroy(struct telemetry *t)
+{
+	free(t->ring);
+	free(t);
+}
+
+void telemetry_push(struct telemetry *t, const struct telemetry_sample *s)
+{
+	unsigned int tail = __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE);
+
+	if (t->head - tail > t->mask) {
+		__atomic_store_n(&t->dropped, t->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	t->ring[t->head & t->mask] = *s;
+	/* Publish the sample before the new head. */
+	__atomic_store_n(&t->head, t->head + 1, __ATOMIC_RELEASE);
+}
+
+int telemetry_pop(struct telemetry *t, struct telemetry_sample *s, int n)
+{
+	unsigned int head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+	int i;
+
+	for (i = 0; i < n && t->tail != head; i++) {
+		s[i] = t->ring[t->tail & t->mask];
+		/* Hand the slot back only after it was copied. */
+		__atomic_store_n(&t->tail, t->tail + 1, __ATOMIC_RELEASE);
+	}
+	return i;
+}
+
+unsigned long telemetry_dropped(struct telemetry *t)
+{
+	return __atomic_load_n(&t->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,76 @@
+/**
+ * @file telemetry.h
+ * @brief Lock free record of every servo sample for another thread.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TELEMETRY_H
+#define HAVE_TELEMETRY_H
+
+#include <stdint.h>
+
+/** Opaque type */
+struct telemetry;
+
+struct telemetry_sample {
+	int64_t ingress;	/* ns */
+	int64_t offset;		/* ns */
+	int64_t path_delay;	/* ns */
+	double freq;		/* ppb */
+	int state;		/* enum servo_state */
+};
+
+/**
+ * Create a new telemetry ring buffer.
+ *
+ * The ring has exactly one producer and one consumer, which may run in
+ * different threads. When the ring is full, new samples are dropped.
+ *
+ * @param length  Number of samples, rounded up to a power of two.
+ * @return        A pointer to a new ring on success, NULL otherwise.
+ */
+struct telemetry *telemetry_create(unsigned int length);
+
+/**
+ * Destroy a telemetry ring buffer.
+ * @param t  Pointer obtained via @ref telemetry_create().
+ */
+void telemetry_destroy(struct telemetry *t);
+
+/**
+ * Append a sample, called by the producer only.
+ * @param t  Pointer obtained via @ref telemetry_create().
+ * @param s  The sample to copy into the ring.
+ */
+void telemetry_push(struct telemetry *t, const struct telemetry_sample *s);
+
+/**
+ * Remove the oldest samples, called by the consumer only.
+ * @param t  Pointer obtained via @ref telemetry_create().
+ * @param s  Array receiving the samples.
+ * @param n  Length of the array.
+ * @return   The number of samples copied to @a s.
+ */
+int telemetry_pop(struct telemetry *t, struct telemetry_sample *s, int n);
+
+/**
+ * Get the number of samples dropped because the ring was full.
+ * @param t  Pointer obtained via @ref telemetry_create().
+ * @return   The number of dropped samples since the ring was created.
+ */
+unsigned long telemetry_dropped(struct telemetry *t);
+
+#endif
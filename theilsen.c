@@ -0,0 +1,216 @@
+/**
+ * @file theilsen.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdlib.h>
+
+#include "theilsen.h"
+
+/* Minimum number of points before new points are checked */
+#define OUTLIER_MIN_POINTS 4
+/* Limit for the deviation of a new point, in median deviations */
+#define OUTLIER_LIMIT 5.0
+/* Lower bound of the median deviation in ns, for time stamp granularity */
+#define OUTLIER_MIN_DEV 8.0
+
+struct theilsen {
+	int len;
+	int cnt;
+	int index;
+	int rejected;
+	/* Points stored in circular buffer. */
+	tmv_t *x;
+	tmv_t *y;
+	/* Scratch space for the pairwise slopes and the deviations. */
+	double *work;
+	/* Fit of the points in the window, valid if 'fitted' is set. */
+	int fitted;
+	double slope;
+	double intercept; /* at x of the newest point */
+	double deviation;
+};
+
+/* Returns the k-th smallest value, reordering the array (quickselect). */
+static double select_kth(double *v, int n, int k)
+{
+	int lo = 0, hi = n - 1, i, j;
+	double pivot, tmp;
+
+	while (lo < hi) {
+		pivot = v[(lo + hi) / 2];
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (v[i] < pivot)
+				i++;
+			while (v[j] > pivot)
+				j--;
+			if (i <= j) {
+				tmp = v[i];
+				v[i] = v[j];
+				v[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+	return v[k];
+}
+
+static double median(double *v, int n)
+{
+	double m = select_kth(v, n, n / 2);
+
+	if (n % 2)
+		return m;
+	return (m + select_kth(v, n / 2, n / 2 - 1)) / 2.0;
+}
+
+static int slot(struct theilsen *ts, int i)
+{
+	/* i-th oldest point in the window */
+	return (ts->index - ts->cnt + i + ts->len) % ts->len;
+}
+
+static void theilsen_fit(struct theilsen *ts)
+{
+	int i, j, a, b, n = 0, newest;
+	double dx;
+
+	ts->fitted = 0;
+	if (ts->cnt < 2)
+		return;
+
+	for (i = 0; i < ts->cnt; i++) {
+		a = slot(ts, i);
+		for (j = i + 1; j < ts->cnt; j++) {
+			b = slot(ts, j);
+			dx = tmv_dbl(tmv_sub(ts->x[b], ts->x[a]));
+			if (dx <= 0.0)
+				continue;
+			ts->work[n++] = tmv_dbl(tmv_sub(ts->y[b], ts->y[a])) / dx;
+		}
+	}
+	if (!n)
+		return;
+	ts->slope = median(ts->work, n);
+
+	/* Intercept and spread relative to the newest point. */
+	newest = slot(ts, ts->cnt - 1);
+	for (i = 0; i < ts->cnt; i++) {
+		a = slot(ts, i);
+		ts->work[i] = tmv_dbl(tmv_sub(ts->y[a], ts->y[newest])) -
+			ts->slope * tmv_dbl(tmv_sub(ts->x[a], ts->x[newest]));
+	}
+	ts->intercept = median(ts->work, ts->cnt);
+	for (i = 0; i < ts->cnt; i++)
+		ts->work[i] = fabs(ts->work[i] - ts->intercept);
+	ts->deviation = median(ts->work, ts->cnt);
+	if (ts->deviation < OUTLIER_MIN_DEV)
+		ts->deviation = OUTLIER_MIN_DEV;
+	ts->fitted = 1;
+}
+
+int theilsen_add(struct theilsen *ts, tmv_t x, tmv_t y)
+{
+	int newest;
+	double dev;
+
+	/* The clock of x went back, start over from this point. */
+	if (ts->cnt) {
+		newest = slot(ts, ts->cnt - 1);
+		if (tmv_dbl(tmv_sub(x, ts->x[newest])) <= 0.0)
+			theilsen_reset(ts);
+	}
+
+	if (ts->fitted && ts->cnt >= OUTLIER_MIN_POINTS) {
+		newest = slot(ts, ts->cnt - 1);
+		dev = tmv_dbl(tmv_sub(y, ts->y[newest])) - ts->intercept -
+			ts->slope * tmv_dbl(tmv_sub(x, ts->x[newest]));
+		if (fabs(dev) <= OUTLIER_LIMIT * ts->deviation)
+			ts->rejected = 0;
+		else if (++ts->rejected <= ts->len / 2)
+			return -1;
+		/*
+		 * Otherwise the line probably moved. Take the points until
+		 * one fits again, the median follows once they are the
+		 * majority of the window.
+		 */
+	}
+
+	ts->x[ts->index] = x;
+	ts->y[ts->index] = y;
+	ts->index = (1 + ts->index) % ts->len;
+	if (ts->cnt < ts->len)
+		ts->cnt++;
+
+	theilsen_fit(ts);
+	return 0;
+}
+
+void theilsen_reset(struct theilsen *ts)
+{
+	ts->cnt = 0;
+	ts->index = 0;
+	ts->rejected = 0;
+	ts->fitted = 0;
+}
+
+int theilsen_slope(struct theilsen *ts, double *slope)
+{
+	/* Too few points to tell an outlier from the line. */
+	if (!ts->fitted || ts->cnt < OUTLIER_MIN_POINTS)
+		return -1;
+	*slope = ts->slope;
+	return 0;
+}
+
+void theilsen_destroy(struct theilsen *ts)
+{
+	free(ts->x);
+	free(ts->y);
+	free(ts->work);
+	free(ts);
+}
+
+struct theilsen *theilsen_create(int length)
+{
+	struct theilsen *ts;
+
+	if (length < 2)
+		return NULL;
+	ts = calloc(1, sizeof(*ts));
+	if (!ts)
+		return NULL;
+	ts->x = calloc(length, sizeof(*ts->x));
+	ts->y = calloc(length, sizeof(*ts->y));
+	ts->work = calloc(length * (length - 1) / 2 + length,
+			  sizeof(*ts->work));
+	if (!ts->x || !ts->y || !ts->work) {
+		theilsen_destroy(ts);
+		return NULL;
+	}
+	ts->len = length;
+	return ts;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file theilsen.h
+ * @brief Robust estimate of the slope over a sliding window of points.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_THEILSEN_H
+#define HAVE_THEILSEN_H
+
+#include "tmv.h"
+
+/** Opaque type */
+struct theilsen;
+
+/**
+ * Create a new estimator.
+ *
+ * The slope is the median of the slopes between all pairs of points in
+ * the window (Theil-Sen estimator), so that up to about a quarter of bad
+ * points do not move it. A new point far off the current line, relative
+ * to the median deviation of the points in the window, is rejected.
+ * After half a window of consecutive rejections the line is taken as
+ * moved and the points are taken again until one fits. A point which
+ * is not newer than the newest one, as after a step of the clock of x
+ * or a wrap of its time stamps, starts the window over.
+ *
+ * @param length  Maximum number of points in the window, at least 2.
+ * @return        A pointer to a new estimator on success, NULL otherwise.
+ */
+struct theilsen *theilsen_create(int length);
+
+/**
+ * Destroy an estimator.
+ * @param ts  Pointer obtained via @ref theilsen_create().
+ */
+void theilsen_destroy(struct theilsen *ts);
+
+/**
+ * Add a point, replacing the oldest one if the window is full.
+ * @param ts  Pointer obtained via @ref theilsen_create().
+ * @param x   The independent coordinate. If it is not greater than the
+ *            one of the newest point, all points are removed first.
+ * @param y   The dependent coordinate.
+ * @return    Zero if the point was added, non-zero if it was rejected.
+ */
+int theilsen_add(struct theilsen *ts, tmv_t x, tmv_t y);
+
+/**
+ * Remove all points.
+ * @param ts  Pointer obtained via @ref theilsen_create().
+ */
+void theilsen_reset(struct theilsen *ts);
+
+/**
+ * Get the slope of the points in the window.
+ * @param ts     Pointer obtained via @ref theilsen_create().
+ * @param slope  Returns the slope, dy/dx.
+ * @return       Zero on success, non-zero if there are less than four
+ *               points in the window.
+ */
+int theilsen_slope(struct theilsen *ts, double *slope);
+
+#endif
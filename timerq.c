@@ -0,0 +1,218 @@
+/**
+ * @file timerq.c
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "missing.h"
+#include "print.h"
+#include "timerq.h"
+
+#define NS_PER_SEC 1000000000ULL
+
+struct timerq {
+	int fd;
+	/* Expiry the timerfd is programmed for, zero if disarmed. */
+	uint64_t armed;
+	/* Binary min-heap of the armed timers, ordered by expiry. */
+	struct tmr **heap;
+	int n;
+	int size;
+};
+
+static uint64_t timerq_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int timerq_program(struct timerq *q, uint64_t expiry)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
+
+	tmo.it_value.tv_sec = expiry / NS_PER_SEC;
+	tmo.it_value.tv_nsec = expiry % NS_PER_SEC;
+	if (timerfd_settime(q->fd, TFD_TIMER_ABSTIME, &tmo, NULL)) {
+		pr_err("timerfd_settime failed: %m");
+		return -1;
+	}
+	q->armed = expiry;
+	return 0;
+}
+
+static void heap_set(struct timerq *q, int i, struct tmr *t)
+{
+	q->heap[i] = t;
+	t->pos = i;
+}
+
+static void heap_sift_up(struct timerq *q, int i)
+{
+	struct tmr *t = q->heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (q->heap[parent]->expiry <= t->expiry)
+			break;
+		heap_set(q, i, q->heap[parent]);
+		i = parent;
+	}
+	heap_set(q, i, t);
+}
+
+static void heap_sift_down(struct timerq *q, int i)
+{
+	struct tmr *t = q->heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < q->n) {
+		if (child + 1 < q->n &&
+		    q->heap[child + 1]->expiry < q->heap[child]->expiry)
+			child++;
+		if (t->expiry <= q->heap[child]->expiry)
+			break;
+		heap_set(q, i, q->heap[child]);
+		i = child;
+	}
+	heap_set(q, i, t);
+}
+
+static void heap_remove(struct timerq *q, struct tmr *t)
+{
+	struct tmr *last = q->heap[--q->n];
+	int i = t->pos;
+
+	t->pos = -1;
+	if (last == t)
+		return;
+	heap_set(q, i, last);
+	heap_sift_up(q, i);
+	heap_sift_down(q, last->pos);
+}
+
+void tmr_init(struct tmr *t, uint64_t data)
+{
+	t->expiry = 0;
+	t->pos = -1;
+	t->data = data;
+}
+
+struct timerq *timerq_create(void)
+{
+	struct timerq *q;
+
+	q = calloc(1, sizeof(*q));
+	if (!q)
+		return NULL;
+
+	q->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (q->fd < 0) {
+		pr_err("timerfd_create failed: %m");
+		free(q);
+		return NULL;
+	}
+	return q;
+}
+
+void timerq_destroy(struct timerq *q)
+{
+	int i;
+
+	for (i = 0; i < q->n; i++)
+		q->heap[i]->pos = -1;
+	close(q->fd);
+	free(q->heap);
+	free(q);
+}
+
+int timerq_fd(struct timerq *q)
+{
+	return q->fd;
+}
+
+int timerq_arm(struct timerq *q, struct tmr *t, uint64_t ns)
+{
+	struct tmr **heap;
+	int size;
+
+	if (!ns) {
+		timerq_cancel(q, t);
+		return 0;
+	}
+	t->expiry = timerq_now() + ns;
+
+	if (t->pos < 0) {
+		if (q->n == q->size) {
+			size = q->size ? 2 * q->size : 16;
+			heap = realloc(q->heap, size * sizeof(*heap));
+			if (!heap)
+				return -1;
+			q->heap = heap;
+			q->size = size;
+		}
+		heap_set(q, q->n++, t);
+		heap_sift_up(q, t->pos);
+	} else {
+		heap_sift_up(q, t->pos);
+		heap_sift_down(q, t->pos);
+	}
+
+	/*
+	 * A timer which moved later leaves the timerfd programmed too
+	 * early. That costs a spurious wake up, rather than a syscall
+	 * each time one of the receipt timeouts is pushed back.
+	 */
+	if (q->armed && q->armed <= q->heap[0]->expiry)
+		return 0;
+	return timerq_program(q, q->heap[0]->expiry);
+}
+
+void timerq_cancel(struct timerq *q, struct tmr *t)
+{
+	if (t->pos >= 0)
+		heap_remove(q, t);
+}
+
+int timerq_expire(struct timerq *q, struct tmr **expired, int n)
+{
+	uint64_t count, now;
+	int cnt = 0;
+
+	/* Only clears the readable state, the heap knows what expired. */
+	if (read(q->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		pr_err("read on timerfd failed: %m");
+
+	now = timerq_now();
+	while (q->n && cnt < n && q->heap[0]->expiry <= now) {
+		expired[cnt] = q->heap[0];
+		heap_remove(q, expired[cnt]);
+		cnt++;
+	}
+
+	q->armed = 0;
+	if (q->n)
+		timerq_program(q, q->heap[0]->expiry);
+	return cnt;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file timerq.h
+ * @brief Queue of one shot timers multiplexed onto a single timerfd.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TIMERQ_H
+#define HAVE_TIMERQ_H
+
+#include <stdint.h>
+
+/** Opaque type */
+struct timerq;
+
+/**
+ * A one shot timer. The data identifies the timer to the code which
+ * handles its expiration, like the data of an epoll event, so that no
+ * lookup is needed. The other fields are private.
+ */
+struct tmr {
+	uint64_t expiry;
+	int pos;
+	uint64_t data;
+};
+
+/**
+ * Initialize a timer, which starts out disarmed.
+ * @param t     The timer.
+ * @param data  Identifies the timer, may be changed while disarmed.
+ */
+void tmr_init(struct tmr *t, uint64_t data);
+
+/**
+ * Create a new timer queue.
+ * @return  A pointer to a new queue on success, NULL otherwise.
+ */
+struct timerq *timerq_create(void);
+
+/**
+ * Destroy a timer queue. Timers still armed are simply forgotten.
+ * @param q  Pointer obtained via @ref timerq_create().
+ */
+void timerq_destroy(struct timerq *q);
+
+/**
+ * Obtain the descriptor of the queue. It becomes readable when the
+ * earliest timer may have expired.
+ * @param q  Pointer obtained via @ref timerq_create().
+ * @return   The timerfd of the queue.
+ */
+int timerq_fd(struct timerq *q);
+
+/**
+ * Arm or rearm a timer. This only touches the queue in memory, the
+ * timerfd is reprogrammed only when the timer becomes the earliest.
+ * @param q   Pointer obtained via @ref timerq_create().
+ * @param t   The timer to arm.
+ * @param ns  Time until the expiration, in nanoseconds. A value of
+ *            zero disarms the timer, like it does for timerfd_settime().
+ * @return    Zero on success, non-zero otherwise.
+ */
+int timerq_arm(struct timerq *q, struct tmr *t, uint64_t ns);
+
+/**
+ * Disarm a timer. Nothing happens if the timer is not armed.
+ * @param q  Pointer obtained via @ref timerq_create().
+ * @param t  The timer to disarm.
+ */
+void timerq_cancel(struct timerq *q, struct tmr *t);
+
+/**
+ * Collect the expired timers, which are disarmed by this call, in the
+ * order of their expiration. Call when the descriptor is readable.
+ * @param q        Pointer obtained via @ref timerq_create().
+ * @param expired  Array to hold the expired timers.
+ * @param n        Size of the array. Any further expired timers are
+ *                 reported when the descriptor becomes readable again,
+ *                 which happens right away.
+ * @return         The number of timers placed into the array.
+ */
+int timerq_expire(struct timerq *q, struct tmr **expired, int n);
+
+#endif
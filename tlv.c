@@ -64,6 +64,7 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
 	struct port_properties_np *ppn;
+	struct msg_pool_stats_np *mps;
 	struct mgmt_clock_description *cd;
 	int extra_len = 0, len;
 	uint8_t *buf;
@@ -258,6 +259,15 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 		extra_len = sizeof(struct port_properties_np);
 		extra_len += ppn->interface.length;
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		if (data_len != sizeof(struct msg_pool_stats_np))
+			goto bad_length;
+		mps = (struct msg_pool_stats_np *) m->data;
+		mps->size = ntohl(mps->size);
+		mps->in_use = ntohl(mps->in_use);
+		mps->high_water = ntohl(mps->high_water);
+		mps->exhausted = ntohl(mps->exhausted);
+		break;
 	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
 	case TLV_RESET_NON_VOLATILE_STORAGE:
 	case TLV_INITIALIZE:
@@ -291,6 +301,7 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 	struct grandmaster_settings_np *gsn;
 	struct subscribe_events_np *sen;
 	struct port_properties_np *ppn;
+	struct msg_pool_stats_np *mps;
 	struct mgmt_clock_description *cd;
 	switch (m->id) {
 	case TLV_CLOCK_DESCRIPTION:
@@ -363,6 +374,13 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 		ppn = (struct port_properties_np *)m->data;
 		ppn->portIdentity.portNumber = htons(ppn->portIdentity.portNumber);
 		break;
+	case TLV_MSG_POOL_STATS_NP:
+		mps = (struct msg_pool_stats_np *) m->data;
+		mps->size = htonl(mps->size);
+		mps->in_use = htonl(mps->in_use);
+		mps->high_water = htonl(mps->high_water);
+		mps->exhausted = htonl(mps->exhausted);
+		break;
 	}
 }
 
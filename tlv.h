@@ -80,6 +80,8 @@ enum management_action {
 #define TLV_TIME_STATUS_NP				0xC000
 #define TLV_GRANDMASTER_SETTINGS_NP			0xC001
 #define TLV_SUBSCRIBE_EVENTS_NP				0xC003
+/* Clear of the ids upstream linuxptp allocates from 0xC000 on. */
+#define TLV_MSG_POOL_STATS_NP				0xC100
 
 /* Port management ID values */
 #define TLV_NULL_MANAGEMENT				0x0000
@@ -213,6 +215,13 @@ struct port_properties_np {
 	struct PTPText interface;
 } PACKED;
 
+struct msg_pool_stats_np {
+	UInteger32 size;
+	UInteger32 in_use;
+	UInteger32 high_water;
+	UInteger32 exhausted;
+} PACKED;
+
 #define PROFILE_ID_LEN 6
 
 struct mgmt_clock_description {
@@ -0,0 +1,156 @@
+/**
+ * @file capture2csv.c
+ * @brief Utility program to convert a ptp4l capture file into CSV.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../capture.h"
+#include "../version.h"
+
+static const char *type_str[] = {
+	[CAPTURE_SYNC]   = "sync",
+	[CAPTURE_DELAY]  = "delay",
+	[CAPTURE_PDELAY] = "pdelay",
+	[CAPTURE_SERVO]  = "servo",
+};
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options] file\n\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n"
+		"Writes the records of a capture file made by ptp4l to the\n"
+		"standard output, oldest first, as comma separated values.\n"
+		"\n",
+		progname);
+}
+
+static void print_record(const struct capture_record *r)
+{
+	const char *type = "unknown";
+
+	if (r->type < sizeof(type_str) / sizeof(type_str[0]) &&
+	    type_str[r->type])
+		type = type_str[r->type];
+
+	printf("%" PRIu32 ",%s,%u,%u,%" PRId64 ",%" PRId64 ",%" PRId64
+	       ",%" PRId64 ",%.3f,%.3f,%" PRId64 ",%.3f\n",
+	       r->seq, type, r->port, r->state, r->t1, r->t2, r->t3, r->t4,
+	       r->correction / 65536.0, r->asymmetry / 65536.0, r->offset,
+	       r->adj);
+}
+
+int main(int argc, char *argv[])
+{
+	const struct capture_header *hdr;
+	const struct capture_record *ring;
+	uint64_t head, i, first;
+	char *progname;
+	struct stat st;
+	int c, fd;
+	void *map;
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "hv"))) {
+		switch (c) {
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(progname);
+		return -1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	if (st.st_size < CAPTURE_HEADER_SIZE) {
+		fprintf(stderr, "%s: file too short\n", argv[optind]);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return -1;
+	}
+	close(fd);
+
+	hdr = map;
+	if (hdr->magic != CAPTURE_MAGIC || hdr->version != CAPTURE_VERSION ||
+	    hdr->record_size != sizeof(*ring) || !hdr->length ||
+	    CAPTURE_HEADER_SIZE + (uint64_t) hdr->length * sizeof(*ring) >
+	    (uint64_t) st.st_size) {
+		fprintf(stderr, "%s: not a capture file of this version\n",
+			argv[optind]);
+		return -1;
+	}
+	ring = (const struct capture_record *)
+		((const char *) map + CAPTURE_HEADER_SIZE);
+
+	/* The writer may still be running, so skip stale records. */
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	first = head > hdr->length ? head - hdr->length : 0;
+
+	printf("seq,type,port,state,t1,t2,t3,t4,correction,asymmetry,"
+	       "offset,adj\n");
+	for (i = first; i < head; i++) {
+		const struct capture_record *slot = &ring[i & (hdr->length - 1)];
+		struct capture_record r;
+		uint32_t seq;
+
+		/*
+		 * Load seq before the copy, so that a complete record is
+		 * seen, and again after it, so that a torn one is skipped.
+		 */
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq != (uint32_t) (i + 1))
+			continue;
+		r = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		r.seq = seq;
+		print_record(&r);
+	}
+
+	munmap(map, st.st_size);
+	return 0;
+}
@@ -0,0 +1,411 @@
+/**
+ * @file fmstress.c
+ * @brief Stress test of the index of foreign masters with many masters.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bmc.h"
+#include "../contain.h"
+#include "../foreign.h"
+#include "../version.h"
+
+/*
+ * bmc_state_decision() is not used here. These keep the linker happy
+ * without pulling in the clock and the port.
+ */
+struct dataset *clock_best_foreign(struct clock *c) { return NULL; }
+struct port *clock_best_port(struct clock *c) { return NULL; }
+UInteger8 clock_class(struct clock *c) { return 0; }
+struct dataset *clock_default_ds(struct clock *c) { return NULL; }
+struct dataset *port_best_foreign(struct port *port) { return NULL; }
+enum port_state port_state(struct port *port) { return PS_LISTENING; }
+
+/*
+ * Time is counted in messages. A master announces about once per round
+ * through all masters, and its messages stay current for four rounds,
+ * like the four announce intervals of the foreign master time window.
+ */
+#define WINDOW_ROUNDS 4
+
+/*
+ * A foreign master as a port records it. Instead of the announce
+ * messages, only the arrival times of the newest ones are kept.
+ */
+struct master {
+	struct foreign_clock fc;
+	long times[FOREIGN_MASTER_THRESHOLD];
+	int known;
+};
+
+/* An announce message: its sender and the change of its data set. */
+struct event {
+	int master;
+	int change;
+};
+
+struct port_sim {
+	struct master *masters;
+	int n_masters;
+	long window;
+	struct foreign_index index;
+	unsigned int sweep;
+};
+
+static struct PortIdentity receiver;
+
+static struct master *master_of(struct foreign_clock *fc)
+{
+	return container_of(fc, struct master, fc);
+}
+
+/* Number of messages still current at 'now', without changing anything. */
+static unsigned int current(struct port_sim *p, struct master *m, long now)
+{
+	unsigned int n = 0;
+
+	while (n < m->fc.n_messages && now - m->times[n] <= p->window)
+		n++;
+	return n;
+}
+
+/* As fc_prune() with and without the index. */
+static void prune(struct port_sim *p, struct master *m, long now, int indexed)
+{
+	m->fc.n_messages = current(p, m, now);
+	if (indexed && m->fc.n_messages < FOREIGN_MASTER_THRESHOLD)
+		foreign_index_disqualify(&p->index, &m->fc);
+}
+
+/*
+ * The data sets: a tenth of the masters share a grandmaster with another
+ * one, on a different number of steps, so that dscmp() also compares the
+ * topology. Changes pick a new priority1 and clock class.
+ */
+static void dataset_init(struct port_sim *p, int i)
+{
+	struct dataset *ds = &p->masters[i].fc.dataset;
+
+	memset(ds, 0, sizeof(*ds));
+	if (i % 10 == 9) {
+		*ds = p->masters[i - 1].fc.dataset;
+		ds->stepsRemoved = random() % 4;
+	} else {
+		ds->priority1 = 128 + random() % 4;
+		ds->identity.id[0] = random();
+		ds->identity.id[7] = i;
+		ds->identity.id[6] = i >> 8;
+		ds->quality.clockClass = 6 + random() % 2;
+		ds->quality.clockAccuracy = 0x20 + random() % 3;
+		ds->quality.offsetScaledLogVariance = random() % 0x10000;
+		ds->priority2 = 128 + random() % 2;
+	}
+	ds->sender.clockIdentity = ds->identity;
+	ds->sender.portNumber = 1 + i;
+	ds->receiver = receiver;
+}
+
+static void dataset_change(struct dataset *ds, int change)
+{
+	ds->priority1 = 128 + change % 4;
+	ds->quality.clockClass = 6 + (change >> 2) % 2;
+}
+
+static void sim_init(struct port_sim *p, int n_masters)
+{
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->n_masters = n_masters;
+	p->window = (long) WINDOW_ROUNDS * n_masters;
+	p->masters = calloc(n_masters, sizeof(*p->masters));
+	if (!p->masters) {
+		fprintf(stderr, "out of memory\n");
+		exit(-1);
+	}
+	srandom(1);
+	for (i = 0; i < n_masters; i++) {
+		TAILQ_INIT(&p->masters[i].fc.messages);
+		p->masters[i].fc.index = -1;
+		dataset_init(p, i);
+	}
+}
+
+static void sim_destroy(struct port_sim *p)
+{
+	foreign_index_destroy(&p->index);
+	free(p->masters);
+}
+
+/* As add_foreign_master() followed by port_compute_best(). */
+static struct master *indexed_message(struct port_sim *p, struct event *e,
+				      long now)
+{
+	struct master *m = &p->masters[e->master];
+	struct foreign_clock *fc;
+	int i;
+
+	fc = foreign_index_find(&p->index, &m->fc.dataset.sender);
+	if (!fc) {
+		m->known = 1;
+		foreign_index_add(&p->index, &m->fc);
+	} else {
+		prune(p, m, now, 1);
+		for (i = FOREIGN_MASTER_THRESHOLD - 1; i > 0; i--)
+			m->times[i] = m->times[i - 1];
+		m->times[0] = now;
+		if (m->fc.n_messages < FOREIGN_MASTER_THRESHOLD)
+			m->fc.n_messages++;
+		if (e->change)
+			dataset_change(&m->fc.dataset, e->change);
+		if (m->fc.n_messages < FOREIGN_MASTER_THRESHOLD)
+			foreign_index_disqualify(&p->index, &m->fc);
+		else if (foreign_index_qualify(&p->index, &m->fc))
+			fprintf(stderr, "out of memory\n");
+	}
+
+	LIST_FOREACH(fc, &p->index.buckets[p->sweep], list)
+		prune(p, master_of(fc), now, 1);
+	p->sweep = (p->sweep + 1) & (FOREIGN_MASTER_BUCKETS - 1);
+
+	while ((fc = foreign_index_best(&p->index))) {
+		prune(p, master_of(fc), now, 1);
+		if (fc->index >= 0)
+			return master_of(fc);
+	}
+	return NULL;
+}
+
+/*
+ * As the port did before the index: a linear search for the sender, and
+ * a pass over all masters for the best one.
+ */
+static struct master *list_message(struct port_sim *p, struct event *e,
+				   long now)
+{
+	struct master *m = NULL, *best = NULL;
+	int i;
+
+	for (i = 0; i < p->n_masters; i++) {
+		if (p->masters[i].known &&
+		    !memcmp(&p->masters[i].fc.dataset.sender,
+			    &p->masters[e->master].fc.dataset.sender,
+			    sizeof(receiver))) {
+			m = &p->masters[i];
+			break;
+		}
+	}
+	if (!m) {
+		p->masters[e->master].known = 1;
+	} else {
+		prune(p, m, now, 0);
+		for (i = FOREIGN_MASTER_THRESHOLD - 1; i > 0; i--)
+			m->times[i] = m->times[i - 1];
+		m->times[0] = now;
+		if (m->fc.n_messages < FOREIGN_MASTER_THRESHOLD)
+			m->fc.n_messages++;
+		if (e->change)
+			dataset_change(&m->fc.dataset, e->change);
+	}
+
+	for (i = 0; i < p->n_masters; i++) {
+		m = &p->masters[i];
+		if (!m->known)
+			continue;
+		prune(p, m, now, 0);
+		if (m->fc.n_messages < FOREIGN_MASTER_THRESHOLD)
+			continue;
+		if (!best || dscmp(&m->fc.dataset, &best->fc.dataset) > 0)
+			best = m;
+	}
+	return best;
+}
+
+/* The best master by brute force, leaving the records as they are. */
+static struct master *brute_force(struct port_sim *p, long now)
+{
+	struct master *m, *best = NULL;
+	int i;
+
+	for (i = 0; i < p->n_masters; i++) {
+		m = &p->masters[i];
+		if (!m->known || current(p, m, now) < FOREIGN_MASTER_THRESHOLD)
+			continue;
+		if (!best || dscmp(&m->fc.dataset, &best->fc.dataset) > 0)
+			best = m;
+	}
+	return best;
+}
+
+/*
+ * Masters announce in random order. Every now and then a master falls
+ * silent for several windows, so that its record expires, and one in a
+ * hundred messages changes the data set of its sender. Masters sharing
+ * a grandmaster do not change: a grandmaster announces a change through
+ * its paths at different times, and dscmp() is no total order meanwhile.
+ */
+static struct event *events_create(int n_masters, long n)
+{
+	struct event *events;
+	long *silent, i;
+	int k;
+
+	events = calloc(n, sizeof(*events));
+	silent = calloc(n_masters, sizeof(*silent));
+	if (!events || !silent) {
+		fprintf(stderr, "out of memory\n");
+		exit(-1);
+	}
+	srandom(2);
+	for (i = 0; i < n; i++) {
+		do {
+			k = random() % n_masters;
+		} while (silent[k] > i && random() % 8);
+		if (!(random() % n_masters))
+			silent[k] = i + (1 + random() % 4) * WINDOW_ROUNDS *
+				(long) n_masters;
+		events[i].master = k;
+		if (k % 10 < 8 && !(random() % 100))
+			events[i].change = 1 + random() % 8;
+	}
+	free(silent);
+	return events;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static long check(int n_masters, struct event *events, long n)
+{
+	struct master *best, *expected, *last = NULL;
+	struct port_sim p;
+	long errors = 0, i, changes = 0;
+
+	sim_init(&p, n_masters);
+	for (i = 0; i < n; i++) {
+		best = indexed_message(&p, &events[i], i);
+		expected = brute_force(&p, i);
+		if (best != expected) {
+			if (errors++ < 10)
+				fprintf(stderr, "%d masters, message %ld: "
+					"best %d, expected %d\n", n_masters, i,
+					best ? (int) (best - p.masters) : -1,
+					expected ?
+					(int) (expected - p.masters) : -1);
+		}
+		changes += best != last;
+		last = best;
+	}
+	sim_destroy(&p);
+	printf("%6d masters: %ld messages, %ld changes of the best master, "
+	       "%ld mismatches\n", n_masters, n, changes, errors);
+	return errors;
+}
+
+static void bench(int n_masters, struct event *events, long n)
+{
+	double t_index, t_list;
+	struct port_sim p;
+	long i;
+
+	sim_init(&p, n_masters);
+	t_index = now_ns();
+	for (i = 0; i < n; i++)
+		indexed_message(&p, &events[i], i);
+	t_index = now_ns() - t_index;
+	sim_destroy(&p);
+
+	sim_init(&p, n_masters);
+	t_list = now_ns();
+	for (i = 0; i < n; i++)
+		list_message(&p, &events[i], i);
+	t_list = now_ns() - t_list;
+	sim_destroy(&p);
+
+	printf("%6d masters: index %8.0f ns, list %8.0f ns per message\n",
+	       n_masters, t_index / n, t_list / n);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -m [num]     number of foreign masters, default 10, 100 and 1000\n"
+		" -n [num]     announce messages per master, default 1000\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, i, n_sizes = 3, sizes[3] = { 10, 100, 1000 };
+	long per_master = 1000, n, errors = 0;
+	struct event *events;
+	char *progname;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "m:n:hv"))) {
+		switch (c) {
+		case 'm':
+			sizes[0] = atoi(optarg);
+			n_sizes = 1;
+			break;
+		case 'n':
+			per_master = atol(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (sizes[0] < 2 || per_master < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	receiver.clockIdentity.id[0] = 0xff;
+	receiver.portNumber = 1;
+
+	for (i = 0; i < n_sizes; i++) {
+		n = per_master * sizes[i];
+		events = events_create(sizes[i], n);
+		errors += check(sizes[i], events, n);
+		bench(sizes[i], events, n);
+		free(events);
+	}
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+/**
+ * @file jsonbench.c
+ * @brief Compares the fixed layout JSON writer with the jansson path.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../rv_json_writer.h"
+#include "../rv_jsonrpc.h"
+#include "../version.h"
+
+/*
+ * Every allocation of the process is counted, including those of
+ * jansson and libc, by wrapping the allocator of glibc.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+enum message { OFFSET, HEALTH, PATH_DELAY, N_MESSAGES };
+
+static const char *message_name[N_MESSAGES] = {
+	"offsetToMaster", "offset health", "pathDelay",
+};
+
+static const int64_t values[] = {
+	0, 1, -1, 999, -123456789, INT64_MAX, INT64_MIN,
+};
+
+static const char *names[] = {
+	"eth0", "enp3s0.100", "quote\"back\\slash",
+	"ctl\b\f\n\r\t\x01\x1f\x7f", "gr\xc3\xb6\xc3\x9f" "e",
+};
+
+static RvJsonWriter writer;
+
+/* As publish_ptp_offset() and publish_ptp_path_delay() do. */
+static int encode_writer(enum message m, int64_t value, const char *name)
+{
+	switch (m) {
+	case OFFSET:
+		rv_json_writer_notification(&writer, "offsetToMaster");
+		rv_json_writer_int(&writer, "offset_nsec", value);
+		return rv_json_writer_notification_end(&writer);
+	case HEALTH:
+		rv_json_writer_health(&writer);
+		rv_json_writer_int(&writer, "value", value);
+		rv_json_writer_string(&writer, "unit", "ns");
+		return rv_json_writer_health_end(&writer);
+	case PATH_DELAY:
+	default:
+		rv_json_writer_notification(&writer, "pathDelay");
+		rv_json_writer_string(&writer, "port_name", name);
+		rv_json_writer_int(&writer, "path_delay_nsec", value);
+		return rv_json_writer_notification_end(&writer);
+	}
+}
+
+/*
+ * As the publishers did before, through rv_mqtt_publish_jsonrpc() and
+ * rv_mqtt_publish_health(). Returns a string to be freed.
+ */
+static char *encode_jansson(enum message m, int64_t value, const char *name)
+{
+	RvJsonRpcRequest request;
+	json_t *data, *encoded;
+	RvTimeUtc time_utc;
+	char *message;
+
+	data = json_object();
+	switch (m) {
+	case OFFSET:
+		json_object_set_new(data, "offset_nsec", json_integer(value));
+		break;
+	case HEALTH:
+		json_object_set_new(data, "value", json_integer(value));
+		json_object_set_new(data, "unit", json_string("ns"));
+		time_utc = rv_gettimeofday();
+		json_object_set_new(data, "timestamp",
+				    json_integer(time_utc.seconds));
+		message = json_dumps(data, 0);
+		json_decref(data);
+		return message;
+	case PATH_DELAY:
+		json_object_set_new(data, "port_name", json_string(name));
+		json_object_set_new(data, "path_delay_nsec", json_integer(value));
+		break;
+	default:
+		break;
+	}
+	rv_jsonrpc_request_ctor(&request, m == OFFSET ? "offsetToMaster" :
+				"pathDelay", data, NULL);
+	encoded = rv_jsonrpc_request_encode(&request);
+	message = encoded ? json_dumps(encoded, 0) : NULL;
+	json_decref(encoded);
+	rv_jsonrpc_request_dtor(&request);
+	json_decref(data);
+	return message;
+}
+
+/* Replaces the value of a member which differs from call to call by '*'. */
+static void mask_value(char *s, const char *key)
+{
+	char *p = strstr(s, key), *end;
+
+	if (!p)
+		return;
+	p += strlen(key);
+	if (*p == '"') {
+		end = strchr(p + 1, '"');
+		if (!end)
+			return;
+		end++;
+	} else {
+		end = p + strcspn(p, ",}");
+	}
+	memmove(p + 1, end, strlen(end) + 1);
+	*p = '*';
+}
+
+static void mask(char *s)
+{
+	mask_value(s, "\"timestamp\": ");
+	mask_value(s, "\"process_hash\": ");
+}
+
+/* Returns the number of messages which differ. */
+static int compare(void)
+{
+	char expected[RV_JSON_WRITER_SIZE], *message;
+	unsigned int i, j;
+	enum message m;
+	int errors = 0;
+
+	for (m = 0; m < N_MESSAGES; m++) {
+		for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+			for (j = 0; j < sizeof(names) / sizeof(names[0]); j++) {
+				message = encode_jansson(m, values[i], names[j]);
+				if (!message) {
+					/* jansson refuses the string */
+					continue;
+				}
+				snprintf(expected, sizeof(expected), "%s", message);
+				free(message);
+				if (encode_writer(m, values[i], names[j]) < 0) {
+					fprintf(stderr, "%s: writer overflow\n",
+						message_name[m]);
+					errors++;
+					continue;
+				}
+				mask(expected);
+				mask(writer.buffer);
+				if (strcmp(expected, writer.buffer)) {
+					fprintf(stderr, "%s differs:\n"
+						"  jansson: %s\n"
+						"  writer:  %s\n",
+						message_name[m], expected,
+						writer.buffer);
+					errors++;
+				}
+				if (m != PATH_DELAY)
+					break;
+			}
+		}
+	}
+	return errors;
+}
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench(enum message m, long n)
+{
+	unsigned long alloc_writer, alloc_jansson;
+	int64_t t_writer, t_jansson;
+	long i;
+
+	alloc_writer = allocations;
+	t_writer = now();
+	for (i = 0; i < n; i++)
+		encode_writer(m, i, "eth0");
+	t_writer = now() - t_writer;
+	alloc_writer = allocations - alloc_writer;
+
+	alloc_jansson = allocations;
+	t_jansson = now();
+	for (i = 0; i < n; i++)
+		free(encode_jansson(m, i, "eth0"));
+	t_jansson = now() - t_jansson;
+	alloc_jansson = allocations - alloc_jansson;
+
+	printf("%-15s writer %6.0f ns %5.1f allocs, "
+	       "jansson %6.0f ns %5.1f allocs\n", message_name[m],
+	       (double) t_writer / n, (double) alloc_writer / n,
+	       (double) t_jansson / n, (double) alloc_jansson / n);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -n [num]     messages per measurement, default 100000\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	char *progname;
+	enum message m;
+	long n = 100000;
+	int c, errors;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "n:hv"))) {
+		switch (c) {
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (n < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	errors = compare();
+	printf("%d messages differ from the jansson output\n", errors);
+
+	/* Warm up, so that one time allocations do not count. */
+	for (m = 0; m < N_MESSAGES; m++) {
+		encode_writer(m, 0, "eth0");
+		free(encode_jansson(m, 0, "eth0"));
+	}
+	for (m = 0; m < N_MESSAGES; m++)
+		bench(m, n);
+
+	return errors ? 1 : 0;
+}
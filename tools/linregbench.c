@@ -0,0 +1,562 @@
+/**
+ * @file linregbench.c
+ * @brief Compares the linreg servo with a copy computing full regressions.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../linreg.h"
+#include "../servo_private.h"
+#include "../version.h"
+
+#define NS_PER_SEC 1000000000LL
+/* Far below the noise, 0.1 ppb of slope and 1 % of RMS offset */
+#define MAX_SLOPE_DIFF 1e-10
+#define MAX_RMS_DIFF 0.01
+
+/*
+ * The linreg servo as it was before the running sums, which sums up all
+ * points of every size on each sample. Leap seconds are left out.
+ */
+#define MAX_SIZE 6
+#define MIN_SIZE 2
+
+#define MAX_POINTS (1 << MAX_SIZE)
+
+#define ERR_SMOOTH 0.02
+#define ERR_INITIAL_UPDATES 10
+#define ERR_EQUALS 1.05
+
+struct point {
+	uint64_t x;
+	uint64_t y;
+	double w;
+};
+
+struct result {
+	double slope;
+	double intercept;
+	double err;
+	int err_updates;
+};
+
+struct full_servo {
+	struct servo servo;
+	struct point points[MAX_POINTS];
+	struct point reference;
+	unsigned int num_points;
+	unsigned int last_point;
+	double x_remainder;
+	uint64_t last_update;
+	struct result results[MAX_SIZE - MIN_SIZE + 1];
+	unsigned int size;
+	double clock_freq;
+	double update_interval;
+	double frequency_ratio;
+};
+
+static void move_reference(struct full_servo *s, int64_t x, int64_t y)
+{
+	struct result *res;
+	unsigned int i;
+
+	s->reference.x += x;
+	s->reference.y += y;
+
+	for (i = MIN_SIZE; i <= MAX_SIZE; i++) {
+		res = &s->results[i - MIN_SIZE];
+		res->intercept += x * res->slope - y;
+	}
+}
+
+static void update_reference(struct full_servo *s, uint64_t local_ts)
+{
+	double x_interval;
+	int64_t y_interval;
+
+	if (s->last_update) {
+		y_interval = local_ts - s->last_update;
+
+		x_interval = y_interval / (1.0 + s->clock_freq / 1e9);
+		x_interval += s->x_remainder;
+		s->x_remainder = x_interval - (int64_t)x_interval;
+
+		move_reference(s, (int64_t)x_interval, y_interval);
+	}
+
+	s->last_update = local_ts;
+}
+
+static void add_sample(struct full_servo *s, int64_t offset, double weight)
+{
+	s->last_point = (s->last_point + 1) % MAX_POINTS;
+
+	s->points[s->last_point].x = s->reference.x;
+	s->points[s->last_point].y = s->reference.y - offset;
+	s->points[s->last_point].w = weight;
+
+	if (s->num_points < MAX_POINTS)
+		s->num_points++;
+}
+
+static void regress(struct full_servo *s)
+{
+	double x, y, y0, e, x_sum, y_sum, xy_sum, x2_sum, w, w_sum;
+	unsigned int i, l, n, size;
+	struct result *res;
+
+	x_sum = 0.0, y_sum = 0.0, xy_sum = 0.0, x2_sum = 0.0; w_sum = 0.0;
+	i = 0;
+
+	y0 = (int64_t)(s->points[s->last_point].y - s->reference.y);
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		n = 1 << size;
+		if (n > s->num_points)
+			break;
+
+		res = &s->results[size - MIN_SIZE];
+
+		if (res->slope) {
+			e = fabs(res->intercept - y0);
+			if (res->err_updates < ERR_INITIAL_UPDATES) {
+				res->err *= res->err_updates;
+				res->err += e;
+				res->err_updates++;
+				res->err /= res->err_updates;
+			} else {
+				res->err += ERR_SMOOTH * (e - res->err);
+			}
+		}
+
+		for (; i < n; i++) {
+			l = (MAX_POINTS + s->last_point - i) % MAX_POINTS;
+
+			x = (int64_t)(s->points[l].x - s->reference.x);
+			y = (int64_t)(s->points[l].y - s->reference.y);
+			w = s->points[l].w;
+
+			x_sum += x * w;
+			y_sum += y * w;
+			xy_sum += x * y * w;
+			x2_sum += x * x * w;
+			w_sum += w;
+		}
+
+		res->slope = (xy_sum - x_sum * y_sum / w_sum) /
+				(x2_sum - x_sum * x_sum / w_sum);
+		res->intercept = (y_sum - res->slope * x_sum) / w_sum;
+	}
+}
+
+static void update_size(struct full_servo *s)
+{
+	struct result *res;
+	double best_err;
+	int size, best_size;
+
+	best_size = 0;
+	best_err = 0.0;
+
+	for (size = MIN_SIZE; size <= MAX_SIZE; size++) {
+		res = &s->results[size - MIN_SIZE];
+		if ((!best_size && res->slope) ||
+		    (best_err * ERR_EQUALS > res->err &&
+		     res->err_updates >= ERR_INITIAL_UPDATES)) {
+			best_size = size;
+			best_err = res->err;
+		}
+	}
+
+	s->size = best_size;
+}
+
+static double full_sample(struct servo *servo, int64_t offset,
+			  uint64_t local_ts, double weight,
+			  enum servo_state *state)
+{
+	struct full_servo *s = container_of(servo, struct full_servo, servo);
+	struct result *res;
+	int corr_interval;
+
+	update_reference(s, local_ts);
+	add_sample(s, offset, weight);
+	regress(s);
+
+	update_size(s);
+
+	if (s->size < MIN_SIZE) {
+		*state = SERVO_UNLOCKED;
+		return -s->clock_freq;
+	}
+
+	res = &s->results[s->size - MIN_SIZE];
+
+	if ((servo->first_update &&
+	     servo->first_step_threshold &&
+	     servo->first_step_threshold < fabs(res->intercept)) ||
+	    (servo->step_threshold &&
+	     servo->step_threshold < fabs(res->intercept))) {
+		move_reference(s, 0, -offset);
+		s->last_update -= offset;
+		*state = SERVO_JUMP;
+	} else {
+		*state = SERVO_LOCKED;
+	}
+
+	s->clock_freq = 1e9 * (res->slope - 1.0);
+
+	corr_interval = s->size <= 4 ? 1 : s->size / 2;
+	s->clock_freq += res->intercept / s->update_interval / corr_interval;
+
+	if (s->clock_freq > servo->max_frequency)
+		s->clock_freq = servo->max_frequency;
+	else if (s->clock_freq < -servo->max_frequency)
+		s->clock_freq = -servo->max_frequency;
+
+	s->frequency_ratio = res->slope / (1.0 + s->clock_freq / 1e9);
+
+	return -s->clock_freq;
+}
+
+static void full_sync_interval(struct servo *servo, double interval)
+{
+	struct full_servo *s = container_of(servo, struct full_servo, servo);
+
+	s->update_interval = interval;
+}
+
+static void full_reset(struct servo *servo)
+{
+	struct full_servo *s = container_of(servo, struct full_servo, servo);
+	unsigned int i;
+
+	s->num_points = 0;
+	s->last_update = 0;
+	s->size = 0;
+	s->frequency_ratio = 1.0;
+
+	for (i = MIN_SIZE; i <= MAX_SIZE; i++) {
+		s->results[i - MIN_SIZE].slope = 0.0;
+		s->results[i - MIN_SIZE].err_updates = 0;
+	}
+}
+
+static double full_rate_ratio(struct servo *servo)
+{
+	struct full_servo *s = container_of(servo, struct full_servo, servo);
+
+	return s->frequency_ratio;
+}
+
+static void full_destroy(struct servo *servo)
+{
+	struct full_servo *s = container_of(servo, struct full_servo, servo);
+
+	free(s);
+}
+
+static struct servo *full_servo_create(int fadj)
+{
+	struct full_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = full_destroy;
+	s->servo.sample = full_sample;
+	s->servo.sync_interval = full_sync_interval;
+	s->servo.reset = full_reset;
+	s->servo.rate_ratio = full_rate_ratio;
+
+	s->clock_freq = -fadj;
+	s->frequency_ratio = 1.0;
+
+	return &s->servo;
+}
+
+/* One input of the servos, recorded for the timing runs. */
+struct input {
+	int64_t offset;
+	uint64_t local_ts;
+	double weight;
+};
+
+/*
+ * A simulated clock, starting at a current TAI time, with a slowly
+ * wandering frequency error. It is stepped by 10 ms after a third of
+ * the samples, and its servo is reset after two thirds.
+ */
+struct sim {
+	struct servo *servo;
+	int64_t master;
+	int64_t local;
+	double adj;
+	enum servo_state state;
+};
+
+static double gaussian(void)
+{
+	double u = (random() + 1.0) / (RAND_MAX + 2.0);
+	double v = (random() + 1.0) / (RAND_MAX + 2.0);
+
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static void sim_init(struct sim *sim, struct servo *servo, double interval,
+		     int steer)
+{
+	sim->servo = servo;
+	sim->master = 1500000000LL * NS_PER_SEC;
+	sim->local = sim->master + 2000;
+	sim->adj = 0.0;
+
+	servo->reset(servo);
+	/* Without steering, a zero maximum keeps the frequency at zero. */
+	servo->max_frequency = steer ? 900000000 : 0;
+	servo->step_threshold = steer ? 1000000 : 0;
+	servo->first_step_threshold = steer ? 20000 : 0;
+	servo->first_update = 1;
+	servo->sync_interval(servo, interval);
+}
+
+static void sim_step(struct sim *sim, struct input *in, long i, long n,
+		     double interval, double drift, double noise,
+		     double weight)
+{
+	struct servo *s = sim->servo;
+
+	if (i == n / 3)
+		sim->local += 10000000;
+	if (i == 2 * n / 3)
+		s->reset(s);
+
+	/* Only the intervals are doubles, at this time a double has 256 ns. */
+	sim->master += (int64_t) (interval * NS_PER_SEC);
+	sim->local += (int64_t) (interval * NS_PER_SEC *
+				 (1.0 + (drift - sim->adj) / 1e9));
+
+	in->offset = sim->local - sim->master + (int64_t) noise;
+	in->local_ts = sim->local;
+	in->weight = weight;
+
+	sim->adj = s->sample(s, in->offset, in->local_ts, weight, &sim->state);
+	s->first_update = 0;
+	if (sim->state == SERVO_JUMP)
+		sim->local -= in->offset;
+	if (!s->max_frequency)
+		sim->adj = 0.0;
+}
+
+/*
+ * Feeds identical samples of a free running clock to both servos and
+ * prints the largest difference of the slopes per tenth of the run. The
+ * frequency stays zero, so the rate ratio equals the slope. This covers
+ * many recomputations of the running sums. Returns the largest
+ * difference.
+ */
+static double compare_slopes(struct servo *full, struct servo *sums,
+			     struct input *in, long n, double interval)
+{
+	double drift = 37300.0, noise, weight, d, max = 0.0, seg = 0.0;
+	enum servo_state state;
+	struct sim sim;
+	long i;
+
+	sim_init(&sim, full, interval, 0);
+	sums->reset(sums);
+	sums->max_frequency = 0;
+	sums->sync_interval(sums, interval);
+	srandom(1);
+
+	printf("identical samples, free running clock\n"
+	       "  samples  max slope diff\n");
+	for (i = 0; i < n; i++) {
+		drift += 0.1 * gaussian();
+		noise = 50.0 * gaussian();
+		weight = 0.5 + 0.5 * random() / RAND_MAX;
+
+		sim_step(&sim, &in[i], i, n, interval, drift, noise, weight);
+		if (i == 2 * n / 3)
+			sums->reset(sums);
+		sums->sample(sums, in[i].offset, in[i].local_ts, weight, &state);
+
+		d = fabs(full->rate_ratio(full) - sums->rate_ratio(sums));
+		if (d > max)
+			max = d;
+		if (d > seg)
+			seg = d;
+		if ((i + 1) % (n / 10 ? n / 10 : 1) == 0) {
+			printf("%9ld %15.3e\n", i + 1, seg);
+			seg = 0.0;
+		}
+	}
+	return max;
+}
+
+/*
+ * Lets each servo steer its own clock through the same drift and noise.
+ * Rounding differences make the two loops part after a while, so only
+ * their performance is compared: the RMS offset per tenth of the run.
+ * Returns the largest relative difference of the RMS offsets.
+ */
+static double compare_loops(struct servo *full, struct servo *sums,
+			    struct input *in, long n, double interval)
+{
+	double drift = 37300.0, noise, weight, rms_a, rms_b, d, max = 0.0;
+	double sum_a = 0.0, sum_b = 0.0;
+	long i, seg = n / 10 ? n / 10 : 1;
+	struct input tmp;
+	struct sim a, b;
+
+	sim_init(&a, full, interval, 1);
+	sim_init(&b, sums, interval, 1);
+	srandom(1);
+
+	printf("servos steering their own clocks\n"
+	       "  samples  rms offset full  rms offset sums\n");
+	for (i = 0; i < n; i++) {
+		drift += 0.1 * gaussian();
+		noise = 50.0 * gaussian();
+		weight = 0.5 + 0.5 * random() / RAND_MAX;
+
+		sim_step(&a, &in[i], i, n, interval, drift, noise, weight);
+		sim_step(&b, &tmp, i, n, interval, drift, noise, weight);
+
+		sum_a += (double) in[i].offset * in[i].offset;
+		sum_b += (double) tmp.offset * tmp.offset;
+		if ((i + 1) % seg == 0) {
+			rms_a = sqrt(sum_a / seg);
+			rms_b = sqrt(sum_b / seg);
+			printf("%9ld %16.1f %16.1f\n", i + 1, rms_a, rms_b);
+			d = fabs(rms_a - rms_b) / rms_a;
+			if (d > max)
+				max = d;
+			sum_a = 0.0;
+			sum_b = 0.0;
+		}
+	}
+	return max;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double replay(struct servo *s, struct input *in, long n)
+{
+	enum servo_state state;
+	double t, sum = 0.0;
+	long i;
+
+	t = now();
+	for (i = 0; i < n; i++) {
+		sum += s->sample(s, in[i].offset, in[i].local_ts, in[i].weight,
+				 &state);
+		s->first_update = 0;
+	}
+	t = now() - t;
+
+	/* Keep the compiler from dropping the loop. */
+	if (sum == 1.0)
+		printf(" ");
+	return t / n;
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -n [num]     number of samples, default 1000000\n"
+		" -i [sec]     sync interval, default 0.125\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	double interval = 0.125, d_slope, d_rms;
+	struct servo *full, *sums;
+	long n = 1000000;
+	struct input *in;
+	struct sim sim;
+	char *progname;
+	int c;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "n:i:hv"))) {
+		switch (c) {
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 'i':
+			interval = atof(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (n < 1 || interval <= 0.0) {
+		usage(progname);
+		return -1;
+	}
+
+	full = full_servo_create(0);
+	sums = linreg_servo_create(0);
+	in = calloc(n, sizeof(*in));
+	if (!full || !sums || !in) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	d_slope = compare_slopes(full, sums, in, n, interval);
+	d_rms = compare_loops(full, sums, in, n, interval);
+
+	/* The inputs of the steering full servo are replayed for timing. */
+	sim_init(&sim, full, interval, 1);
+	sim_init(&sim, sums, interval, 1);
+	printf("full regression %.1f ns, running sums %.1f ns per sample\n",
+	       replay(full, in, n), replay(sums, in, n));
+
+	free(in);
+	full->destroy(full);
+	sums->destroy(sums);
+
+	return d_slope > MAX_SLOPE_DIFF || d_rms > MAX_RMS_DIFF ? 1 : 0;
+}
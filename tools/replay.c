@@ -0,0 +1,419 @@
+/**
+ * @file replay.c
+ * @brief Offline replay of captured time stamps through tsproc and a servo.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../config.h"
+#include "../ntpshm.h"
+#include "../print.h"
+#include "../servo.h"
+#include "../servo_private.h"
+#include "../tsproc.h"
+#include "../util.h"
+#include "../version.h"
+
+/*
+ * The replay reads the CSV written by capture2csv. Only the time stamps,
+ * corrections and asymmetries are used as input. The servo records tell
+ * how the captured clock was steered, which the clock model removes
+ * again before the simulated servo steers it.
+ */
+struct sample {
+	char type[8];
+	int64_t t1, t2, t3, t4;
+	double correction;
+	double asymmetry;
+	int64_t offset;
+	int state;
+	double adj;
+};
+
+/*
+ * The local clock as seen by the replay. Time stamps of the captured
+ * clock are moved by the difference between the phase the simulated
+ * servo and the captured servo have accumulated, plus an optional
+ * extra frequency error.
+ */
+struct clock_model {
+	double drift;		/* additional frequency error, ppb */
+	double sim_adj;		/* adjustment of the simulated servo, ppb */
+	double sim_phase;	/* ns */
+	double rec_adj;		/* adjustment of the captured servo, ppb */
+	double rec_phase;	/* ns */
+	int64_t last;		/* captured local time of the last update */
+	int started;
+};
+
+struct result {
+	double *time;		/* seconds since the first sample */
+	double *offset;		/* ns */
+	int n;
+	int size;
+	double lock_time;
+	int jumps;
+};
+
+/*
+ * Stand-in for the SHM and SOCK servos, which would otherwise attach a
+ * segment or send to chronyd.
+ */
+static double ntpshm_stub_sample(struct servo *servo, int64_t offset,
+				 uint64_t local_ts, double weight,
+				 enum servo_state *state)
+{
+	*state = SERVO_UNLOCKED;
+	return 0.0;
+}
+
+static void ntpshm_stub_destroy(struct servo *servo)
+{
+	free(servo);
+}
+
+static void ntpshm_stub_nop(struct servo *servo, double interval)
+{
+}
+
+static void ntpshm_stub_reset(struct servo *servo)
+{
+}
+
+static void ntpshm_stub_leap(struct servo *servo, int leap)
+{
+}
+
+struct servo *ntpshm_servo_create(struct config *cfg)
+{
+	struct servo *s = calloc(1, sizeof(*s));
+
+	if (!s)
+		return NULL;
+	s->destroy = ntpshm_stub_destroy;
+	s->sample = ntpshm_stub_sample;
+	s->sync_interval = ntpshm_stub_nop;
+	s->reset = ntpshm_stub_reset;
+	s->leap = ntpshm_stub_leap;
+	return s;
+}
+
+struct servo *ntpsock_servo_create(struct config *cfg)
+{
+	return ntpshm_servo_create(cfg);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options] capture.csv\n\n"
+		" -d [ppb]     add a frequency error to the local clock, default 0\n"
+		" -F [ppb]     start the servo from this frequency, as restored\n"
+		"              from a servo_state_file, default 0\n"
+		" -f [file]    read configuration from 'file', for the servo,\n"
+		"              tsproc, delay filter and outlier filter options\n"
+		" -m [ppb]     maximum frequency adjustment, default 500000\n"
+		" -t [ns]      offset threshold for convergence, default 1000\n"
+		" -l           print each sample as 'time offset adj state'\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+static int parse_sample(char *line, struct sample *s)
+{
+	unsigned int seq, port;
+
+	return sscanf(line, "%u,%7[^,],%u,%d,%" SCNd64 ",%" SCNd64 ",%" SCNd64
+		      ",%" SCNd64 ",%lf,%lf,%" SCNd64 ",%lf", &seq, s->type,
+		      &port, &s->state, &s->t1, &s->t2, &s->t3, &s->t4,
+		      &s->correction, &s->asymmetry, &s->offset,
+		      &s->adj) == 12 ? 0 : -1;
+}
+
+/* Advances the clock model to the captured local time 'ts'. */
+static void model_advance(struct clock_model *m, int64_t ts)
+{
+	double dt;
+
+	if (!m->started) {
+		m->last = ts;
+		m->started = 1;
+		return;
+	}
+	if (ts <= m->last)
+		return;
+	dt = (ts - m->last) * 1e-9;
+	/* clockadj_set_freq(-adj) slows the clock down by adj ppb. */
+	m->sim_phase += (m->drift - m->sim_adj) * dt;
+	m->rec_phase -= m->rec_adj * dt;
+	m->last = ts;
+}
+
+/* Maps a captured local time stamp to the simulated clock. */
+static tmv_t model_local(struct clock_model *m, int64_t ts)
+{
+	return ts + (int64_t) llround(m->sim_phase - m->rec_phase);
+}
+
+static int result_add(struct result *r, double t, double offset)
+{
+	if (r->n == r->size) {
+		int size = r->size ? 2 * r->size : 1024;
+		double *time = realloc(r->time, size * sizeof(*time));
+		double *off;
+
+		if (!time)
+			return -1;
+		r->time = time;
+		off = realloc(r->offset, size * sizeof(*off));
+		if (!off)
+			return -1;
+		r->offset = off;
+		r->size = size;
+	}
+	r->time[r->n] = t;
+	r->offset[r->n] = offset;
+	r->n++;
+	return 0;
+}
+
+static void result_report(struct result *r, double threshold)
+{
+	double sum = 0.0, max = 0.0;
+	int i, first;
+
+	printf("samples             %d\n", r->n);
+	printf("jumps               %d\n", r->jumps);
+	if (r->lock_time < 0)
+		printf("lock_time           never\n");
+	else
+		printf("lock_time           %.3f s\n", r->lock_time);
+
+	/* Converged from the first sample which all later ones stay near. */
+	for (first = r->n; first > 0; first--) {
+		if (fabs(r->offset[first - 1]) > threshold)
+			break;
+	}
+	if (first == r->n) {
+		printf("convergence_time    never\n");
+		return;
+	}
+	for (i = first; i < r->n; i++) {
+		sum += r->offset[i] * r->offset[i];
+		if (fabs(r->offset[i]) > max)
+			max = fabs(r->offset[i]);
+	}
+	printf("convergence_time    %.3f s\n", r->time[first]);
+	printf("steady_rms_offset   %.1f ns\n", sqrt(sum / (r->n - first)));
+	printf("steady_max_offset   %.0f ns\n", max);
+}
+
+int main(int argc, char *argv[])
+{
+	char *config = NULL, *progname, line[512];
+	int c, err = -1, list = 0, max_ppb = 500000, lineno = 0;
+	int have_interval = 0;
+	double threshold = 1000.0, weight, adj, interval;
+	struct clock_model model = { 0 };
+	struct result res = { .lock_time = -1 };
+	int64_t first_ts = 0, last_sync = 0;
+	struct servo *servo = NULL;
+	struct tsproc *tsp = NULL;
+	enum servo_state state;
+	struct config *cfg;
+	tmv_t offset, delay;
+	struct sample s;
+	FILE *fp;
+
+	/* Process the command line arguments. */
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1+progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "d:F:f:m:t:lhv"))) {
+		switch (c) {
+		case 'd':
+			model.drift = atof(optarg);
+			break;
+		case 'F':
+			model.sim_adj = atof(optarg);
+			break;
+		case 'f':
+			config = optarg;
+			break;
+		case 'm':
+			max_ppb = atoi(optarg);
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(progname);
+		return -1;
+	}
+
+	print_set_progname(progname);
+	print_set_syslog(0);
+	print_set_verbose(1);
+
+	cfg = config_create();
+	if (!cfg)
+		return -1;
+	if (config && config_read(config, cfg)) {
+		fprintf(stderr, "failed to read configuration file\n");
+		goto out;
+	}
+	print_set_level(config_get_int(cfg, NULL, "logging_level"));
+
+	tsp = tsproc_create(config_get_int(cfg, NULL, "tsproc_mode"),
+			    config_get_int(cfg, NULL, "delay_filter"),
+			    config_get_int(cfg, NULL, "delay_filter_length"),
+			    config_get_double(cfg, NULL, "step_threshold"),
+			    config_get_int(cfg, NULL, "outlier_filter_length"),
+			    config_get_double(cfg, NULL, "outlier_filter_percentile"),
+			    config_get_int(cfg, NULL, "outlier_filter_hysteresis"));
+	servo = servo_create(cfg, config_get_int(cfg, NULL, "clock_servo"),
+			     (int) model.sim_adj, max_ppb, config_get_int(cfg, NULL, "time_stamping")
+			     == TS_SOFTWARE);
+	if (!tsp || !servo) {
+		fprintf(stderr, "failed to create the servo pipeline\n");
+		goto out;
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (!fp) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (parse_sample(line, &s)) {
+			if (lineno > 1)
+				fprintf(stderr, "%s:%d: skipping bad line\n",
+					argv[optind], lineno);
+			continue;
+		}
+
+		if (!strcmp(s.type, "servo")) {
+			/* How the captured clock was steered. */
+			model_advance(&model, s.t2);
+			if (s.state == SERVO_JUMP)
+				model.rec_phase -= s.offset;
+			if (s.state != SERVO_UNLOCKED)
+				model.rec_adj = s.adj;
+			continue;
+		}
+
+		if (!strcmp(s.type, "delay")) {
+			model_advance(&model, s.t3);
+			tsproc_up_ts(tsp, model_local(&model, s.t3),
+				     s.t4 - (int64_t) llround(s.correction));
+			tsproc_update_delay(tsp, &delay);
+			continue;
+		}
+
+		if (!strcmp(s.type, "pdelay")) {
+			model_advance(&model, s.t4);
+			tsproc_up_ts(tsp, model_local(&model, s.t1), s.t2);
+			tsproc_down_ts(tsp, s.t3 + (int64_t) llround(s.correction +
+							s.asymmetry),
+				       model_local(&model, s.t4));
+			tsproc_update_delay(tsp, &delay);
+			continue;
+		}
+
+		if (strcmp(s.type, "sync"))
+			continue;
+
+		model_advance(&model, s.t2);
+		if (!first_ts)
+			first_ts = s.t2;
+		if (last_sync && !have_interval && s.t1 > last_sync) {
+			/* Round to the log interval, as announced on the wire. */
+			interval = pow(2.0, round(log2((s.t1 - last_sync) * 1e-9)));
+			servo_sync_interval(servo, interval);
+			have_interval = 1;
+		}
+		last_sync = s.t1;
+
+		tsproc_down_ts(tsp, s.t1 + (int64_t) llround(s.correction),
+			       model_local(&model, s.t2));
+		if (tsproc_update_offset(tsp, &offset, &weight))
+			continue;
+
+		servo_offset_variance(servo, tsproc_offset_variance(tsp));
+		adj = servo_sample(servo, tmv_to_nanoseconds(offset),
+				   model_local(&model, s.t2), weight, &state);
+		if (result_add(&res, (s.t2 - first_ts) * 1e-9, offset))
+			goto out_file;
+		if (list)
+			printf("%.6f %" PRId64 " %.1f %d\n",
+			       (s.t2 - first_ts) * 1e-9, offset, adj, state);
+
+		switch (state) {
+		case SERVO_UNLOCKED:
+			break;
+		case SERVO_JUMP:
+			model.sim_adj = adj;
+			model.sim_phase -= offset;
+			tsproc_reset(tsp, 0);
+			res.jumps++;
+			break;
+		case SERVO_LOCKED:
+			model.sim_adj = adj;
+			if (res.lock_time < 0)
+				res.lock_time = (s.t2 - first_ts) * 1e-9;
+			break;
+		}
+	}
+
+	result_report(&res, threshold);
+	err = 0;
+out_file:
+	fclose(fp);
+out:
+	if (servo)
+		servo_destroy(servo);
+	if (tsp)
+		tsproc_destroy(tsp);
+	free(res.time);
+	free(res.offset);
+	config_destroy(cfg);
+	return err;
+}
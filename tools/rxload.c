@@ -0,0 +1,382 @@
+/**
+ * @file rxload.c
+ * @brief Load test of the receive path, with and without a receive thread.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "../msg.h"
+#include "../print.h"
+#include "../rxthread.h"
+#include "../transport_private.h"
+#include "../version.h"
+
+#define NS_PER_SEC 1000000000LL
+#define MAX_SAMPLES 1000000
+
+/*
+ * Two ports, each a datagram socket pair. The master port is flooded
+ * with Delay_Req messages, which cost a configurable time to handle,
+ * and the slave port gets Sync messages at a steady rate. Both carry
+ * the time of sending in the origin time stamp. The delay from sending
+ * to handling of the Sync messages is what the load adds to the path
+ * of the slave port to the servo.
+ */
+enum { MASTER, SLAVE, N_PORTS };
+
+struct load {
+	int tx[N_PORTS];
+	int rx[N_PORTS];
+	int master_rate;	/* messages per second */
+	int slave_rate;		/* messages per second */
+	int running;
+	long sent[N_PORTS];
+};
+
+static struct load load;
+
+static int64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void burn(int64_t ns)
+{
+	int64_t end = now() + ns;
+
+	while (now() < end)
+		;
+}
+
+static int sock_recv_batch(struct transport *t, int fd, void *buf[],
+			   int buflen, struct address *addr[],
+			   struct hw_timestamp *hwts[], int cnt[], int n)
+{
+	struct mmsghdr msg[TRANSPORT_RECV_BATCH];
+	struct iovec iov[TRANSPORT_RECV_BATCH];
+	int i, res;
+
+	memset(msg, 0, sizeof(msg));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = buflen;
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	res = recvmmsg(fd, msg, n, MSG_DONTWAIT, NULL);
+	if (res < 0)
+		return errno == EAGAIN ? 0 : -1;
+	for (i = 0; i < res; i++) {
+		cnt[i] = msg[i].msg_len;
+		hwts[i]->ts.tv_sec = 1;
+		hwts[i]->ts.tv_nsec = 0;
+	}
+	return res;
+}
+
+static struct transport sock_transport = {
+	.recv_batch = sock_recv_batch,
+};
+
+static void send_msg(int fd, int type, uint16_t seq)
+{
+	struct sync_msg m;
+	int64_t ts = now();
+
+	memset(&m, 0, sizeof(m));
+	m.hdr.tsmt = type;
+	m.hdr.ver = PTP_VERSION;
+	m.hdr.messageLength = htons(sizeof(m));
+	m.hdr.sequenceId = htons(seq);
+	m.originTimestamp.seconds_lsb = htonl(ts / NS_PER_SEC);
+	m.originTimestamp.nanoseconds = htonl(ts % NS_PER_SEC);
+	if (send(fd, &m, sizeof(m), MSG_DONTWAIT) == sizeof(m))
+		load.sent[type == SYNC ? SLAVE : MASTER]++;
+}
+
+/* Sends in steps of a millisecond, so that the master load is bursty. */
+static void *sender(void *arg)
+{
+	int64_t next = now();
+	uint16_t seq[N_PORTS] = { 0 };
+	double due[N_PORTS] = { 0.0 };
+
+	while (__atomic_load_n(&load.running, __ATOMIC_RELAXED)) {
+		due[MASTER] += load.master_rate / 1000.0;
+		due[SLAVE] += load.slave_rate / 1000.0;
+		for (; due[SLAVE] >= 1.0; due[SLAVE] -= 1.0)
+			send_msg(load.tx[SLAVE], SYNC, seq[SLAVE]++);
+		for (; due[MASTER] >= 1.0; due[MASTER] -= 1.0)
+			send_msg(load.tx[MASTER], DELAY_REQ, seq[MASTER]++);
+		next += 1000000;
+		while (now() < next)
+			usleep(100);
+	}
+	return NULL;
+}
+
+static int open_port(int *tx, int *rx)
+{
+	int fd[2], size = 4 << 20;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fd))
+		return -1;
+	setsockopt(fd[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(fd[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	*tx = fd[0];
+	*rx = fd[1];
+	return 0;
+}
+
+/* Takes one batch of a port, as port_rx_queue() does without a thread. */
+static int recv_inline(int fd, struct ptp_message *msg[], int cnt[],
+		       int err[])
+{
+	struct hw_timestamp *hwts[TRANSPORT_RECV_BATCH];
+	struct address *addr[TRANSPORT_RECV_BATCH];
+	void *buf[TRANSPORT_RECV_BATCH];
+	int i, n;
+
+	for (i = 0; i < TRANSPORT_RECV_BATCH; i++) {
+		msg[i] = msg_allocate();
+		if (!msg[i])
+			break;
+		buf[i] = &msg[i]->data;
+		hwts[i] = &msg[i]->hwts;
+		addr[i] = &msg[i]->address;
+	}
+	n = sock_recv_batch(&sock_transport, fd, buf, sizeof(msg[0]->data),
+			    addr, hwts, cnt, i);
+	if (n < 0)
+		n = 0;
+	while (i > n)
+		msg_put(msg[--i]);
+	for (i = 0; i < n; i++)
+		err[i] = msg_post_recv(msg[i], cnt[i]);
+	return n;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -t           receive on a thread, as with rx_threads,\n"
+		"              default is to receive on the main thread\n"
+		" -c [cpu]     bind the receive thread to this CPU\n"
+		" -l [num]     length of the receive queues, default %d\n"
+		" -m [num]     Delay_Req messages per second on the master port,\n"
+		"              default 100000\n"
+		" -s [num]     Sync messages per second on the slave port,\n"
+		"              default 1000\n"
+		" -w [ns]      time to handle a Delay_Req message, default 2000\n"
+		" -d [sec]     duration of the test, default 10\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname, rxq_length(128, N_PORTS));
+}
+
+int main(int argc, char *argv[])
+{
+	char *progname;
+	int c, cpu = -1, duration = 10, threaded = 0, work = 2000;
+	int cnt[TRANSPORT_RECV_BATCH], err[TRANSPORT_RECV_BATCH];
+	int i, k, n, nev, length = rxq_length(128, N_PORTS), ep;
+	struct ptp_message *msg[TRANSPORT_RECV_BATCH];
+	struct epoll_event ev, events[N_PORTS];
+	struct fdarray fda[N_PORTS];
+	struct rxq *rxq[N_PORTS] = { NULL };
+	struct rxthread *rxt = NULL;
+	double *delay, mean, sum = 0.0, sum2 = 0.0;
+	long handled[N_PORTS] = { 0 }, nd = 0, invalid = 0;
+	int64_t end, sent;
+	pthread_t thread;
+
+	load.master_rate = 100000;
+	load.slave_rate = 1000;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "tc:l:m:s:w:d:hv"))) {
+		switch (c) {
+		case 't':
+			threaded = 1;
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'l':
+			length = atoi(optarg);
+			break;
+		case 'm':
+			load.master_rate = atoi(optarg);
+			break;
+		case 's':
+			load.slave_rate = atoi(optarg);
+			break;
+		case 'w':
+			work = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (length < 2 || length & (length - 1) || length > 32 ||
+	    load.slave_rate < 1 || duration < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	print_set_progname(progname);
+	print_set_verbose(1);
+	print_set_syslog(0);
+
+	delay = calloc(MAX_SAMPLES, sizeof(*delay));
+	if (!delay || msg_pool_init(128 + N_PORTS * TRANSPORT_RECV_BATCH +
+				    N_PORTS * rxq_reserve(length), 0, 0)) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	ep = epoll_create1(0);
+	if (ep < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+	if (threaded) {
+		rxt = rxthread_create(cpu);
+		if (!rxt)
+			return -1;
+	}
+	for (k = 0; k < N_PORTS; k++) {
+		if (open_port(&load.tx[k], &load.rx[k])) {
+			perror("socketpair");
+			return -1;
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = k;
+		if (threaded) {
+			/* The general descriptor stays idle. */
+			rxq[k] = rxq_create(rxt, &sock_transport, TS_SOFTWARE,
+					    length);
+			fda[k].fd[FD_EVENT] = load.rx[k];
+			fda[k].fd[FD_GENERAL] = dup(load.tx[k]);
+			if (!rxq[k] || rxq_attach(rxq[k], &fda[k]))
+				return -1;
+			epoll_ctl(ep, EPOLL_CTL_ADD, rxq_fd(rxq[k]), &ev);
+		} else {
+			epoll_ctl(ep, EPOLL_CTL_ADD, load.rx[k], &ev);
+		}
+	}
+
+	__atomic_store_n(&load.running, 1, __ATOMIC_RELAXED);
+	if (pthread_create(&thread, NULL, sender, NULL)) {
+		fprintf(stderr, "failed to start the sender\n");
+		return -1;
+	}
+	end = now() + duration * NS_PER_SEC;
+	while (now() < end) {
+		nev = epoll_wait(ep, events, N_PORTS, 100);
+		for (i = 0; i < nev; i++) {
+			k = events[i].data.u32;
+			n = threaded ?
+				rxq_recv(rxq[k], msg, cnt, err,
+					 TRANSPORT_RECV_BATCH) :
+				recv_inline(load.rx[k], msg, cnt, err);
+			for (c = 0; c < n; c++) {
+				if (cnt[c] <= 0 || err[c]) {
+					invalid++;
+				} else if (k == SLAVE && nd < MAX_SAMPLES) {
+					sent = tmv_to_nanoseconds(
+						timestamp_to_tmv(msg[c]->ts.pdu));
+					delay[nd++] = (now() - sent) / 1e3;
+				} else if (k == MASTER) {
+					burn(work);
+				}
+				handled[k]++;
+				msg_put(msg[c]);
+			}
+		}
+	}
+	__atomic_store_n(&load.running, 0, __ATOMIC_RELAXED);
+	pthread_join(thread, NULL);
+
+	for (k = 0; k < N_PORTS; k++) {
+		if (rxq[k]) {
+			rxq_destroy(rxq[k]);
+			close(fda[k].fd[FD_GENERAL]);
+		}
+	}
+	if (rxt)
+		rxthread_destroy(rxt);
+	if (!nd) {
+		fprintf(stderr, "no Sync message handled\n");
+		return -1;
+	}
+
+	sent = load.sent[MASTER];
+	qsort(delay, nd, sizeof(*delay), cmp_double);
+	for (i = 0; i < nd; i++) {
+		sum += delay[i];
+		sum2 += delay[i] * delay[i];
+	}
+	mean = sum / nd;
+	printf("%s, queue length %d\n", threaded ? "receive thread" : "inline",
+	       threaded ? length : TRANSPORT_RECV_BATCH);
+	printf("master: %ld of %lld Delay_Req handled\n", handled[MASTER],
+	       (long long) sent);
+	printf("slave: %ld of %ld Sync handled, %ld invalid\n", handled[SLAVE],
+	       load.sent[SLAVE], invalid);
+	printf("slave delay us: mean %.1f sd %.1f p50 %.1f p99 %.1f "
+	       "p99.9 %.1f max %.1f\n", mean,
+	       sqrt(fmax(sum2 / nd - mean * mean, 0.0)), delay[nd / 2],
+	       delay[nd * 99 / 100], delay[nd * 999 / 1000], delay[nd - 1]);
+	free(delay);
+	msg_cleanup();
+	return 0;
+}
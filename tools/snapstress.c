@@ -0,0 +1,158 @@
+/**
+ * @file snapstress.c
+ * @brief Stress test of the clock state snapshot shared between threads.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../rv_ptp_snapshot.h"
+#include "../version.h"
+
+/*
+ * The writer publishes state number g with every byte set to the low
+ * byte of g, except for the offset, which holds g itself. A copy is
+ * consistent if all of its bytes agree with its offset, and if the
+ * returned generation is the one of that write. Torn copies mix the
+ * bytes of two states.
+ */
+struct stress {
+	RvPtpSnapshot snapshot;
+	long writes;
+	int done;
+};
+
+static struct stress stress;
+
+static void fill(RvPtpClockState *state, int64_t g)
+{
+	memset(state, g & 0xff, sizeof(*state));
+	state->offset = g;
+}
+
+static int check(const RvPtpClockState *state, unsigned int generation)
+{
+	const unsigned char *p = (const unsigned char *) state;
+	unsigned char b = state->offset & 0xff;
+	size_t i, skip = offsetof(RvPtpClockState, offset);
+
+	if (generation != 2 * (unsigned int) state->offset)
+		return -1;
+	for (i = 0; i < sizeof(*state); i++) {
+		if (i >= skip && i < skip + sizeof(state->offset))
+			continue;
+		if (p[i] != b)
+			return -1;
+	}
+	return 0;
+}
+
+static void *writer(void *arg)
+{
+	RvPtpClockState state;
+	long g;
+
+	for (g = 1; g <= stress.writes; g++) {
+		fill(&state, g);
+		rv_ptp_snapshot_write(&stress.snapshot, &state);
+	}
+	__atomic_store_n(&stress.done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -n [num]     number of writes, default 10000000\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	long reads = 0, changes = 0, errors = 0;
+	unsigned int generation, last = 0;
+	RvPtpClockState state;
+	char *progname;
+	pthread_t thread;
+	int c;
+
+	stress.writes = 10000000;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "n:hv"))) {
+		switch (c) {
+		case 'n':
+			stress.writes = atol(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (stress.writes < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	fill(&stress.snapshot.state, 0);
+	if (pthread_create(&thread, NULL, writer, NULL)) {
+		fprintf(stderr, "failed to start the writer\n");
+		return -1;
+	}
+	while (!__atomic_load_n(&stress.done, __ATOMIC_ACQUIRE)) {
+		generation = rv_ptp_snapshot_read(&stress.snapshot, &state);
+		reads++;
+		if (check(&state, generation)) {
+			if (errors++ < 10)
+				fprintf(stderr, "torn copy: generation %u, "
+					"offset %lld\n", generation,
+					(long long) state.offset);
+		} else if (generation < last) {
+			if (errors++ < 10)
+				fprintf(stderr, "generation %u after %u\n",
+					generation, last);
+		}
+		changes += generation != last;
+		last = generation;
+	}
+	pthread_join(thread, NULL);
+
+	generation = rv_ptp_snapshot_read(&stress.snapshot, &state);
+	if (check(&state, generation) || state.offset != stress.writes)
+		errors++;
+
+	printf("%ld writes, %ld reads, %ld new states seen, %ld errors\n",
+	       stress.writes, reads, changes, errors);
+	return errors ? 1 : 0;
+}
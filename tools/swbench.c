@@ -0,0 +1,294 @@
+/**
+ * @file swbench.c
+ * @brief Checks and times the sliding window against a sorted array.
+ * @note Copyright (C) 2017, ALC NetworX GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../swindow.h"
+#include "../version.h"
+
+#define MIN_LENGTH 8
+#define MAX_LENGTH 4096
+
+/* Ranks checked besides the median, as outlier_detect uses them. */
+static const double ranks[] = { 0.1, 0.9, 1.0 };
+
+#define N_RANKS (sizeof(ranks) / sizeof(ranks[0]))
+
+/*
+ * The reference keeps the window sorted by insertion, as mmedian did
+ * before the sliding window, which costs O(length) per sample.
+ */
+struct reference {
+	int len;
+	int cnt;
+	int index;
+	tmv_t *samples;
+	tmv_t *sorted;
+};
+
+static int reference_init(struct reference *r, int length)
+{
+	r->len = length;
+	r->cnt = 0;
+	r->index = 0;
+	r->samples = calloc(length, sizeof(*r->samples));
+	r->sorted = calloc(length, sizeof(*r->sorted));
+	return r->samples && r->sorted ? 0 : -1;
+}
+
+static void reference_destroy(struct reference *r)
+{
+	free(r->samples);
+	free(r->sorted);
+}
+
+static void reference_add(struct reference *r, tmv_t sample)
+{
+	int i;
+
+	if (r->cnt == r->len) {
+		/* Remove one copy of the replaced value. */
+		for (i = 0; i < r->cnt; i++)
+			if (r->sorted[i] == r->samples[r->index])
+				break;
+		for (; i + 1 < r->cnt; i++)
+			r->sorted[i] = r->sorted[i + 1];
+		r->cnt--;
+	}
+	for (i = r->cnt; i > 0 && r->sorted[i - 1] > sample; i--)
+		r->sorted[i] = r->sorted[i - 1];
+	r->sorted[i] = sample;
+	r->cnt++;
+
+	r->samples[r->index] = sample;
+	r->index = (1 + r->index) % r->len;
+}
+
+static void reference_reset(struct reference *r)
+{
+	r->cnt = 0;
+	r->index = 0;
+}
+
+static tmv_t reference_median(struct reference *r)
+{
+	if (r->cnt % 2)
+		return r->sorted[r->cnt / 2];
+	else
+		return tmv_div(tmv_add(r->sorted[r->cnt / 2 - 1],
+				       r->sorted[r->cnt / 2]), 2);
+}
+
+/* Smallest sample with at least the fraction 'rank' at or below it. */
+static tmv_t reference_rank(struct reference *r, double rank)
+{
+	int k = (int) ceil(rank * r->cnt - 1e-9);
+
+	if (k < 1)
+		k = 1;
+	if (k > r->cnt)
+		k = r->cnt;
+	return r->sorted[k - 1];
+}
+
+/*
+ * Random samples, from a small range in every other block so that
+ * duplicates are common, and ascending runs now and then.
+ */
+static tmv_t next_sample(long i)
+{
+	switch ((i / 1000) % 4) {
+	case 0:
+		return random() % 16 - 8;
+	case 1:
+		return i;
+	default:
+		return (tmv_t) random() * (random() & 1 ? 1 : -1);
+	}
+}
+
+/* Returns the number of mismatches over 'n' samples. */
+static long check(int length, long n)
+{
+	struct swindow *w[1 + N_RANKS];
+	struct reference r;
+	long errors = 0, i;
+	unsigned int j;
+	tmv_t sample;
+
+	w[0] = swindow_create(length, 0.5);
+	for (j = 0; j < N_RANKS; j++)
+		w[1 + j] = swindow_create(length, ranks[j]);
+	if (reference_init(&r, length)) {
+		fprintf(stderr, "out of memory\n");
+		exit(-1);
+	}
+	for (j = 0; j < 1 + N_RANKS; j++) {
+		if (!w[j]) {
+			fprintf(stderr, "failed to create the window\n");
+			exit(-1);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		/* Also check that a reset window starts over. */
+		if (i == n / 2) {
+			reference_reset(&r);
+			for (j = 0; j < 1 + N_RANKS; j++)
+				swindow_reset(w[j]);
+		}
+		sample = next_sample(i);
+		reference_add(&r, sample);
+		for (j = 0; j < 1 + N_RANKS; j++)
+			swindow_add(w[j], sample);
+
+		if (swindow_count(w[0]) != r.cnt ||
+		    swindow_median(w[0]) != reference_median(&r)) {
+			if (errors++ < 10)
+				fprintf(stderr, "length %d sample %ld: median "
+					"%lld, expected %lld\n", length, i,
+					(long long) swindow_median(w[0]),
+					(long long) reference_median(&r));
+		}
+		for (j = 0; j < N_RANKS; j++) {
+			if (swindow_rank(w[1 + j]) == reference_rank(&r, ranks[j]))
+				continue;
+			if (errors++ < 10)
+				fprintf(stderr, "length %d sample %ld: rank %.1f "
+					"%lld, expected %lld\n", length, i,
+					ranks[j],
+					(long long) swindow_rank(w[1 + j]),
+					(long long) reference_rank(&r, ranks[j]));
+		}
+	}
+
+	for (j = 0; j < 1 + N_RANKS; j++)
+		swindow_destroy(w[j]);
+	reference_destroy(&r);
+	return errors;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Prints the ns per sample of the window and of the reference. */
+static void bench(int length, long n)
+{
+	double t_window, t_reference;
+	struct reference r;
+	struct swindow *w;
+	tmv_t *samples;
+	tmv_t sum = 0;
+	long i;
+
+	w = swindow_create(length, 0.5);
+	samples = calloc(n, sizeof(*samples));
+	if (!w || !samples || reference_init(&r, length)) {
+		fprintf(stderr, "out of memory\n");
+		exit(-1);
+	}
+	for (i = 0; i < n; i++)
+		samples[i] = random() - RAND_MAX / 2;
+
+	t_window = now();
+	for (i = 0; i < n; i++) {
+		swindow_add(w, samples[i]);
+		sum += swindow_median(w);
+	}
+	t_window = now() - t_window;
+
+	t_reference = now();
+	for (i = 0; i < n; i++) {
+		reference_add(&r, samples[i]);
+		sum -= reference_median(&r);
+	}
+	t_reference = now() - t_reference;
+
+	printf("%6d %12.1f %12.1f %8.1f%s\n", length, t_window / n,
+	       t_reference / n, t_reference / t_window,
+	       sum ? "  (medians differ)" : "");
+
+	reference_destroy(&r);
+	free(samples);
+	swindow_destroy(w);
+}
+
+static void usage(char *progname)
+{
+	fprintf(stderr,
+		"\n"
+		"usage: %s [options]\n\n"
+		" -n [num]     samples per window length, default 1000000\n"
+		" -h           prints this message and exits\n"
+		" -v           prints the software version and exits\n"
+		"\n",
+		progname);
+}
+
+int main(int argc, char *argv[])
+{
+	long n = 1000000, errors = 0;
+	char *progname;
+	int c, length;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? 1 + progname : argv[0];
+	while (EOF != (c = getopt(argc, argv, "n:hv"))) {
+		switch (c) {
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 'v':
+			version_show(stdout);
+			return 0;
+		case 'h':
+			usage(progname);
+			return 0;
+		case '?':
+		default:
+			usage(progname);
+			return -1;
+		}
+	}
+	if (n < 1) {
+		usage(progname);
+		return -1;
+	}
+
+	srandom(1);
+	for (length = MIN_LENGTH; length <= MAX_LENGTH; length *= 2)
+		errors += check(length, 10L * length + 10000);
+	printf("%ld mismatches against the sorted array\n\n", errors);
+
+	printf("length    window ns  sorted ns    ratio\n");
+	for (length = MIN_LENGTH; length <= MAX_LENGTH; length *= 2)
+		bench(length, n);
+
+	return errors ? 1 : 0;
+}
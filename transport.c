@@ -42,6 +42,35 @@ int transport_recv(struct transport *t, int fd, struct ptp_message *msg)
 	return t->recv(t, fd, msg, sizeof(msg->data), &msg->address, &msg->hwts);
 }
 
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message *msg[], int cnt[], int n)
+{
+	struct hw_timestamp *hwts[TRANSPORT_RECV_BATCH];
+	struct address *addr[TRANSPORT_RECV_BATCH];
+	void *buf[TRANSPORT_RECV_BATCH];
+	int i;
+
+	if (!t->recv_batch || n < 2) {
+		cnt[0] = transport_recv(t, fd, msg[0]);
+		return cnt[0] < 0 ? cnt[0] : 1;
+	}
+	if (n > TRANSPORT_RECV_BATCH)
+		n = TRANSPORT_RECV_BATCH;
+
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		addr[i] = &msg[i]->address;
+		hwts[i] = &msg[i]->hwts;
+	}
+	return t->recv_batch(t, fd, buf, sizeof(msg[0]->data), addr, hwts,
+			     cnt, n);
+}
+
+int transport_can_recv_batch(struct transport *t)
+{
+	return t->recv_batch ? 1 : 0;
+}
+
 int transport_send(struct transport *t, struct fdarray *fda, int event,
 		   struct ptp_message *msg)
 {
@@ -66,6 +95,43 @@ int transport_sendto(struct transport *t, struct fdarray *fda, int event,
 	return t->send(t, fda, event, 0, msg, len, &msg->address, &msg->hwts);
 }
 
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message *msg[], int n)
+{
+	struct address *addr[TRANSPORT_SEND_BATCH];
+	int i, cnt, len[TRANSPORT_SEND_BATCH];
+	void *buf[TRANSPORT_SEND_BATCH];
+
+	if (n > TRANSPORT_SEND_BATCH)
+		n = TRANSPORT_SEND_BATCH;
+
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		len[i] = ntohs(msg[i]->header.messageLength);
+		addr[i] = msg[i]->header.flagField[0] & UNICAST ?
+			&msg[i]->address : NULL;
+	}
+	if (t->send_batch) {
+		return t->send_batch(t, fda, buf, len, addr, n);
+	}
+	for (i = 0; i < n; i++) {
+		cnt = t->send(t, fda, 0, 0, buf[i], len[i], addr[i],
+			      &msg[i]->hwts);
+		if (cnt <= 0)
+			return i ? i : -1;
+	}
+	return n;
+}
+
+int transport_txts(struct transport *t, struct fdarray *fda,
+		   void *buf, int buflen, struct hw_timestamp *hwts)
+{
+	if (t->txts) {
+		return t->txts(t, fda, buf, buflen, hwts);
+	}
+	return -1;
+}
+
 int transport_physical_addr(struct transport *t, uint8_t *addr)
 {
 	if (t->physical_addr) {
@@ -48,6 +48,7 @@ enum transport_event {
 	TRANS_GENERAL,
 	TRANS_EVENT,
 	TRANS_ONESTEP,
+	TRANS_DEFER_EVENT, /* event message, time stamp via transport_txts() */
 };
 
 struct transport;
@@ -59,6 +60,34 @@ int transport_open(struct transport *t, const char *name,
 
 int transport_recv(struct transport *t, int fd, struct ptp_message *msg);
 
+/**
+ * The largest batch accepted by transport_recv_batch().
+ */
+#define TRANSPORT_RECV_BATCH 16
+
+/**
+ * Receives the messages waiting on a descriptor, up to a given number.
+ * Transports without batch support read exactly one message.
+ * @param t	The transport.
+ * @param fd	The descriptor to read from.
+ * @param msg	Array of 'n' messages to receive into.
+ * @param cnt	Array of 'n' integers to receive the message lengths.
+ * @param n	Number of messages, at most TRANSPORT_RECV_BATCH.
+ * @return	Number of messages received, or negative value in case
+ *		of an error.
+ */
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message *msg[], int cnt[], int n);
+
+/**
+ * Tells whether the transport supports transport_recv_batch() natively.
+ * Such transports never block in transport_recv_batch() when passed
+ * at least two messages, they return zero if nothing is waiting.
+ * @param t	The transport.
+ * @return	One if batches are supported, zero otherwise.
+ */
+int transport_can_recv_batch(struct transport *t);
+
 /**
  * Sends the PTP message using the given transport. The message is sent to
  * the default (usually multicast) address, any address field in the
@@ -98,6 +127,40 @@ int transport_peer(struct transport *t, struct fdarray *fda, int event,
 int transport_sendto(struct transport *t, struct fdarray *fda, int event,
 		     struct ptp_message *msg);
 
+/**
+ * The largest batch accepted by transport_send_batch().
+ */
+#define TRANSPORT_SEND_BATCH 16
+
+/**
+ * Sends a number of general messages. Messages flagged as UNICAST go to
+ * the address in their address field, all others go to the default
+ * address. Transports without batch support send them one by one.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param msg	Array of 'n' messages, already prepared for sending.
+ * @param n	Number of messages, at most TRANSPORT_SEND_BATCH.
+ * @return	Number of messages sent, or negative value if none were
+ *		sent.
+ */
+int transport_send_batch(struct transport *t, struct fdarray *fda,
+			 struct ptp_message *msg[], int n);
+
+/**
+ * Collects one transmit time stamp of an event message which was sent
+ * with TRANS_DEFER_EVENT. This call never waits.
+ * @param t	 The transport.
+ * @param fda	 The array of descriptors filled in by transport_open.
+ * @param buf	 Buffer to receive the looped back frame. The PTP message
+ *		 is found at the end of the frame.
+ * @param buflen Size of 'buf' in bytes.
+ * @param hwts	 Receives the time stamp. The 'type' field must be set.
+ * @return	 Number of bytes in 'buf', or negative value when no time
+ *		 stamp is pending or in case of an error.
+ */
+int transport_txts(struct transport *t, struct fdarray *fda,
+		   void *buf, int buflen, struct hw_timestamp *hwts);
+
 /**
  * Returns the transport's type.
  */
@@ -22,8 +22,12 @@
 
 #include "tsproc.h"
 #include "filter.h"
+#include "outlier_detect.h"
 #include "print.h"
 
+/* Number of delay samples over which the delay variance is averaged */
+#define DELAY_VAR_LENGTH 32
+
 struct tsproc {
 	/* Processing options */
 	int raw_mode;
@@ -43,6 +47,10 @@ struct tsproc {
 	/* Current filtered delay */
 	tmv_t filtered_delay;
 
+	/* Variance of the raw delay around the filtered delay in ns^2 */
+	double delay_var;
+	int delay_var_count;
+
 	/* Delay filter */
 	struct filter *delay_filter;
 
@@ -51,7 +59,9 @@ struct tsproc {
 };
 
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length, double step_threshold)
+			     enum filter_type delay_filter, int filter_length, double step_threshold,
+			     int outlier_length, double outlier_percentile,
+			     int outlier_hysteresis)
 {
 	struct tsproc *tsp;
 
@@ -87,7 +97,9 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 		return NULL;
 	}
 
-	tsp->outlier_detection_filter = filter_create(FILTER_OUTLIER_DETECT, 10, step_threshold);
+	tsp->outlier_detection_filter = outlier_detect_create(outlier_length, step_threshold,
+							      outlier_percentile,
+							      outlier_hysteresis);
     if(!tsp->outlier_detection_filter) {
         filter_destroy(tsp->delay_filter);
         free(tsp);
@@ -159,6 +171,7 @@ tmv_t get_raw_delay(struct tsproc *tsp)
 int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 {
 	tmv_t raw_delay;
+	double dev;
 
 	if (tmv_is_zero(tsp->t2) || tmv_is_zero(tsp->t3))
 		return -1;
@@ -166,6 +179,11 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 	raw_delay = get_raw_delay(tsp);
 	tsp->filtered_delay = filter_sample(tsp->delay_filter, raw_delay);
 
+	dev = tmv_to_nanoseconds(tmv_sub(raw_delay, tsp->filtered_delay));
+	if (tsp->delay_var_count < DELAY_VAR_LENGTH)
+		tsp->delay_var_count++;
+	tsp->delay_var += (dev * dev - tsp->delay_var) / tsp->delay_var_count;
+
 	pr_debug("delay   filtered %10" PRId64 "   raw %10" PRId64,
 		 tsp->filtered_delay, raw_delay);
 
@@ -224,5 +242,19 @@ void tsproc_reset(struct tsproc *tsp, int full)
 	if (full) {
 		tsp->clock_rate_ratio = 1.0;
 		filter_reset(tsp->delay_filter);
+		tsp->delay_var = 0.0;
+		tsp->delay_var_count = 0;
 	}
 }
+
+double tsproc_offset_variance(struct tsproc *tsp)
+{
+	if (!tsp->delay_var_count)
+		return 0.0;
+	/*
+	 * With the filtered delay, the offset carries the full jitter of
+	 * the sync path, which is about twice the variance of the mean
+	 * of both paths. The raw delay cancels half of it.
+	 */
+	return tsp->raw_mode ? tsp->delay_var : 2.0 * tsp->delay_var;
+}
@@ -40,10 +40,16 @@ enum tsproc_mode {
  * @param mode           Time stamp processing mode.
  * @param delay_filter   Type of the filter that will be applied to delay.
  * @param filter_length  Length of the filter.
+ * @param step_threshold Offset in seconds above which the outlier detector resets.
+ * @param outlier_length      Length of the outlier detector window.
+ * @param outlier_percentile  Percentile of the window used as clamp limit.
+ * @param outlier_hysteresis  Clamped offsets in a row accepted as a step.
  * @return               A pointer to a new tsproc on success, NULL otherwise.
  */
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length, double step_threshold);
+			     enum filter_type delay_filter, int filter_length, double step_threshold,
+			     int outlier_length, double outlier_percentile,
+			     int outlier_hysteresis);
 
 /**
  * Destroy a time stamp processor.
@@ -99,6 +105,14 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay);
  */
 int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight);
 
+/**
+ * Estimate the variance of the offsets from the variation of the measured
+ * delay, for servos which weigh the measurements by their noise.
+ * @param tsp    Pointer obtained via @ref tsproc_create().
+ * @return       The variance in ns^2, or 0.0 if no delay was measured yet.
+ */
+double tsproc_offset_variance(struct tsproc *tsp);
+
 /**
  * Reset a time stamp processor.
  * @param tsp    Pointer obtained via @ref tsproc_create().
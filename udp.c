@@ -216,6 +216,13 @@ static int udp_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp_recv_batch(struct transport *t, int fd, void *buf[],
+			  int buflen, struct address *addr[],
+			  struct hw_timestamp *hwts[], int cnt[], int n)
+{
+	return sk_receive_batch(fd, buf, buflen, addr, hwts, cnt, n);
+}
+
 static int udp_send(struct transport *t, struct fdarray *fda, int event,
 		    int peer, void *buf, int len, struct address *addr,
 		    struct hw_timestamp *hwts)
@@ -255,6 +262,31 @@ static int udp_send(struct transport *t, struct fdarray *fda, int event,
 	return event == TRANS_EVENT ? sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
 }
 
+static int udp_send_batch(struct transport *t, struct fdarray *fda,
+			  void *buf[], int len[], struct address *addr[], int n)
+{
+	struct address addr_buf;
+	int i;
+
+	memset(&addr_buf, 0, sizeof(addr_buf));
+	addr_buf.sin.sin_family = AF_INET;
+	addr_buf.sin.sin_addr = mcast_addr[MC_PRIMARY];
+
+	for (i = 0; i < n; i++) {
+		if (!addr[i])
+			addr[i] = &addr_buf;
+		addr[i]->sin.sin_port = htons(GENERAL_PORT);
+		addr[i]->len = sizeof(addr[i]->sin);
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], buf, len, addr, n);
+}
+
+static int udp_txts(struct transport *t, struct fdarray *fda, void *buf,
+		    int buflen, struct hw_timestamp *hwts)
+{
+	return sk_receive_txts(fda->fd[FD_EVENT], buf, buflen, hwts);
+}
+
 static void udp_release(struct transport *t)
 {
 	struct udp *udp = container_of(t, struct udp, t);
@@ -293,7 +325,10 @@ struct transport *udp_transport_create(void)
 	udp->t.close = udp_close;
 	udp->t.open  = udp_open;
 	udp->t.recv  = udp_recv;
+	udp->t.recv_batch = udp_recv_batch;
 	udp->t.send  = udp_send;
+	udp->t.send_batch = udp_send_batch;
+	udp->t.txts  = udp_txts;
 	udp->t.release = udp_release;
 	udp->t.physical_addr = udp_physical_addr;
 	udp->t.protocol_addr = udp_protocol_addr;
@@ -225,6 +225,13 @@ static int udp6_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp6_recv_batch(struct transport *t, int fd, void *buf[],
+			   int buflen, struct address *addr[],
+			   struct hw_timestamp *hwts[], int cnt[], int n)
+{
+	return sk_receive_batch(fd, buf, buflen, addr, hwts, cnt, n);
+}
+
 static int udp6_send(struct transport *t, struct fdarray *fda, int event,
 		    int peer, void *buf, int len, struct address *addr,
 		    struct hw_timestamp *hwts)
@@ -262,6 +269,36 @@ static int udp6_send(struct transport *t, struct fdarray *fda, int event,
 	return event == TRANS_EVENT ? sk_receive(fd, junk, len, NULL, hwts, MSG_ERRQUEUE) : cnt;
 }
 
+static int udp6_send_batch(struct transport *t, struct fdarray *fda,
+			   void *buf[], int len[], struct address *addr[],
+			   int n)
+{
+	struct udp6 *udp6 = container_of(t, struct udp6, t);
+	struct address addr_buf;
+	int i;
+
+	memset(&addr_buf, 0, sizeof(addr_buf));
+	addr_buf.sin6.sin6_family = AF_INET6;
+	addr_buf.sin6.sin6_addr = mc6_addr[MC_PRIMARY];
+	if (is_link_local(&addr_buf.sin6.sin6_addr))
+		addr_buf.sin6.sin6_scope_id = udp6->index;
+
+	for (i = 0; i < n; i++) {
+		if (!addr[i])
+			addr[i] = &addr_buf;
+		addr[i]->sin6.sin6_port = htons(GENERAL_PORT);
+		addr[i]->len = sizeof(addr[i]->sin6);
+		len[i] += 2; /* UDP checksum correction, as in udp6_send() */
+	}
+	return sk_send_batch(fda->fd[FD_GENERAL], buf, len, addr, n);
+}
+
+static int udp6_txts(struct transport *t, struct fdarray *fda, void *buf,
+		     int buflen, struct hw_timestamp *hwts)
+{
+	return sk_receive_txts(fda->fd[FD_EVENT], buf, buflen, hwts);
+}
+
 static void udp6_release(struct transport *t)
 {
 	struct udp6 *udp6 = container_of(t, struct udp6, t);
@@ -301,7 +338,10 @@ struct transport *udp6_transport_create(void)
 	udp6->t.close   = udp6_close;
 	udp6->t.open    = udp6_open;
 	udp6->t.recv    = udp6_recv;
+	udp6->t.recv_batch = udp6_recv_batch;
 	udp6->t.send    = udp6_send;
+	udp6->t.send_batch = udp6_send_batch;
+	udp6->t.txts    = udp6_txts;
 	udp6->t.release = udp6_release;
 	udp6->t.physical_addr = udp6_physical_addr;
 	udp6->t.protocol_addr = udp6_protocol_addr;